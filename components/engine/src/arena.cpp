@@ -0,0 +1,53 @@
+#include "arena.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+namespace DOM {
+
+    namespace {
+        constexpr size_t kMaxBlockSize = 1024 * 1024;
+    }
+
+    Arena::~Arena() {
+        while (m_blocks) {
+            Block* next = m_blocks->next;
+            std::free(m_blocks);
+            m_blocks = next;
+        }
+    }
+
+    void* Arena::allocate(size_t size, size_t align) {
+        uintptr_t cursor = reinterpret_cast<uintptr_t>(m_cursor);
+        uintptr_t aligned = (cursor + align - 1) & ~(uintptr_t(align) - 1);
+        if (!m_cursor || aligned + size > reinterpret_cast<uintptr_t>(m_end)) {
+            // Blocks grow geometrically up to a cap; an oversized request gets a block of its own.
+            size_t data_size = std::max(m_next_block_size, size + align);
+            m_next_block_size = std::min(m_next_block_size * 2, kMaxBlockSize);
+
+            size_t header = (sizeof(Block) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+            Block* block = static_cast<Block*>(std::malloc(header + data_size));
+            if (!block) throw std::bad_alloc();
+            block->next = m_blocks;
+            m_blocks = block;
+            m_cursor = reinterpret_cast<char*>(block) + header;
+            m_end = m_cursor + data_size;
+            m_bytes_reserved += header + data_size;
+            ++m_block_count;
+
+            cursor = reinterpret_cast<uintptr_t>(m_cursor);
+            aligned = (cursor + align - 1) & ~(uintptr_t(align) - 1);
+        }
+        m_cursor = reinterpret_cast<char*>(aligned + size);
+        m_bytes_used += size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    std::string_view Arena::copy_string(std::string_view s) {
+        if (s.empty()) return {};
+        char* data = static_cast<char*>(allocate(s.size(), 1));
+        std::memcpy(data, s.data(), s.size());
+        return std::string_view(data, s.size());
+    }
+}
\ No newline at end of file
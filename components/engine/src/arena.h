@@ -0,0 +1,60 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace DOM {
+
+    // Bump allocator that owns all memory of one document. Allocations are carved
+    // out of large blocks and are never freed one at a time: destroying the arena
+    // releases every block at once, without visiting the objects in them. Only
+    // trivially destructible types may live here.
+    class Arena {
+    public:
+        Arena() = default;
+        ~Arena();
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        void* allocate(size_t size, size_t align);
+
+        template<typename T, typename... Args>
+        T* make(Args&&... args) {
+            static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+            return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        template<typename T>
+        T* make_array(size_t count) {
+            static_assert(std::is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+            T* items = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+            for (size_t i = 0; i < count; ++i) new (items + i) T();
+            return items;
+        }
+
+        std::string_view copy_string(std::string_view s);
+
+        size_t bytes_used() const { return m_bytes_used; }
+        size_t bytes_reserved() const { return m_bytes_reserved; }
+        size_t block_count() const { return m_block_count; }
+
+    private:
+        struct Block {
+            Block* next;
+        };
+
+        Block* m_blocks = nullptr;
+        char* m_cursor = nullptr;
+        char* m_end = nullptr;
+        size_t m_next_block_size = 64 * 1024;
+        size_t m_bytes_used = 0;
+        size_t m_bytes_reserved = 0;
+        size_t m_block_count = 0;
+    };
+}
+
+#endif // ARENA_H
\ No newline at end of file
@@ -0,0 +1,83 @@
+#include "atom.h"
+
+namespace DOM {
+
+    namespace {
+        // FNV-1a. Names are short, so a byte loop is as fast as anything fancier.
+        uint32_t hash_name(std::string_view name) {
+            uint32_t hash = 2166136261u;
+            for (char c : name) {
+                hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+            }
+            return hash;
+        }
+    }
+
+    AtomTable& AtomTable::global() {
+        static AtomTable table;
+        return table;
+    }
+
+    AtomTable::AtomTable() {
+        m_slots.resize(1024, Slot{ 0, Atoms::Null });
+        m_names.emplace_back(); // Atoms::Null; never stored in a slot.
+#define DOM_INTERN_ATOM(identifier, name) add(name, hash_name(name));
+        DOM_PREDEFINED_ATOMS(DOM_INTERN_ATOM)
+#undef DOM_INTERN_ATOM
+    }
+
+    // The slot holding `name`, or the empty slot where it would go.
+    size_t AtomTable::find_slot(std::string_view name, uint32_t hash) const {
+        size_t mask = m_slots.size() - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            const Slot& slot = m_slots[i];
+            if (slot.atom == Atoms::Null) return i;
+            if (slot.hash == hash && m_names[slot.atom] == name) return i;
+        }
+    }
+
+    Atom AtomTable::add(std::string_view name, uint32_t hash) {
+        if ((m_names.size() + 1) * 4 > m_slots.size() * 3) grow();
+        Atom atom = static_cast<Atom>(m_names.size());
+        m_names.push_back(m_strings.copy_string(name));
+        m_slots[find_slot(name, hash)] = Slot{ hash, atom };
+        return atom;
+    }
+
+    void AtomTable::grow() {
+        std::vector<Slot> old(m_slots.size() * 2, Slot{ 0, Atoms::Null });
+        old.swap(m_slots);
+        size_t mask = m_slots.size() - 1;
+        for (const Slot& slot : old) {
+            if (slot.atom == Atoms::Null) continue;
+            size_t i = slot.hash & mask;
+            while (m_slots[i].atom != Atoms::Null) i = (i + 1) & mask;
+            m_slots[i] = slot;
+        }
+    }
+
+    Atom AtomTable::intern(std::string_view name) {
+        if (name.empty()) return Atoms::Null;
+        uint32_t hash = hash_name(name);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Atom atom = m_slots[find_slot(name, hash)].atom;
+        return atom != Atoms::Null ? atom : add(name, hash);
+    }
+
+    Atom AtomTable::find(std::string_view name) const {
+        if (name.empty()) return Atoms::Null;
+        uint32_t hash = hash_name(name);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_slots[find_slot(name, hash)].atom;
+    }
+
+    std::string_view AtomTable::name(Atom atom) const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return atom < m_names.size() ? m_names[atom] : std::string_view();
+    }
+
+    size_t AtomTable::size() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_names.size();
+    }
+}
\ No newline at end of file
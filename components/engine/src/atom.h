@@ -0,0 +1,79 @@
+#ifndef ATOM_H
+#define ATOM_H
+
+#include "arena.h"
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace DOM {
+
+    // An interned name. Two names are equal exactly when their atoms are, so tag,
+    // attribute, id and class comparisons become integer compares.
+    using Atom = uint32_t;
+
+    // Names the engine refers to directly. Their atoms are compile-time constants,
+    // e.g. DOM::Atoms::script, and can be used in switch statements.
+#define DOM_PREDEFINED_ATOMS(X) \
+    X(html, "html") X(head, "head") X(body, "body") X(title, "title") \
+    X(div, "div") X(p, "p") X(span, "span") X(a, "a") \
+    X(ul, "ul") X(ol, "ol") X(li, "li") X(dl, "dl") X(dt, "dt") X(dd, "dd") \
+    X(h1, "h1") X(h2, "h2") X(h3, "h3") X(h4, "h4") X(h5, "h5") X(h6, "h6") \
+    X(area, "area") X(base, "base") X(br, "br") X(col, "col") X(embed, "embed") X(hr, "hr") \
+    X(img, "img") X(input, "input") X(link, "link") X(meta, "meta") X(param, "param") \
+    X(source, "source") X(track, "track") X(wbr, "wbr") \
+    X(script, "script") X(style, "style") \
+    X(table, "table") X(tr, "tr") X(td, "td") X(th, "th") X(option, "option") X(select, "select") \
+    X(button, "button") X(address, "address") X(article, "article") X(aside, "aside") \
+    X(blockquote, "blockquote") X(fieldset, "fieldset") X(footer, "footer") X(form, "form") \
+    X(header, "header") X(main, "main") X(nav, "nav") X(pre, "pre") X(section, "section") \
+    X(id, "id") X(class_, "class") X(href, "href") X(src, "src") X(rel, "rel") X(type, "type")
+
+    namespace Atoms {
+        enum : Atom {
+            Null = 0, // The empty name; also "no atom".
+#define DOM_DECLARE_ATOM(identifier, name) identifier,
+            DOM_PREDEFINED_ATOMS(DOM_DECLARE_ATOM)
+#undef DOM_DECLARE_ATOM
+            PredefinedCount
+        };
+    }
+
+    // Process-wide intern table. Interning and lookups are thread-safe. Atoms are
+    // never released, so the table grows with the distinct names seen across pages.
+    class AtomTable {
+    public:
+        static AtomTable& global();
+
+        // Returns the atom for `name`, adding it if needed. Names are case-sensitive;
+        // callers lowercase tag and attribute names first.
+        Atom intern(std::string_view name);
+        // Returns the atom for `name`, or Atoms::Null if it was never interned.
+        Atom find(std::string_view name) const;
+        std::string_view name(Atom atom) const;
+        size_t size() const;
+
+    private:
+        AtomTable();
+        Atom add(std::string_view name, uint32_t hash);
+        size_t find_slot(std::string_view name, uint32_t hash) const;
+        void grow();
+
+        // Open-addressed index into m_names; an empty slot holds Atoms::Null.
+        struct Slot {
+            uint32_t hash;
+            Atom atom;
+        };
+
+        mutable std::mutex m_mutex;
+        Arena m_strings; // Names never move, so views handed out stay valid.
+        std::vector<std::string_view> m_names; // Indexed by atom.
+        std::vector<Slot> m_slots;
+    };
+
+    inline Atom intern(std::string_view name) { return AtomTable::global().intern(name); }
+    inline std::string_view atom_name(Atom atom) { return AtomTable::global().name(atom); }
+}
+
+#endif // ATOM_H
\ No newline at end of file
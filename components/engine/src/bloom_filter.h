@@ -0,0 +1,52 @@
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace Style {
+
+    // A counting Bloom filter over 32-bit hashes, so keys can be removed again as a
+    // tree walk leaves an element. Each key sets two counters, taken from the low and
+    // high bits of its hash. may_contain() has no false negatives; a counter that
+    // saturates is never decremented, which only costs precision.
+    template<unsigned KeyBits = 12>
+    class CountingBloomFilter {
+    public:
+        static constexpr size_t TableSize = size_t(1) << KeyBits;
+        static constexpr uint32_t KeyMask = TableSize - 1;
+        static constexpr uint8_t MaxCount = 0xFF;
+
+        void add(uint32_t hash) {
+            increment(m_counts[first_slot(hash)]);
+            increment(m_counts[second_slot(hash)]);
+        }
+
+        void remove(uint32_t hash) {
+            decrement(m_counts[first_slot(hash)]);
+            decrement(m_counts[second_slot(hash)]);
+        }
+
+        bool may_contain(uint32_t hash) const {
+            return m_counts[first_slot(hash)] && m_counts[second_slot(hash)];
+        }
+
+        void clear() { m_counts.fill(0); }
+
+    private:
+        std::array<uint8_t, TableSize> m_counts{};
+
+        static uint32_t first_slot(uint32_t hash) { return hash & KeyMask; }
+        static uint32_t second_slot(uint32_t hash) { return (hash >> 16) & KeyMask; }
+
+        static void increment(uint8_t& count) {
+            if (count != MaxCount) ++count;
+        }
+        static void decrement(uint8_t& count) {
+            if (count != 0 && count != MaxCount) --count;
+        }
+    };
+}
+
+#endif // BLOOM_FILTER_H
\ No newline at end of file
@@ -1,7 +1,85 @@
 // components/engine/src/css.cpp
 
 #include "css.h"
+#include "text_scanner.h"
+#include <array>
 
-// This file is intentionally left blank for now.
-// All CSS data structures are defined in the header file.
-// We might add implementation for helper functions here later.
\ No newline at end of file
+namespace CSS {
+
+    namespace {
+        using Scan::lower;
+        using Scan::equals_ignore_case;
+
+        // FNV-1a over the lowercased name, so lookups need no lowercase copy. The final
+        // mix spreads the seed into the low bits the table index is taken from.
+        constexpr uint32_t hash_name(std::string_view name, uint32_t seed) {
+            uint32_t hash = 2166136261u;
+            for (char c : name) {
+                hash = (hash ^ static_cast<unsigned char>(lower(c))) * 16777619u;
+            }
+            hash ^= seed;
+            hash = (hash ^ (hash >> 16)) * 0x45d9f3bu;
+            return hash ^ (hash >> 16);
+        }
+
+        // A collision-free hash table over a fixed set of names. The seed is searched
+        // for at compile time, so a lookup is one hash, one slot and one compare.
+        template<size_t N, size_t Size>
+        struct PerfectHashTable {
+            static_assert((Size & (Size - 1)) == 0, "Size must be a power of two");
+            static_assert(N < 255, "Slots store an 8-bit index");
+
+            std::array<std::string_view, N> names{};
+            std::array<uint8_t, Size> slots{}; // Index into names + 1; 0 is empty.
+            uint32_t seed = 0;
+
+            // Position of `name` in the name list + 1, or 0 if it isn't one of them.
+            constexpr size_t find(std::string_view name) const {
+                size_t slot = slots[hash_name(name, seed) & (Size - 1)];
+                return slot != 0 && equals_ignore_case(name, names[slot - 1]) ? slot : 0;
+            }
+        };
+
+        template<size_t Size, size_t N>
+        constexpr PerfectHashTable<N, Size> make_perfect_hash_table(const std::array<std::string_view, N>& names) {
+            PerfectHashTable<N, Size> table;
+            table.names = names;
+            for (uint32_t seed = 0;; ++seed) {
+                table.slots = {};
+                table.seed = seed;
+                bool collision = false;
+                for (size_t i = 0; i < N && !collision; ++i) {
+                    uint8_t& slot = table.slots[hash_name(names[i], seed) & (Size - 1)];
+                    collision = slot != 0;
+                    slot = static_cast<uint8_t>(i + 1);
+                }
+                if (!collision) return table;
+            }
+        }
+
+#define CSS_NAME(identifier, name) std::string_view(name),
+        constexpr std::array kPropertyNames{ CSS_PROPERTIES(CSS_NAME) };
+        constexpr std::array kKeywordNames{ CSS_KEYWORDS(CSS_NAME) };
+#undef CSS_NAME
+
+        constexpr auto kProperties = make_perfect_hash_table<64>(kPropertyNames);
+        constexpr auto kKeywords = make_perfect_hash_table<128>(kKeywordNames);
+
+        static_assert(kProperties.find("justify-content") == size_t(PropertyId::JustifyContent));
+        static_assert(kKeywords.find("Space-Between") == size_t(Keyword::SpaceBetween));
+        static_assert(kProperties.find("colour") == 0);
+    }
+
+    PropertyId property_id(std::string_view name) {
+        return static_cast<PropertyId>(kProperties.find(name));
+    }
+
+    std::string_view property_name(PropertyId property) {
+        size_t index = static_cast<size_t>(property);
+        return index > 0 && index <= kPropertyNames.size() ? kPropertyNames[index - 1] : std::string_view();
+    }
+
+    Keyword keyword_id(std::string_view name) {
+        return static_cast<Keyword>(kKeywords.find(name));
+    }
+}
\ No newline at end of file
@@ -1,7 +1,10 @@
 #ifndef CSS_H
 #define CSS_H
 
+#include "atom.h"
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <variant>
@@ -15,17 +18,88 @@ namespace CSS {
     enum class FlexDirection { Row, Column };
     enum class JustifyContent { FlexStart, FlexEnd, Center, SpaceBetween, SpaceAround };
 
-    // Value can now hold our new enum types
-    using Value = std::variant<std::string, float, Color, Display, FlexDirection, JustifyContent>;
+    // Lengths in absolute units (px, pt, pc, in, cm, mm, q) are converted to px when
+    // parsed and stored as a plain float. These depend on context and are kept as is.
+    // Number is a unitless line-height, which descendants inherit as the number.
+    enum class Unit : uint8_t { Em, Rem, Percent, Vw, Vh, Vmin, Vmax, Ex, Ch, Number };
+    struct Length {
+        float value = 0.0f;
+        Unit unit = Unit::Em;
+    };
+
+    // The properties the engine understands. Declarations of any other property are
+    // dropped by the parser.
+#define CSS_PROPERTIES(X) \
+    X(Display, "display") X(Color, "color") X(BackgroundColor, "background-color") \
+    X(FontSize, "font-size") X(FontFamily, "font-family") X(FontWeight, "font-weight") \
+    X(LineHeight, "line-height") X(Width, "width") X(Height, "height") \
+    X(Margin, "margin") X(MarginTop, "margin-top") X(MarginRight, "margin-right") \
+    X(MarginBottom, "margin-bottom") X(MarginLeft, "margin-left") \
+    X(Padding, "padding") X(PaddingTop, "padding-top") X(PaddingRight, "padding-right") \
+    X(PaddingBottom, "padding-bottom") X(PaddingLeft, "padding-left") \
+    X(FlexDirection, "flex-direction") X(JustifyContent, "justify-content")
+
+    enum class PropertyId : uint8_t {
+        Unknown,
+#define CSS_DECLARE_PROPERTY(identifier, name) identifier,
+        CSS_PROPERTIES(CSS_DECLARE_PROPERTY)
+#undef CSS_DECLARE_PROPERTY
+        Count
+    };
+
+    // Identifier values: display and flex keywords, CSS-wide keywords, named colors and
+    // font weights.
+#define CSS_KEYWORDS(X) \
+    X(Block, "block") X(Inline, "inline") X(Flex, "flex") X(None, "none") \
+    X(Row, "row") X(Column, "column") X(FlexStart, "flex-start") X(FlexEnd, "flex-end") \
+    X(Center, "center") X(SpaceBetween, "space-between") X(SpaceAround, "space-around") \
+    X(Auto, "auto") X(Inherit, "inherit") X(Initial, "initial") X(Transparent, "transparent") \
+    X(Black, "black") X(Silver, "silver") X(Gray, "gray") X(White, "white") \
+    X(Maroon, "maroon") X(Red, "red") X(Purple, "purple") X(Fuchsia, "fuchsia") \
+    X(Green, "green") X(Lime, "lime") X(Olive, "olive") X(Yellow, "yellow") \
+    X(Navy, "navy") X(Blue, "blue") X(Teal, "teal") X(Aqua, "aqua") X(Orange, "orange") \
+    X(Normal, "normal") X(Bold, "bold")
+
+    enum class Keyword : uint8_t {
+        Unknown,
+#define CSS_DECLARE_KEYWORD(identifier, name) identifier,
+        CSS_KEYWORDS(CSS_DECLARE_KEYWORD)
+#undef CSS_DECLARE_KEYWORD
+        Count
+    };
+
+    // Value can now hold our new enum types. Identifiers with no more specific meaning
+    // for the property, such as inherit or auto, are kept as their Keyword.
+    using Value = std::variant<std::string, float, Color, Display, FlexDirection, JustifyContent, Length, Keyword>;
+
+    // Case-insensitive lookups through compile-time perfect hash tables; Unknown if
+    // the name isn't in the table.
+    PropertyId property_id(std::string_view name);
+    std::string_view property_name(PropertyId property);
+    Keyword keyword_id(std::string_view name);
+
+    // Names are interned so matching compares atoms; Atoms::Null means "any".
+    struct CompoundSelector {
+        DOM::Atom tag = DOM::Atoms::Null;
+        DOM::Atom id = DOM::Atoms::Null;
+        std::vector<DOM::Atom> classes;
+    };
+
+    enum class Combinator : uint8_t { Descendant, Child };
 
-    struct Selector {
-        std::string tag_name;
-        std::string id;
-        std::vector<std::string> classes;
+    // A complex selector such as "#nav > ul a". The rightmost compound, the one the
+    // matched element itself must satisfy, is the base; `ancestors` holds the rest
+    // from right to left, each with the combinator joining it to its right neighbour.
+    struct Selector : CompoundSelector {
+        struct Ancestor {
+            Combinator combinator;
+            CompoundSelector compound;
+        };
+        std::vector<Ancestor> ancestors;
     };
 
     struct Declaration {
-        std::string property;
+        PropertyId property;
         Value value;
     };
 
@@ -1,7 +1,8 @@
 #include "css_parser.h"
-#include <cassert>
 #include <algorithm>
+#include <charconv>
 #include <iostream>
+#include <iterator>
 
 namespace CSS {
 
@@ -11,27 +12,20 @@ namespace CSS {
     bool Parser::eof() { return m_pos >= m_input.length(); }
     char Parser::consume_char() { return m_input[m_pos++]; }
 
-    std::string Parser::consume_while(std::function<bool(char)> test) {
-        std::string result;
-        while (!eof() && test(next_char())) {
-            result += consume_char();
-        }
-        return result;
+    std::string_view Parser::consume_until(const Scan::DelimiterSet& delimiters) {
+        size_t start = m_pos;
+        m_pos = Scan::find_first_of(m_input, m_pos, delimiters);
+        return std::string_view(m_input).substr(start, m_pos - start);
     }
 
     void Parser::consume_whitespace() {
-        while (!eof()) {
-            if (isspace(next_char())) {
-                consume_char();
-            } else if (m_input.substr(m_pos, 2) == "/*") {
-                consume_char(); consume_char();
-                while (!eof() && m_input.substr(m_pos, 2) != "*/") {
-                    consume_char();
-                }
-                consume_char(); consume_char();
-            } else {
+        while (true) {
+            m_pos = Scan::skip_whitespace(m_input, m_pos);
+            if (m_input.compare(m_pos, 2, "/*") != 0) {
                 break;
             }
+            size_t close = Scan::find_pair(m_input, m_pos + 2, '*', '/');
+            m_pos = std::min(close + 2, m_input.length());
         }
     }
 
@@ -45,6 +39,12 @@ namespace CSS {
         return sheet;
     }
 
+    std::vector<Selector> Parser::parse_selector_list() {
+        consume_whitespace();
+        if (eof()) return {};
+        return parse_selectors();
+    }
+
     Rule Parser::parse_rule() {
         Rule rule;
         rule.selectors = parse_selectors();
@@ -55,106 +55,285 @@ namespace CSS {
     std::vector<Selector> Parser::parse_selectors() {
         std::vector<Selector> selectors;
         while (true) {
-            selectors.push_back(parse_simple_selector());
-            consume_whitespace();
-            char next = next_char();
-            if (next == '{') {
-                // Start of declarations, we're done.
-                break;
-            } else if (next == ',') {
+            selectors.push_back(parse_complex_selector());
+            if (!eof() && next_char() == ',') {
                 // Another selector in the list, consume the comma and continue.
                 consume_char();
                 consume_whitespace();
-            } else if (eof()) {
-                // Should not happen, but break just in case.
-                break;
+                continue;
             }
-            // If it's not a '{' or a ',', it's a descendant selector (e.g. "nav p").
-            // We just continue the loop to parse the next part.
+            // Start of declarations, or the end of the input.
+            break;
         }
         return selectors;
     }
 
-    Selector Parser::parse_simple_selector() {
+    // Compounds are read left to right and stored right to left, the order they
+    // are matched in.
+    Selector Parser::parse_complex_selector() {
+        std::vector<Selector::Ancestor> ancestors;
+        CompoundSelector compound = parse_compound_selector();
+        while (true) {
+            consume_whitespace();
+            if (eof() || next_char() == ',' || next_char() == '{') break;
+            Combinator combinator = Combinator::Descendant;
+            if (next_char() == '>') {
+                consume_char();
+                consume_whitespace();
+                combinator = Combinator::Child;
+            }
+            ancestors.push_back(Selector::Ancestor{ combinator, std::move(compound) });
+            compound = parse_compound_selector();
+        }
+
         Selector selector;
-        // This function now correctly handles a single part of a selector, like '#nav' or 'p'
-        while (!eof() && !isspace(next_char()) && next_char() != ',' && next_char() != '{') {
+        static_cast<CompoundSelector&>(selector) = std::move(compound);
+        selector.ancestors.assign(std::make_move_iterator(ancestors.rbegin()), std::make_move_iterator(ancestors.rend()));
+        return selector;
+    }
+
+    CompoundSelector Parser::parse_compound_selector() {
+        CompoundSelector selector;
+        // A single part of a selector, like 'p', '#nav' or 'li.item.active'.
+        while (!eof() && !Scan::is_space(next_char()) && next_char() != ',' && next_char() != '{' && next_char() != '>') {
             if (next_char() == '#') {
                 consume_char();
-                selector.id = consume_while([](char c) { return isalnum(c) || c == '-'; });
+                selector.id = DOM::intern(consume_while([](char c) { return Scan::is_alnum(c) || c == '-'; }));
             } else if (next_char() == '.') {
                 consume_char();
-                selector.classes.push_back(consume_while([](char c) { return isalnum(c) || c == '-'; }));
+                selector.classes.push_back(DOM::intern(consume_while([](char c) { return Scan::is_alnum(c) || c == '-'; })));
+            } else if (Scan::is_alnum(next_char())) {
+                selector.tag = DOM::intern(consume_while([](char c) { return Scan::is_alnum(c); }));
             } else {
-                selector.tag_name = consume_while([](char c) { return isalnum(c); });
+                consume_char(); // Unsupported selector syntax; skip it rather than stall.
             }
         }
         return selector;
     }
 
     std::vector<Declaration> Parser::parse_declarations() {
-        assert(consume_char() == '{');
-        std::vector<Declaration> declarations;
+        if (!eof()) consume_char(); // '{'
+        m_declarations.clear();
         while (true) {
             consume_whitespace();
+            if (eof()) break;
             if (next_char() == '}') {
                 consume_char();
                 break;
             }
-            declarations.push_back(parse_declaration());
+            parse_declaration();
         }
-        return declarations;
+        // Collected in a reused buffer so each rule gets one exactly-sized allocation.
+        return std::vector<Declaration>(std::make_move_iterator(m_declarations.begin()),
+                                        std::make_move_iterator(m_declarations.end()));
     }
 
-    Color parse_hex_color(const std::string& hex_str) {
-        Color color;
-        if (hex_str.length() == 7 && hex_str[0] == '#') {
-            try {
-                color.r = std::stoul(hex_str.substr(1, 2), nullptr, 16);
-                color.g = std::stoul(hex_str.substr(3, 2), nullptr, 16);
-                color.b = std::stoul(hex_str.substr(5, 2), nullptr, 16);
-            } catch (...) {}
+    namespace {
+        using Scan::equals_ignore_case;
+        using Scan::trim;
+
+        // Parses a number at the start of `text` and advances past it. Unlike
+        // from_chars alone, accepts a leading '+'.
+        bool consume_number(std::string_view& text, float& value) {
+            const char* begin = text.data();
+            const char* end = begin + text.size();
+            if (begin != end && *begin == '+') ++begin;
+            auto [ptr, ec] = std::from_chars(begin, end, value);
+            if (ec != std::errc()) return false;
+            text.remove_prefix(ptr - text.data());
+            return true;
+        }
+
+        // #rgb, #rgba, #rrggbb and #rrggbbaa, without the '#'.
+        bool parse_hex_color(std::string_view hex, Color& color) {
+            size_t digits = (hex.length() == 3 || hex.length() == 4) ? 1 : (hex.length() == 6 || hex.length() == 8) ? 2 : 0;
+            if (digits == 0) return false;
+            uint8_t channels[4] = { 0, 0, 0, 255 };
+            for (size_t i = 0; i * digits < hex.length(); ++i) {
+                const char* begin = hex.data() + i * digits;
+                unsigned value = 0;
+                auto [ptr, ec] = std::from_chars(begin, begin + digits, value, 16);
+                if (ec != std::errc() || ptr != begin + digits) return false;
+                channels[i] = static_cast<uint8_t>(digits == 1 ? value * 17 : value);
+            }
+            color = Color{ channels[0], channels[1], channels[2], channels[3] };
+            return true;
         }
-        return color;
-    }
 
-    Declaration Parser::parse_declaration() {
-        Declaration decl;
-        decl.property = consume_while([](char c) { return c != ':'; });
-        decl.property.erase(0, decl.property.find_first_not_of(" \t\n\r"));
-        decl.property.erase(decl.property.find_last_not_of(" \t\n\r") + 1);
-        std::transform(decl.property.begin(), decl.property.end(), decl.property.begin(), ::tolower);
+        // rgb(r, g, b), rgba(r, g, b, a) and the space-separated rgb(r g b / a).
+        // Channels may be numbers or percentages; alpha is 0-1 or a percentage.
+        bool parse_rgb_function(std::string_view text, Color& color) {
+            size_t open = text.find('(');
+            if (open == std::string_view::npos || text.back() != ')') return false;
+            std::string_view name = trim(text.substr(0, open));
+            if (!equals_ignore_case(name, "rgb") && !equals_ignore_case(name, "rgba")) return false;
 
-        assert(consume_char() == ':');
+            std::string_view args = text.substr(open + 1, text.length() - open - 2);
+            float channels[4] = { 0, 0, 0, 1 };
+            int count = 0;
+            while (true) {
+                while (!args.empty() && (Scan::is_space(args.front()) || args.front() == ',' || args.front() == '/')) {
+                    args.remove_prefix(1);
+                }
+                if (args.empty()) break;
+                if (count == 4 || !consume_number(args, channels[count])) return false;
+                bool percent = !args.empty() && args.front() == '%';
+                if (percent) {
+                    args.remove_prefix(1);
+                    channels[count] *= count < 3 ? 2.55f : 0.01f;
+                }
+                ++count;
+            }
+            if (count < 3) return false;
+
+            auto clamp = [](float v, float hi) { return static_cast<uint8_t>(std::min(std::max(v, 0.0f), hi) + 0.5f); };
+            color = Color{ clamp(channels[0], 255), clamp(channels[1], 255), clamp(channels[2], 255), clamp(channels[3] * 255, 255) };
+            return true;
+        }
+
+        bool named_color(Keyword keyword, Color& color) {
+            switch (keyword) {
+                case Keyword::Transparent: color = Color{ 0, 0, 0, 0 }; return true;
+                case Keyword::Black: color = Color{ 0, 0, 0 }; return true;
+                case Keyword::Silver: color = Color{ 192, 192, 192 }; return true;
+                case Keyword::Gray: color = Color{ 128, 128, 128 }; return true;
+                case Keyword::White: color = Color{ 255, 255, 255 }; return true;
+                case Keyword::Maroon: color = Color{ 128, 0, 0 }; return true;
+                case Keyword::Red: color = Color{ 255, 0, 0 }; return true;
+                case Keyword::Purple: color = Color{ 128, 0, 128 }; return true;
+                case Keyword::Fuchsia: color = Color{ 255, 0, 255 }; return true;
+                case Keyword::Green: color = Color{ 0, 128, 0 }; return true;
+                case Keyword::Lime: color = Color{ 0, 255, 0 }; return true;
+                case Keyword::Olive: color = Color{ 128, 128, 0 }; return true;
+                case Keyword::Yellow: color = Color{ 255, 255, 0 }; return true;
+                case Keyword::Navy: color = Color{ 0, 0, 128 }; return true;
+                case Keyword::Blue: color = Color{ 0, 0, 255 }; return true;
+                case Keyword::Teal: color = Color{ 0, 128, 128 }; return true;
+                case Keyword::Aqua: color = Color{ 0, 255, 255 }; return true;
+                case Keyword::Orange: color = Color{ 255, 165, 0 }; return true;
+                default: return false;
+            }
+        }
+
+        // A number with an optional unit. Unitless numbers and absolute units become
+        // px floats; relative units are kept as a Length.
+        bool parse_length(std::string_view text, Value& value) {
+            float number = 0.0f;
+            if (!consume_number(text, number)) return false;
+
+            struct UnitName { std::string_view name; float px; Unit unit; };
+            static constexpr UnitName units[] = {
+                { "", 1.0f, Unit::Em }, { "px", 1.0f, Unit::Em }, { "pt", 96.0f / 72.0f, Unit::Em },
+                { "pc", 16.0f, Unit::Em }, { "in", 96.0f, Unit::Em }, { "cm", 96.0f / 2.54f, Unit::Em },
+                { "mm", 96.0f / 25.4f, Unit::Em }, { "q", 96.0f / 101.6f, Unit::Em },
+                { "em", 0.0f, Unit::Em }, { "rem", 0.0f, Unit::Rem }, { "%", 0.0f, Unit::Percent },
+                { "vw", 0.0f, Unit::Vw }, { "vh", 0.0f, Unit::Vh }, { "vmin", 0.0f, Unit::Vmin },
+                { "vmax", 0.0f, Unit::Vmax }, { "ex", 0.0f, Unit::Ex }, { "ch", 0.0f, Unit::Ch },
+            };
+            for (const UnitName& unit : units) {
+                if (!equals_ignore_case(text, unit.name)) continue;
+                if (unit.px > 0.0f) value = number * unit.px;
+                else value = Length{ number, unit.unit };
+                return true;
+            }
+            return false;
+        }
+
+        Value parse_value(PropertyId property, std::string_view text) {
+            Keyword keyword = keyword_id(text);
+            if (keyword == Keyword::Inherit || keyword == Keyword::Initial) return keyword;
+            switch (property) {
+                case PropertyId::Display:
+                    if (keyword == Keyword::Flex) return Display::Flex;
+                    if (keyword == Keyword::None) return Display::None;
+                    if (keyword == Keyword::Inline) return Display::Inline;
+                    return Display::Block;
+                case PropertyId::FlexDirection:
+                    return keyword == Keyword::Column ? FlexDirection::Column : FlexDirection::Row;
+                case PropertyId::JustifyContent:
+                    if (keyword == Keyword::FlexEnd) return JustifyContent::FlexEnd;
+                    if (keyword == Keyword::Center) return JustifyContent::Center;
+                    if (keyword == Keyword::SpaceBetween) return JustifyContent::SpaceBetween;
+                    if (keyword == Keyword::SpaceAround) return JustifyContent::SpaceAround;
+                    return JustifyContent::FlexStart;
+                case PropertyId::FontWeight:
+                    if (keyword == Keyword::Normal) return 400.0f;
+                    if (keyword == Keyword::Bold) return 700.0f;
+                    break;
+                case PropertyId::LineHeight: {
+                    // Unlike em, a unitless line-height scales with each element's own font.
+                    float number = 0.0f;
+                    std::string_view rest = text;
+                    if (consume_number(rest, number) && rest.empty()) return Length{ number, Unit::Number };
+                    break;
+                }
+                default:
+                    break;
+            }
+
+            Color color;
+            if (!text.empty() && text[0] == '#') {
+                if (parse_hex_color(text.substr(1), color)) return color;
+            } else if (named_color(keyword, color) || parse_rgb_function(text, color)) {
+                return color;
+            }
+            Value value;
+            if (parse_length(text, value)) return value;
+            if (keyword != Keyword::Unknown) return keyword;
+            return std::string(text);
+        }
+
+        // The longhands a margin or padding value of 1-4 components sets, in
+        // top, right, bottom, left order.
+        size_t split_box_sides(std::string_view text, std::string_view (&sides)[4]) {
+            std::string_view parts[4];
+            size_t count = 0;
+            while (true) {
+                while (!text.empty() && Scan::is_space(text.front())) text.remove_prefix(1);
+                if (text.empty()) break;
+                if (count == 4) return 0;
+                size_t end = 0;
+                while (end < text.length() && !Scan::is_space(text[end])) ++end;
+                parts[count++] = text.substr(0, end);
+                text.remove_prefix(end);
+            }
+            static constexpr size_t order[5][4] = { {}, { 0, 0, 0, 0 }, { 0, 1, 0, 1 }, { 0, 1, 2, 1 }, { 0, 1, 2, 3 } };
+            for (size_t i = 0; i < 4; ++i) sides[i] = parts[order[count][i]];
+            return count;
+        }
+    }
+
+    // Declarations of properties the engine doesn't know are dropped; margin and
+    // padding are expanded into their longhands.
+    void Parser::parse_declaration() {
+        std::string_view name = trim(consume_until({':', ';', '}'}));
+        if (!eof() && next_char() == ':') consume_char();
         consume_whitespace();
-        std::string value_str = consume_while([](char c) { return c != ';'; });
-        value_str.erase(0, value_str.find_first_not_of(" \t\n\r"));
-        value_str.erase(value_str.find_last_not_of(" \t\n\r") + 1);
-
-        if (decl.property == "display") {
-            if (value_str == "flex") decl.value = Display::Flex;
-            else if (value_str == "none") decl.value = Display::None;
-            else decl.value = Display::Block;
-        } else if (decl.property == "flex-direction") {
-            if (value_str == "column") decl.value = FlexDirection::Column;
-            else decl.value = FlexDirection::Row;
-        } else if (decl.property == "justify-content") {
-            if (value_str == "flex-end") decl.value = JustifyContent::FlexEnd;
-            else if (value_str == "center") decl.value = JustifyContent::Center;
-            else if (value_str == "space-between") decl.value = JustifyContent::SpaceBetween;
-            else if (value_str == "space-around") decl.value = JustifyContent::SpaceAround;
-            else decl.value = JustifyContent::FlexStart;
-        } else if (value_str.length() > 0 && value_str[0] == '#') {
-            decl.value = parse_hex_color(value_str);
-        } else if (value_str.length() > 2 && value_str.substr(value_str.length() - 2) == "px") {
-            try {
-                decl.value = std::stof(value_str.substr(0, value_str.length() - 2));
-            } catch (...) { decl.value = value_str; }
-        } else {
-            decl.value = value_str;
+        // A missing ';' before '}' ends the declaration instead of swallowing the next rule.
+        std::string_view value = trim(consume_until({';', '}'}));
+        if (!eof() && next_char() == ';') consume_char();
+
+        PropertyId property = property_id(name);
+        if (property == PropertyId::Unknown) return;
+
+        // Priorities aren't implemented; an !important value applies like any other.
+        constexpr std::string_view important = "!important";
+        if (value.length() >= important.length() &&
+            equals_ignore_case(value.substr(value.length() - important.length()), important)) {
+            value = trim(value.substr(0, value.length() - important.length()));
         }
 
-        assert(consume_char() == ';');
-        return decl;
+        if (property == PropertyId::Margin || property == PropertyId::Padding) {
+            static constexpr PropertyId margins[4] = { PropertyId::MarginTop, PropertyId::MarginRight, PropertyId::MarginBottom, PropertyId::MarginLeft };
+            static constexpr PropertyId paddings[4] = { PropertyId::PaddingTop, PropertyId::PaddingRight, PropertyId::PaddingBottom, PropertyId::PaddingLeft };
+            const PropertyId* longhands = property == PropertyId::Margin ? margins : paddings;
+            std::string_view sides[4];
+            if (split_box_sides(value, sides) == 0) return;
+            for (size_t i = 0; i < 4; ++i) {
+                m_declarations.push_back(Declaration{ longhands[i], parse_value(longhands[i], sides[i]) });
+            }
+            return;
+        }
+        m_declarations.push_back(Declaration{ property, parse_value(property, value) });
     }
 }
\ No newline at end of file
@@ -2,31 +2,45 @@
 #define CSS_PARSER_H
 
 #include "css.h"
+#include "text_scanner.h"
 #include <string>
-#include <functional> 
+#include <string_view>
 
 namespace CSS {
     class Parser {
     public:
         Parser(std::string input);
         Stylesheet parse_stylesheet();
+        // A selector list on its own, as passed to querySelector().
+        std::vector<Selector> parse_selector_list();
 
     private:
         std::string m_input;
         size_t m_pos = 0;
+        std::vector<Declaration> m_declarations;
 
         char next_char();
         bool eof();
         char consume_char();
-        // This line now works because we included <functional>
-        std::string consume_while(std::function<bool(char)> test);
+
+        template<typename Pred>
+        std::string_view consume_while(Pred test) {
+            size_t start = m_pos;
+            while (m_pos < m_input.length() && test(m_input[m_pos])) {
+                ++m_pos;
+            }
+            return std::string_view(m_input).substr(start, m_pos - start);
+        }
+
+        std::string_view consume_until(const Scan::DelimiterSet& delimiters);
         void consume_whitespace();
 
         Rule parse_rule();
         std::vector<Selector> parse_selectors();
-        Selector parse_simple_selector();
+        Selector parse_complex_selector();
+        CompoundSelector parse_compound_selector();
         std::vector<Declaration> parse_declarations();
-        Declaration parse_declaration();
+        void parse_declaration();
     };
 }
 
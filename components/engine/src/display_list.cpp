@@ -0,0 +1,51 @@
+#include "display_list.h"
+
+namespace Paint {
+
+    void DisplayList::clear() {
+        m_items.clear();
+        m_box_items.clear();
+    }
+
+    void DisplayList::build(const Layout::LayoutTree& tree) {
+        clear();
+        m_box_items.resize(tree.size());
+        if (tree.empty()) return;
+
+        // The same preorder walk the spatial index makes.
+        Layout::BoxId box = tree.root();
+        while (box != Layout::NoBox) {
+            const Layout::Rect& rect = tree.rect(box);
+            const Style::ComputedStyle& style = *tree.styled_node(box)->style;
+            Layout::BoxType box_type = tree.box_type(box);
+            ItemRange& range = m_box_items[box];
+            range.first = static_cast<uint32_t>(m_items.size());
+
+            if (box_type == Layout::BoxType::Block || box_type == Layout::BoxType::Flex) {
+                const CSS::Color& background = style.background->background_color;
+                if (background.a > 0 && rect.width > 0.0f && rect.height > 0.0f) {
+                    m_items.push_back(DisplayItem{ ItemType::SolidRect, background, rect.x, rect.y, rect.width, rect.height,
+                                                   0.0f, nullptr, 0 });
+                }
+            } else if (box_type == Layout::BoxType::Anonymous && tree.text_run(box)) {
+                const Style::InheritedStyle& text_style = *style.inherited;
+                float line_height = text_style.used_line_height();
+                const char* text = tree.text_run(box)->text.data();
+                const Layout::TextLine* lines = tree.lines(box);
+                for (uint32_t i = 0; i < tree.line_count(box); ++i) {
+                    m_items.push_back(DisplayItem{ ItemType::Text, text_style.color, rect.x, rect.y + i * line_height,
+                                                   lines[i].width, line_height, text_style.font_size,
+                                                   text + lines[i].start, lines[i].length });
+                }
+            }
+            range.count = static_cast<uint32_t>(m_items.size()) - range.first;
+
+            if (tree.first_child(box) != Layout::NoBox) {
+                box = tree.first_child(box);
+                continue;
+            }
+            while (box != Layout::NoBox && tree.next_sibling(box) == Layout::NoBox) box = tree.parent(box);
+            if (box != Layout::NoBox) box = tree.next_sibling(box);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef DISPLAY_LIST_H
+#define DISPLAY_LIST_H
+
+#include "layout.h"
+#include <cstdint>
+#include <vector>
+
+namespace Paint {
+
+    enum class ItemType : uint8_t { SolidRect, Text };
+
+    // One drawing command, in page coordinates. A Text item is one laid out line:
+    // `x`, `y` is its top left corner and `text` points into the box's text run.
+    struct DisplayItem {
+        ItemType type;
+        CSS::Color color;
+        float x, y, width, height;
+        float font_size;
+        const char* text;
+        uint32_t text_length;
+    };
+
+    // What painting the tree comes down to, flattened into commands in paint order,
+    // with every style value it needs copied in. It is built once per layout or style
+    // change, and a frame only replays the items of the boxes in view. Text items
+    // point into text runs, which the tree keeps alive until it changes again.
+    class DisplayList {
+    public:
+        void build(const Layout::LayoutTree& tree);
+        void clear();
+
+        const std::vector<DisplayItem>& items() const { return m_items; }
+        // The items a box paints are consecutive; `first` indexes items().
+        uint32_t first_item(Layout::BoxId box) const { return m_box_items[box].first; }
+        uint32_t item_count(Layout::BoxId box) const { return m_box_items[box].count; }
+
+    private:
+        struct ItemRange {
+            uint32_t first = 0;
+            uint32_t count = 0;
+        };
+
+        std::vector<DisplayItem> m_items;
+        std::vector<ItemRange> m_box_items; // By box; boxes that paint nothing have none.
+    };
+}
+
+#endif // DISPLAY_LIST_H
\ No newline at end of file
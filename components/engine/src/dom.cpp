@@ -1,19 +1,326 @@
 #include "dom.h"
+#include "text_scanner.h"
+#include <vector>
+#include <algorithm>
 
 namespace DOM {
-    std::unique_ptr<Node> create_text_node(const std::string& data) {
-        auto node = std::make_unique<Node>();
+    namespace {
+        size_t depth_of(const Node* node) {
+            size_t depth = 0;
+            for (; node->parent; node = node->parent) ++depth;
+            return depth;
+        }
+
+        // Whether `node` comes before the end of `parent`'s subtree in document order.
+        // Costs the depth of the two nodes plus the distance between the siblings
+        // where their ancestor chains meet, or from the later one to the end.
+        bool before_end_of(const Node* node, const Node* parent) {
+            const Node* a = node;
+            const Node* b = parent;
+            size_t depth_a = depth_of(a), depth_b = depth_of(b);
+            for (; depth_a > depth_b; --depth_a) a = a->parent;
+            for (; depth_b > depth_a; --depth_b) b = b->parent;
+            // Inside `parent`'s subtree, or one of its ancestors.
+            if (a == b) return true;
+            while (a->parent != b->parent) {
+                a = a->parent;
+                b = b->parent;
+            }
+            for (const Node *from_a = a, *from_b = b;;) {
+                from_a = from_a->next_sibling;
+                from_b = from_b->next_sibling;
+                if (from_a == b || !from_b) return true;
+                if (from_b == a || !from_a) return false;
+            }
+        }
+    }
+
+    bool ElementData::has_class(Atom name) const {
+        for (uint16_t i = 0; i < class_count; ++i) {
+            if (classes[i] == name) return true;
+        }
+        return false;
+    }
+
+    const Attr* ElementData::find_attribute(Atom name) const {
+        for (uint32_t i = 0; i < attribute_count; ++i) {
+            if (attributes[i].name == name) return &attributes[i];
+        }
+        return nullptr;
+    }
+
+    std::string_view ElementData::get_attribute(Atom name) const {
+        const Attr* attr = find_attribute(name);
+        return attr ? attr->value : std::string_view();
+    }
+
+    std::string_view ElementData::get_attribute(std::string_view name) const {
+        // A name that was never interned can't be on any element.
+        Atom atom = AtomTable::global().find(name);
+        return atom != Atoms::Null ? get_attribute(atom) : std::string_view();
+    }
+
+    Document::~Document() {
+        // Copied: an observer may remove itself when told.
+        std::vector<DocumentObserver*> observers = m_observers;
+        for (DocumentObserver* observer : observers) observer->document_destroyed(this);
+    }
+
+    void Document::add_observer(DocumentObserver* observer) {
+        m_observers.push_back(observer);
+    }
+
+    void Document::remove_observer(DocumentObserver* observer) {
+        m_observers.erase(std::remove(m_observers.begin(), m_observers.end(), observer), m_observers.end());
+    }
+
+    Node* Document::allocate_node() {
+        Node* node;
+        if (m_free_nodes) {
+            node = m_free_nodes;
+            m_free_nodes = node->next_sibling;
+            --m_free_node_count;
+            *node = Node();
+        } else {
+            node = m_arena.make<Node>();
+        }
+        ++m_node_count;
+        return node;
+    }
+
+    Node* Document::create_text_node(std::string_view data) {
+        Node* node = allocate_node();
         node->type = NodeType::Text;
-        node->text_data = data;
+        node->text_data = m_arena.copy_string(data);
         return node;
     }
 
-    std::unique_ptr<Node> create_element_node(const std::string& name, AttrMap attrs, std::vector<std::unique_ptr<Node>> children) {
-        auto node = std::make_unique<Node>();
+    Node* Document::create_element_node(Atom tag, const Attr* attrs, size_t attr_count) {
+        Node* node = allocate_node();
         node->type = NodeType::Element;
-        node->element_data.tag_name = name;
-        node->element_data.attributes = std::move(attrs);
-        node->children = std::move(children);
+        ElementData& element = node->element_data;
+        element.tag = tag;
+        if (attr_count == 0) return node;
+
+        Attr* copied = m_arena.make_array<Attr>(attr_count);
+        for (size_t i = 0; i < attr_count; ++i) {
+            copied[i].name = attrs[i].name;
+            copied[i].value = m_arena.copy_string(attrs[i].value);
+
+            if (attrs[i].name == Atoms::id) {
+                element.id = intern(attrs[i].value);
+            } else if (attrs[i].name == Atoms::class_) {
+                element.classes = split_class_list(attrs[i].value, element.class_count);
+            }
+        }
+        element.attributes = copied;
+        element.attribute_count = static_cast<uint32_t>(attr_count);
         return node;
     }
+
+    const Atom* Document::split_class_list(std::string_view value, uint16_t& count) {
+        using Scan::is_space;
+        auto next_token = [&](size_t& pos) {
+            while (pos < value.size() && is_space(value[pos])) ++pos;
+            size_t start = pos;
+            while (pos < value.size() && !is_space(value[pos])) ++pos;
+            return value.substr(start, pos - start);
+        };
+
+        size_t tokens = 0;
+        for (size_t pos = 0; !next_token(pos).empty();) ++tokens;
+        count = static_cast<uint16_t>(std::min<size_t>(tokens, UINT16_MAX));
+        if (count == 0) return nullptr;
+
+        Atom* classes = m_arena.make_array<Atom>(count);
+        size_t pos = 0;
+        for (uint16_t i = 0; i < count; ++i) classes[i] = intern(next_token(pos));
+        return classes;
+    }
+
+    void Document::append_child(Node* parent, Node* child) {
+        Node*& first = parent ? parent->first_child : m_first_top_level;
+        Node*& last = parent ? parent->last_child : m_last_top_level;
+        child->parent = parent;
+        child->prev_sibling = last;
+        child->next_sibling = nullptr;
+        if (last) last->next_sibling = child;
+        else first = child;
+        last = child;
+
+        if (parent && !parent->connected) return;
+        if (m_index_stale) {
+            connect_subtree(child);
+            return;
+        }
+        // Appending below an ancestor of the last node puts the subtree at the end of the
+        // document. Each node on the walk up stops being on that rightmost path, so a
+        // sequence of appends in document order costs O(1) amortized.
+        Node* ancestor = m_last_node;
+        while (parent && ancestor && ancestor != parent) ancestor = ancestor->parent;
+        if (parent && ancestor != parent) {
+            insert_subtree(child);
+        } else {
+            index_subtree(child);
+        }
+    }
+
+    void Document::connect_subtree(Node* root) {
+        root->connected = true;
+        if (!root->has_children()) return;
+        std::vector<Node*> pending{ root };
+        while (!pending.empty()) {
+            Node* node = pending.back();
+            pending.pop_back();
+            node->connected = true;
+            for (Node* child : node->children()) pending.push_back(child);
+        }
+    }
+
+    // Marks `root` and its descendants connected and adds their elements to the
+    // indexes in document order. Leaves m_last_node at the subtree's last node.
+    void Document::index_subtree(Node* root) {
+        if (!root->has_children()) {
+            // What the parser appends: a node on its own.
+            root->connected = true;
+            m_last_node = root;
+            if (root->type == NodeType::Element) index_element(root);
+            return;
+        }
+        std::vector<Node*> pending{ root };
+        while (!pending.empty()) {
+            Node* node = pending.back();
+            pending.pop_back();
+            node->connected = true;
+            m_last_node = node;
+            if (node->type == NodeType::Element) index_element(node);
+            for (Node* child = node->last_child; child; child = child->prev_sibling) {
+                pending.push_back(child);
+            }
+        }
+    }
+
+    // Marks `root`, appended somewhere before the last node, and its descendants
+    // connected, and inserts their elements into the indexes at their position in
+    // document order. Text, what innerHTML appends, leaves the indexes as they are.
+    void Document::insert_subtree(Node* root) {
+        std::vector<Node*> elements;
+        std::vector<Node*> pending{ root };
+        while (!pending.empty()) {
+            Node* node = pending.back();
+            pending.pop_back();
+            node->connected = true;
+            if (node->type == NodeType::Element) elements.push_back(node);
+            for (Node* child = node->last_child; child; child = child->prev_sibling) {
+                pending.push_back(child);
+            }
+        }
+
+        // Every indexed node is either before the end of the parent's subtree, which
+        // ends with `root`, or after it. Elements of the subtree itself are inserted
+        // in document order, so each lands after the ones before it.
+        const Node* parent = root->parent;
+        auto insert = [parent](std::vector<Node*>& nodes, Node* element) {
+            auto position = std::partition_point(nodes.begin(), nodes.end(),
+                                                 [parent](const Node* node) { return before_end_of(node, parent); });
+            nodes.insert(position, element);
+        };
+        for (Node* element : elements) {
+            const ElementData& data = element->element_data;
+            insert(m_tag_index[data.tag], element);
+            if (data.id != Atoms::Null) insert(m_id_index[data.id], element);
+            for (uint16_t i = 0; i < data.class_count; ++i) {
+                insert(m_class_index[data.classes[i]], element);
+            }
+        }
+    }
+
+    void Document::index_element(Node* element) {
+        const ElementData& data = element->element_data;
+        m_tag_index[data.tag].push_back(element);
+        if (data.id != Atoms::Null) m_id_index[data.id].push_back(element);
+        for (uint16_t i = 0; i < data.class_count; ++i) {
+            m_class_index[data.classes[i]].push_back(element);
+        }
+    }
+
+    void Document::rebuild_indexes() {
+        m_id_index.clear();
+        m_class_index.clear();
+        m_tag_index.clear();
+        m_last_node = nullptr;
+        for (Node* node : top_level_nodes()) index_subtree(node);
+        m_index_stale = false;
+    }
+
+    void Document::remove_children(Node* parent) {
+        std::vector<Node*> pending;
+        for (Node* child : parent->children()) pending.push_back(child);
+        parent->first_child = parent->last_child = nullptr;
+
+        // Index lists are filtered once per affected name rather than once per node.
+        std::vector<std::pair<NodeIndex*, Atom>> stale;
+        bool removed_last = false;
+        while (!pending.empty()) {
+            Node* node = pending.back();
+            pending.pop_back();
+            for (Node* child : node->children()) pending.push_back(child);
+            for (DocumentObserver* observer : m_observers) observer->node_removed(node);
+            if (!m_index_stale && node->connected && node->type == NodeType::Element) {
+                const ElementData& data = node->element_data;
+                stale.emplace_back(&m_tag_index, data.tag);
+                if (data.id != Atoms::Null) stale.emplace_back(&m_id_index, data.id);
+                for (uint16_t i = 0; i < data.class_count; ++i) {
+                    stale.emplace_back(&m_class_index, data.classes[i]);
+                }
+            }
+            removed_last = removed_last || node == m_last_node;
+            node->connected = false;
+            node->next_sibling = m_free_nodes;
+            m_free_nodes = node;
+            ++m_free_node_count;
+            --m_node_count;
+        }
+
+        std::sort(stale.begin(), stale.end());
+        stale.erase(std::unique(stale.begin(), stale.end()), stale.end());
+        for (const auto& [index, name] : stale) {
+            auto it = index->find(name);
+            if (it == index->end()) continue;
+            std::vector<Node*>& nodes = it->second;
+            nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [](Node* node) { return !node->connected; }), nodes.end());
+            if (nodes.empty()) index->erase(it);
+        }
+        if (removed_last) m_last_node = parent;
+    }
+
+    Node* Document::element_by_id(Atom id) {
+        if (m_index_stale) rebuild_indexes();
+        auto it = m_id_index.find(id);
+        return it != m_id_index.end() ? it->second.front() : nullptr;
+    }
+
+    const std::vector<Node*>& Document::elements_by_class(Atom name) {
+        static const std::vector<Node*> none;
+        if (m_index_stale) rebuild_indexes();
+        auto it = m_class_index.find(name);
+        return it != m_class_index.end() ? it->second : none;
+    }
+
+    const std::vector<Node*>& Document::elements_by_tag(Atom tag) {
+        static const std::vector<Node*> none;
+        if (m_index_stale) rebuild_indexes();
+        auto it = m_tag_index.find(tag);
+        return it != m_tag_index.end() ? it->second : none;
+    }
+
+    DocumentStats Document::stats() const {
+        DocumentStats stats;
+        stats.node_count = m_node_count;
+        stats.free_node_count = m_free_node_count;
+        stats.arena_bytes_used = m_arena.bytes_used();
+        stats.arena_bytes_reserved = m_arena.bytes_reserved();
+        stats.arena_block_count = m_arena.block_count();
+        return stats;
+    }
 }
\ No newline at end of file
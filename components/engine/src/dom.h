@@ -1,20 +1,41 @@
 #ifndef DOM_H
 #define DOM_H
 
-#include <string>
+#include "arena.h"
+#include "atom.h"
+#include <string_view>
+#include <cstdint>
+#include <unordered_map>
 #include <vector>
-#include <map>
-#include <memory>
 
 namespace DOM {
 
     struct Node; // Forward declaration
 
-    using AttrMap = std::map<std::string, std::string>;
+    // The value points into the owning document's arena.
+    struct Attr {
+        Atom name;
+        std::string_view value;
+    };
 
+    // Attributes are one flat array, allocated in the arena right after the element.
+    // The id and the class list are also interned when the element is created, since
+    // selector matching and getElementById only ever compare them.
     struct ElementData {
-        std::string tag_name;
-        AttrMap attributes;
+        Atom tag = Atoms::Null;
+        Atom id = Atoms::Null;
+        uint16_t class_count = 0;
+        uint32_t attribute_count = 0;
+        const Atom* classes = nullptr;
+        const Attr* attributes = nullptr;
+
+        std::string_view tag_name() const { return atom_name(tag); }
+        bool has_class(Atom name) const;
+
+        const Attr* find_attribute(Atom name) const;
+        // The attribute's value, or an empty view if it is not set.
+        std::string_view get_attribute(Atom name) const;
+        std::string_view get_attribute(std::string_view name) const;
     };
 
     enum class NodeType {
@@ -22,16 +43,134 @@ namespace DOM {
         Text
     };
 
+    // Iterates a node's children through the intrusive sibling links.
+    class ChildIterator {
+    public:
+        explicit ChildIterator(Node* node) : m_node(node) {}
+        Node* operator*() const { return m_node; }
+        ChildIterator& operator++();
+        bool operator!=(const ChildIterator& other) const { return m_node != other.m_node; }
+        bool operator==(const ChildIterator& other) const { return m_node == other.m_node; }
+
+    private:
+        Node* m_node;
+    };
+
+    struct ChildRange {
+        Node* first;
+        ChildIterator begin() const { return ChildIterator(first); }
+        ChildIterator end() const { return ChildIterator(nullptr); }
+    };
+
+    // Nodes live in their Document's arena and are linked into the tree intrusively,
+    // so a node holds no owning pointers and is never destroyed individually.
     struct Node {
         NodeType type;
+        // In the document's tree (and indexes), as opposed to created but not yet appended.
+        bool connected = false;
         ElementData element_data;
-        std::string text_data;
-        std::vector<std::unique_ptr<Node>> children;
+        std::string_view text_data;
+
+        Node* parent = nullptr;
+        Node* first_child = nullptr;
+        Node* last_child = nullptr;
+        Node* prev_sibling = nullptr;
+        Node* next_sibling = nullptr;
+
+        ChildRange children() const { return ChildRange{ first_child }; }
+        bool has_children() const { return first_child != nullptr; }
+    };
+
+    inline ChildIterator& ChildIterator::operator++() {
+        m_node = m_node->next_sibling;
+        return *this;
+    }
+
+    struct DocumentStats {
+        size_t node_count = 0;
+        size_t free_node_count = 0;
+        size_t arena_bytes_used = 0;
+        size_t arena_bytes_reserved = 0;
+        size_t arena_block_count = 0;
     };
 
-    // Helper functions
-    std::unique_ptr<Node> create_text_node(const std::string& data);
-    std::unique_ptr<Node> create_element_node(const std::string& name, AttrMap attrs, std::vector<std::unique_ptr<Node>> children);
+    class Document;
+
+    // Told about changes to a document that invalidate what is kept per node, such
+    // as script wrappers. Observers must outlive their registration or remove
+    // themselves.
+    class DocumentObserver {
+    public:
+        virtual ~DocumentObserver() = default;
+        // `node` was detached and is about to be recycled: a later create_*_node()
+        // may return the same address for a different node.
+        virtual void node_removed(Node* node) = 0;
+        virtual void document_destroyed(Document* document) = 0;
+    };
+
+    // Owns every node, string and attribute array of one parsed page. Dropping the
+    // Document frees the whole tree in one pass over the arena's blocks.
+    class Document {
+    public:
+        Document() = default;
+        ~Document();
+        Document(const Document&) = delete;
+        Document& operator=(const Document&) = delete;
+
+        // Attribute values and text are copied into the document's arena.
+        Node* create_element_node(Atom tag, const Attr* attrs, size_t attr_count);
+        Node* create_text_node(std::string_view data);
+
+        // parent == nullptr appends a top-level node.
+        void append_child(Node* parent, Node* child);
+        // Detaches all children of `parent` and recycles their nodes.
+        void remove_children(Node* parent);
+
+        // Connected elements by id, class and tag name, in document order. The indexes
+        // are built on the first lookup and from then on kept up to date by
+        // append_child() and remove_children().
+        Node* element_by_id(Atom id);
+        const std::vector<Node*>& elements_by_class(Atom name);
+        const std::vector<Node*>& elements_by_tag(Atom tag);
+
+        // The first top-level node, which is what the browser treats as the root.
+        Node* root() const { return m_first_top_level; }
+        ChildRange top_level_nodes() const { return ChildRange{ m_first_top_level }; }
+
+        DocumentStats stats() const;
+
+        void add_observer(DocumentObserver* observer);
+        void remove_observer(DocumentObserver* observer);
+
+    private:
+        Arena m_arena;
+        Node* m_first_top_level = nullptr;
+        Node* m_last_top_level = nullptr;
+        // Removed nodes, chained through next_sibling, reused before the arena grows.
+        Node* m_free_nodes = nullptr;
+        size_t m_node_count = 0;
+        size_t m_free_node_count = 0;
+
+        using NodeIndex = std::unordered_map<Atom, std::vector<Node*>>;
+        NodeIndex m_id_index;
+        NodeIndex m_class_index;
+        NodeIndex m_tag_index;
+        // The last connected node in document order. Subtrees appended below it go to
+        // the end of the index lists; ones appended anywhere else are inserted at
+        // their position.
+        Node* m_last_node = nullptr;
+        // Set until the first lookup, so parsing doesn't pay for indexes nobody reads.
+        bool m_index_stale = true;
+        std::vector<DocumentObserver*> m_observers;
+
+        Node* allocate_node();
+        void connect_subtree(Node* root);
+        void index_subtree(Node* root);
+        void insert_subtree(Node* root);
+        void index_element(Node* element);
+        void rebuild_indexes();
+        const Atom* split_class_list(std::string_view value, uint16_t& count);
+    };
 }
 
 #endif // DOM_H
\ No newline at end of file
@@ -0,0 +1,384 @@
+// Times the engine's passes on generated documents:
+//   engine_bench <benchmark> [options]
+// Run without arguments for the list. Each benchmark prints the best of several runs.
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "html_parser.h"
+#include "css_parser.h"
+#include "style.h"
+#include "stylesheet_cache.h"
+#include "layout.h"
+#include "thread_pool.h"
+#include "tool_support.h"
+
+namespace {
+    template<typename Fn>
+    double best_ms(int runs, Fn&& fn) {
+        double best = 1e300;
+        for (int i = 0; i < runs; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        return best;
+    }
+
+    // Text heavy markup with nesting, attributes and scripts, repeated to `bytes`.
+    std::string generate_page(size_t bytes) {
+        std::string html = "<html><head><title>Generated</title></head><body>";
+        for (size_t i = 0; html.size() < bytes; ++i) {
+            std::string n = std::to_string(i);
+            html += "<div class=\"section s" + n + "\" id=\"section-" + n + "\">"
+                    "<h2>Section " + n + "</h2>"
+                    "<p>The World Wide Web is a wide-area hypermedia information retrieval initiative aiming "
+                    "to give universal access to a large universe of documents. Everything there is online "
+                    "about W3 is linked directly or indirectly to this document &amp; its <a href=\"/s" + n +
+                    "\">index</a>.</p>"
+                    "<ul><li>Summary<li>Mailing lists<li><a href=\"/policy\" title='Policy'>Policy</a></ul>"
+                    "<script>if (a < b) { total += " + n + "; }</script>"
+                    "<p>Pointers to the world's online information, subjects, W3 servers, etc.<br>"
+                    "<img src=\"/icons/" + n + ".gif\" alt=\"icon\"></p></div>\n";
+        }
+        return html + "</body></html>";
+    }
+
+    int tokenize(int argc, char** argv) {
+        std::string html;
+        if (argc > 0) {
+            if (!Tools::read_file(argv[0], html)) {
+                std::cerr << "Cannot read " << argv[0] << std::endl;
+                return 1;
+            }
+        } else {
+            html = generate_page(16 << 20);
+        }
+        size_t nodes = 0;
+        double ms = best_ms(5, [&] {
+            auto document = HTML::Parser(html).parse_document();
+            nodes = document->stats().node_count;
+        });
+        std::cout << "[Tokenize] " << html.size() / 1e6 << " MB, " << nodes << " nodes in " << ms << " ms: "
+                  << html.size() / 1e3 / ms << " MB/s" << std::endl;
+        return 0;
+    }
+
+    // The same 200k elements as siblings, and nested in groups down to one chain of
+    // 100k levels: tree construction should cost the same at any depth.
+    int nesting(int, char**) {
+        const size_t elements = 200000;
+        for (size_t depth : { size_t(1), size_t(100), size_t(10000), size_t(100000) }) {
+            std::string html;
+            for (size_t group = 0; group < elements / depth; ++group) {
+                for (size_t i = 0; i < depth; ++i) html += "<div class=\"level\">text ";
+                for (size_t i = 0; i < depth; ++i) html += "</div>";
+            }
+            double ms = best_ms(5, [&] { HTML::Parser(html).parse_document(); });
+            std::cout << "[Nesting] depth " << depth << ": " << html.size() / 1e6 << " MB in " << ms << " ms: "
+                      << html.size() / 1e3 / ms << " MB/s" << std::endl;
+        }
+        return 0;
+    }
+
+    // The first element with `id` in document order, found by walking the tree the
+    // way getElementById did before the Document kept indexes.
+    const DOM::Node* walk_for_id(const DOM::Node* node, DOM::Atom id) {
+        while (node) {
+            if (node->type == DOM::NodeType::Element && node->element_data.id == id) return node;
+            if (node->first_child) {
+                node = node->first_child;
+                continue;
+            }
+            while (node && !node->next_sibling) node = node->parent;
+            if (node) node = node->next_sibling;
+        }
+        return nullptr;
+    }
+
+    // 10k id, class and tag lookups on a 50k node document, against walking the tree.
+    int lookup(int, char**) {
+        const int items = 25000, lookups = 10000;
+        std::string html = "<html><body>";
+        for (int i = 0; i < items; ++i) {
+            std::string n = std::to_string(i);
+            html += (i % 5 ? "<span" : "<p") + std::string(" id=\"item-") + n + "\" class=\"item c" + std::to_string(i % 100) +
+                    "\">" + n + (i % 5 ? "</span>" : "</p>");
+        }
+        html += "</body></html>";
+        auto document = HTML::Parser(html).parse_document();
+
+        std::vector<DOM::Atom> ids, classes;
+        for (int i = 0; i < lookups; ++i) {
+            ids.push_back(DOM::intern("item-" + std::to_string(i * 7919 % items)));
+            classes.push_back(DOM::intern("c" + std::to_string(i % 100)));
+        }
+        document->element_by_id(ids[0]); // Builds the indexes.
+
+        size_t found = 0;
+        double walk_ms = best_ms(3, [&] {
+            for (DOM::Atom id : ids) found += walk_for_id(document->root(), id) != nullptr;
+        });
+        double id_ms = best_ms(5, [&] {
+            for (DOM::Atom id : ids) found += document->element_by_id(id) != nullptr;
+        });
+        double class_ms = best_ms(5, [&] {
+            for (DOM::Atom name : classes) found += document->elements_by_class(name).size();
+        });
+        double tag_ms = best_ms(5, [&] {
+            for (int i = 0; i < lookups; ++i) found += document->elements_by_tag(i % 2 ? DOM::Atoms::p : DOM::Atoms::span).size();
+        });
+        std::cout << "[Lookup] " << document->stats().node_count << " nodes, " << lookups << " lookups each: "
+                  << "tree walk by id " << walk_ms << " ms, by id " << id_ms << " ms, by class " << class_ms
+                  << " ms, by tag " << tag_ms << " ms" << std::endl;
+
+        // What a script does in a loop: change an element in the middle of the page,
+        // as innerHTML does, or add one there, then look something up.
+        const int mutations = 1000;
+        std::vector<DOM::Node*> targets;
+        for (int i = 0; i < mutations; ++i) targets.push_back(document->element_by_id(ids[i]));
+        double text_ms = best_ms(3, [&] {
+            for (int i = 0; i < mutations; ++i) {
+                document->remove_children(targets[i]);
+                document->append_child(targets[i], document->create_text_node("changed"));
+                found += document->element_by_id(ids[i + 1]) != nullptr;
+            }
+        });
+        DOM::Atom added = DOM::intern("added");
+        DOM::Attr attributes[] = { { DOM::Atoms::class_, "item added" } };
+        double element_ms = best_ms(3, [&] {
+            for (int i = 0; i < mutations; ++i) {
+                document->remove_children(targets[i]);
+                document->append_child(targets[i], document->create_element_node(DOM::Atoms::span, attributes, 1));
+                found += document->elements_by_class(added).size();
+            }
+        });
+        std::cout << "[Lookup] " << mutations << " mid-document changes, each followed by a lookup: "
+                  << "text " << text_ms << " ms, element " << element_ms << " ms" << std::endl;
+        return found > 0 ? 0 : 1;
+    }
+
+    // 20k elements under a few sections, with tags, classes and ids the generated
+    // stylesheets below refer to.
+    std::string generate_styled_page(int elements) {
+        const char* tags[] = { "div", "p", "span", "li", "a" };
+        std::string html = "<html><body>";
+        for (int i = 0; i < elements; ++i) {
+            if (i % 100 == 0) html += i ? "</div><div class=\"section\">" : "<div class=\"section\">";
+            std::string tag = tags[i % 5];
+            html += "<" + tag + " class=\"c" + std::to_string(i * 13 % 3000) + " item\"";
+            if (i % 10 == 0) html += " id=\"e" + std::to_string(i) + "\"";
+            html += ">" + std::to_string(i) + "</" + tag + ">";
+        }
+        return html + "</div></body></html>";
+    }
+
+    // `rules` rules, mostly on one class or id as real sheets are, with some on tags
+    // and some with a descendant combinator.
+    std::string generate_stylesheet(int rules) {
+        const char* tags[] = { "div", "p", "span", "li", "a" };
+        std::string css;
+        for (int i = 0; i < rules; ++i) {
+            std::string n = std::to_string(i);
+            switch (i % 10) {
+                case 0: css += "#e" + std::to_string(i * 10 % 20000); break;
+                case 1: css += std::string(tags[i % 5]) + ".c" + std::to_string(i % 3000); break;
+                case 2: css += ".section .c" + std::to_string(i % 3000); break;
+                case 3: css += std::string(tags[i / 10 % 5]); break;
+                default: css += ".c" + std::to_string(i % 3000); break;
+            }
+            css += " { margin-left: " + std::to_string(i % 7) + "px; color: #" + std::to_string(100 + i % 900) + " }\n";
+        }
+        return css;
+    }
+
+    // Styles 20k elements with a 5,000 rule stylesheet, and times testing every
+    // selector against every element, which is what matching cost before rules were
+    // bucketed.
+    int match(int, char**) {
+        auto document = HTML::Parser(generate_styled_page(20000)).parse_document();
+        CSS::Stylesheet sheet = CSS::Parser(generate_stylesheet(5000)).parse_stylesheet();
+        Style::RuleIndex rules(sheet);
+
+        size_t elements = 0, selectors = 0;
+        for (const CSS::Rule& rule : sheet.rules) selectors += rule.selectors.size();
+        std::vector<const DOM::Node*> stack{ document->root() };
+        std::vector<const DOM::Node*> all;
+        while (!stack.empty()) {
+            const DOM::Node* node = stack.back();
+            stack.pop_back();
+            if (node->type != DOM::NodeType::Element) continue;
+            all.push_back(node);
+            for (const DOM::Node* child : node->children()) stack.push_back(child);
+        }
+        elements = all.size();
+
+        size_t matched = 0;
+        double all_ms = best_ms(3, [&] {
+            for (const DOM::Node* node : all) {
+                for (const CSS::Rule& rule : sheet.rules) {
+                    for (const CSS::Selector& selector : rule.selectors) matched += Style::selector_matches(node, selector);
+                }
+            }
+        });
+        Style::StyleStats stats;
+        double style_ms = best_ms(5, [&] {
+            stats = Style::StyleStats();
+            Style::style_tree(document->root(), rules, &stats);
+        });
+        std::cout << "[Match] " << elements << " elements, " << selectors << " selectors: every selector "
+                  << all_ms << " ms for " << elements * selectors << " tests; style_tree " << style_ms << " ms for "
+                  << stats.selectors_tested << " tests" << std::endl;
+        return matched > 0 ? 0 : 1;
+    }
+
+    // 1, 2, 4... up to the hardware threads, or up to `argv[0]` threads if given.
+    std::vector<size_t> thread_counts(int argc, char** argv) {
+        size_t most = argc > 0 ? std::strtoul(argv[0], nullptr, 10) : std::thread::hardware_concurrency();
+        std::vector<size_t> counts;
+        for (size_t threads = 1; threads < most; threads *= 2) counts.push_back(threads);
+        counts.push_back(std::max<size_t>(most, 1));
+        return counts;
+    }
+
+    // Whether two styled trees are for the same nodes with equal computed values.
+    bool same_styles(const Style::StyledNode& a, const Style::StyledNode& b) {
+        std::vector<std::pair<const Style::StyledNode*, const Style::StyledNode*>> stack{ { &a, &b } };
+        while (!stack.empty()) {
+            auto [x, y] = stack.back();
+            stack.pop_back();
+            if (x->node != y->node || x->children.size() != y->children.size()) return false;
+            if (!(*x->style->inherited == *y->style->inherited) || !(*x->style->box == *y->style->box) ||
+                !(*x->style->background == *y->style->background)) {
+                return false;
+            }
+            for (size_t i = 0; i < x->children.size(); ++i) stack.push_back({ x->children[i].get(), y->children[i].get() });
+        }
+        return true;
+    }
+
+    // parallel_style_tree on 100k elements with pools of growing size, checked
+    // against style_tree.
+    int style(int argc, char** argv) {
+        auto document = HTML::Parser(generate_styled_page(100000)).parse_document();
+        CSS::Stylesheet sheet = CSS::Parser(generate_stylesheet(2000)).parse_stylesheet();
+        Style::RuleIndex rules(sheet);
+
+        std::unique_ptr<Style::StyledNode> expected;
+        double sequential_ms = best_ms(5, [&] { expected = Style::style_tree(document->root(), rules); });
+        std::cout << "[Style] style_tree: " << sequential_ms << " ms" << std::endl;
+        for (size_t threads : thread_counts(argc, argv)) {
+            Engine::ThreadPool pool(threads);
+            std::unique_ptr<Style::StyledNode> styled;
+            double ms = best_ms(5, [&] { styled = Style::parallel_style_tree(document->root(), rules, pool); });
+            bool same = same_styles(*expected, *styled);
+            std::cout << "[Style] parallel_style_tree, " << threads << " threads: " << ms << " ms, "
+                      << sequential_ms / ms << "x, " << (same ? "same styles" : "DIFFERENT STYLES") << std::endl;
+            if (!same) return 1;
+        }
+        return 0;
+    }
+
+    // Whether two trees laid out from the same styles have identical rects.
+    bool same_layout(const Layout::LayoutTree& a, const Layout::LayoutTree& b) {
+        if (a.size() != b.size()) return false;
+        for (Layout::BoxId box = 0; box < a.size(); ++box) {
+            const Layout::Rect& x = a.rect(box);
+            const Layout::Rect& y = b.rect(box);
+            if (x.x != y.x || x.y != y.y || x.width != y.width || x.height != y.height) return false;
+        }
+        return true;
+    }
+
+    // A page of six flex columns of fractional widths, each holding thousands of
+    // padded paragraphs, laid out from scratch by layout() and by parallel_layout()
+    // on pools of growing size.
+    int layout(int argc, char** argv) {
+        std::string html = "<html><body><div class=\"columns\">";
+        for (int column = 0; column < 6; ++column) {
+            html += "<div class=\"column\">";
+            for (int i = 0; i < 4000; ++i) {
+                html += "<div class=\"card\"><h3>Item " + std::to_string(i) + "</h3><p>Column " +
+                        std::to_string(column) + " holds a long list of cards whose text wraps over a few lines "
+                        "at this width.</p></div>";
+            }
+            html += "</div>";
+        }
+        html += "</div></body></html>";
+        auto document = HTML::Parser(html).parse_document();
+        CSS::Stylesheet sheet = CSS::Parser(".columns { display: flex; }"
+                                            ".column { display: block; width: 16.6%; padding-left: 0.7%; }"
+                                            ".card { display: block; margin-bottom: 3.3px; padding-top: 1.1px; }")
+                                    .parse_stylesheet();
+        std::vector<const CSS::Stylesheet*> stylesheets{ &CSS::user_agent_stylesheet(), &sheet };
+        Style::RuleIndex rules(stylesheets);
+        auto styled = Style::style_tree(document->root(), rules);
+
+        Layout::FixedPitchMetrics metrics;
+        Layout::TextRunCache text_cache(metrics);
+        Layout::Rect viewport;
+        viewport.width = 1600.0f;
+        viewport.height = 900.0f;
+        auto time_layout = [&](Layout::LayoutTree& tree, auto&& run) {
+            tree.build(*styled);
+            run(); // Fills the text cache, so runs compare layout alone.
+            double best = 1e300;
+            for (int i = 0; i < 5; ++i) {
+                for (Layout::BoxId box = 0; box < tree.size(); ++box) tree.mark_needs_layout(box);
+                best = std::min(best, best_ms(1, run));
+            }
+            return best;
+        };
+
+        Layout::LayoutTree expected;
+        double sequential_ms = time_layout(expected, [&] { expected.layout(viewport, text_cache); });
+        std::cout << "[Layout] " << expected.size() << " boxes, layout: " << sequential_ms << " ms" << std::endl;
+        for (size_t threads : thread_counts(argc, argv)) {
+            Engine::ThreadPool pool(threads);
+            Layout::LayoutTree tree;
+            double ms = time_layout(tree, [&] { tree.parallel_layout(viewport, text_cache, pool); });
+            bool same = same_layout(expected, tree);
+            std::cout << "[Layout] parallel_layout, " << threads << " threads: " << ms << " ms, "
+                      << sequential_ms / ms << "x, " << (same ? "same layout" : "DIFFERENT LAYOUT") << std::endl;
+            if (!same) return 1;
+        }
+        return 0;
+    }
+
+    struct Benchmark {
+        const char* name;
+        const char* arguments;
+        const char* description;
+        int (*run)(int argc, char** argv);
+    };
+
+    const Benchmark Benchmarks[] = {
+        { "tokenize", "[page.html]", "parse a 16 MB generated page, or the given one", tokenize },
+        { "nesting", "", "parse 200k elements as siblings and nested up to 100k deep", nesting },
+        { "lookup", "", "10k getElementById/ByClassName/ByTagName lookups on 50k nodes", lookup },
+        { "match", "", "style 20k elements with a 5,000 rule stylesheet", match },
+        { "style", "[max threads]", "style 100k elements in parallel on 1 to N threads", style },
+        { "layout", "[max threads]", "lay out a six column page in parallel on 1 to N threads", layout },
+    };
+}
+
+int main(int argc, char** argv) {
+    for (const Benchmark& benchmark : Benchmarks) {
+        if (argc > 1 && std::strcmp(argv[1], benchmark.name) == 0) {
+            return benchmark.run(argc - 2, argv + 2);
+        }
+    }
+    std::cerr << "Usage: " << argv[0] << " <benchmark> [options]" << std::endl;
+    for (const Benchmark& benchmark : Benchmarks) {
+        std::string usage = std::string(benchmark.name) + " " + benchmark.arguments;
+        std::cerr << "  " << std::left << std::setw(24) << usage << benchmark.description << std::endl;
+    }
+    return 2;
+}
\ No newline at end of file
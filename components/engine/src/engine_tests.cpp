@@ -0,0 +1,340 @@
+// Checks of the engine that need no window, network or script engine:
+//   engine_tests [test ...]
+// Runs every test, or the named ones, and exits non-zero if any check failed.
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "html_parser.h"
+#include "css_parser.h"
+#include "preload_scanner.h"
+#include "style.h"
+#include "stylesheet_cache.h"
+#include "text_scanner.h"
+#include "tool_support.h"
+
+namespace {
+    // Every implementation the CPU has must agree with a plain loop, for any length,
+    // start and alignment, including bytes >= 0x80 and delimiters at block edges.
+    void scanner_levels() {
+        const char alphabet[] = { 'a', 'b', ' ', '\t', '\n', '\r', '\f', '\v', '<', '&', '"', '\'',
+                                  ';', '{', '}', '*', '/', char(0x80), char(0xE9), char(0xFF), '\0' };
+        const Scan::DelimiterSet sets[] = { { '<' }, { '<', '&' }, { '"', '\'', '>' }, { ';', '{', '}', '/' } };
+        std::mt19937 random(42);
+        std::string buffer(512, ' ');
+        Scan::Level original = Scan::active_level();
+
+        for (Scan::Level level : { Scan::Level::Scalar, Scan::Level::SSE2, Scan::Level::AVX2 }) {
+            Scan::set_level(level);
+            if (Scan::active_level() != level) continue; // Not supported here.
+            for (int round = 0; round < 200; ++round) {
+                for (char& c : buffer) c = alphabet[random() % sizeof(alphabet)];
+                size_t offset = random() % 32;
+                std::string_view input = std::string_view(buffer).substr(offset, random() % (buffer.size() - offset));
+                for (size_t pos = 0; pos <= input.size(); ++pos) {
+                    for (const Scan::DelimiterSet& set : sets) {
+                        size_t expected = pos;
+                        while (expected < input.size() && !std::memchr(set.chars, input[expected], set.count)) ++expected;
+                        CHECK(Scan::find_first_of(input, pos, set) == expected);
+                    }
+                    size_t expected = pos;
+                    while (expected < input.size() && std::strchr(" \t\n\r\f\v", input[expected]) && input[expected]) ++expected;
+                    CHECK(Scan::skip_whitespace(input, pos) == expected);
+
+                    expected = input.find("*/", pos);
+                    CHECK(Scan::find_pair(input, pos, '*', '/') == (expected == std::string_view::npos ? input.size() : expected));
+                }
+            }
+        }
+        Scan::set_level(original);
+    }
+
+    // The tree as markup with every end tag written out. Iterative, so it also
+    // works for documents nested deeper than the call stack allows.
+    std::string serialize(const DOM::Document& document) {
+        std::string out;
+        std::vector<const DOM::Node*> stack;
+        for (const DOM::Node* node = document.root(); node || !stack.empty();) {
+            if (!node) {
+                node = stack.back();
+                stack.pop_back();
+                out += "</" + std::string(node->element_data.tag_name()) + ">";
+                node = node->next_sibling;
+                continue;
+            }
+            if (node->type == DOM::NodeType::Text) {
+                out += "[" + std::string(node->text_data) + "]";
+                node = node->next_sibling;
+                continue;
+            }
+            const DOM::ElementData& element = node->element_data;
+            out += "<" + std::string(element.tag_name());
+            for (uint32_t i = 0; i < element.attribute_count; ++i) {
+                out += " " + std::string(DOM::atom_name(element.attributes[i].name)) + "=\"" +
+                       std::string(element.attributes[i].value) + "\"";
+            }
+            out += ">";
+            stack.push_back(node);
+            node = node->first_child;
+        }
+        return out;
+    }
+
+    std::string parse_in_chunks(std::string_view html, const std::vector<size_t>& cuts) {
+        HTML::Parser parser;
+        size_t start = 0;
+        for (size_t cut : cuts) {
+            parser.feed(html.substr(start, cut - start));
+            start = cut;
+        }
+        parser.feed(html.substr(start));
+        return serialize(*parser.finish());
+    }
+
+    const char* const ChunkedPages[] = {
+        // Raw text, with markup and '<' inside.
+        "<html><head><script>if (a < b && c > d) { x = \"</div>\"; }</script>"
+        "<style>p > a { color: red }</style></head><body>x</body></html>",
+        // Comments, doctypes and processing instructions.
+        "<!DOCTYPE html><!-- a <b> -- c --><p>x<!---->y<!-- -> --></p><?xml version=\"1.0\"?><div>z</div>",
+        // Attributes of every form, and '>' inside quoted values.
+        "<div><a href=\"http://x/?a=1&b=2\" title='it\"s' data-long-attribute-name=unquoted checked>link</a>"
+        "<img src = \"a>b.png\" alt='>'><input value=x/><p ID=\"Mixed\" Class=\"a  b\" id=dup>t</p></div>",
+        // End tags the author left out, void elements and stray end tags.
+        "<body><ul><li>one<li>two<li>three</ul><p>para<div>block</div><dl><dt>t<dd>d<dt>t2</dl>"
+        "<table><tr><td>a<td>b<tr><th>c</table><select><option>1<option>2</select>"
+        "<p>a<br>b<br/>c</span></p></body>",
+        // Raw text holding near misses of its end tag.
+        "<script>var s=\"</scriptx>\"; s += '</scrip'; </script ><style>a{}</styles></STYLE\n>x",
+        // Text with literal '<', entities and case, and a document cut off mid-tag.
+        "<Div CLASS=\"A\">a < b, c<d, 1 <2 &amp; &lt;</DIV><custom-element x=1>tail <",
+    };
+
+    // Every split of a page into chunks must give the DOM of parsing it in one go,
+    // and must not intern names that were cut off by a chunk boundary.
+    void parser_chunk_splits() {
+        std::mt19937 random(7);
+        for (const char* page : ChunkedPages) {
+            std::string_view html = page;
+            std::string expected = serialize(*HTML::Parser(std::string(html)).parse_document());
+            size_t atoms = DOM::AtomTable::global().size();
+
+            for (size_t cut = 0; cut <= html.size(); ++cut) {
+                CHECK(parse_in_chunks(html, { cut }) == expected);
+            }
+            std::vector<size_t> every_byte;
+            for (size_t cut = 1; cut < html.size(); ++cut) every_byte.push_back(cut);
+            CHECK(parse_in_chunks(html, every_byte) == expected);
+
+            for (int round = 0; round < 2000; ++round) {
+                std::vector<size_t> cuts(1 + random() % 8);
+                for (size_t& cut : cuts) cut = random() % (html.size() + 1);
+                std::sort(cuts.begin(), cuts.end());
+                CHECK(parse_in_chunks(html, cuts) == expected);
+            }
+            CHECK(DOM::AtomTable::global().size() == atoms);
+        }
+    }
+
+    // A raw text element ends only at its own name followed by whitespace, '/' or
+    // '>', or at the end of the input.
+    void parser_raw_text_end_tags() {
+        const std::pair<const char*, const char*> cases[] = {
+            { "<script>var s=\"</scriptx>\";</script>", "<script>[var s=\"</scriptx>\";]</script>" },
+            { "<style>a</style2></style>b", "<style>[a</style2>]</style>[b]" },
+            { "<script>x</SCRIPT\t>y", "<script>[x]</script>[y]" },
+            { "<script>x</script/>y", "<script>[x]</script>[y]" },
+            { "<script>x</script", "<script>[x]</script>" },
+            { "<script>x</scriptx", "<script>[x</scriptx]</script>" },
+        };
+        for (const auto& [html, expected] : cases) {
+            CHECK(serialize(*HTML::Parser(html).parse_document()) == expected);
+            std::string_view input = html;
+            for (size_t cut = 0; cut <= input.size(); ++cut) {
+                CHECK(parse_in_chunks(input, { cut }) == expected);
+            }
+        }
+    }
+
+    // Nesting depth costs the parser heap, not call stack.
+    void parser_deep_nesting() {
+        const size_t depth = 100000;
+        std::string html;
+        for (size_t i = 0; i < depth; ++i) html += i % 2 ? "<span>" : "<div class=x>";
+        html += "leaf";
+
+        auto document = HTML::Parser(html).parse_document();
+        size_t levels = 0;
+        const DOM::Node* node = document->root();
+        for (; node && node->type == DOM::NodeType::Element; node = node->first_child) ++levels;
+        CHECK(levels == depth);
+        CHECK(node && node->text_data == "leaf");
+
+        std::vector<size_t> cuts;
+        for (size_t cut = 4096; cut < html.size(); cut += 4096) cuts.push_back(cut);
+        CHECK(parse_in_chunks(html, cuts) == serialize(*document));
+    }
+
+    // The index lists a walk of the tree in document order gives, by tag, id and class.
+    void check_indexes(DOM::Document& document, const std::vector<DOM::Atom>& names) {
+        std::vector<const DOM::Node*> elements;
+        std::vector<const DOM::Node*> stack;
+        for (const DOM::Node* node = document.root(); node || !stack.empty();) {
+            if (!node) {
+                node = stack.back()->next_sibling;
+                stack.pop_back();
+                continue;
+            }
+            if (node->type == DOM::NodeType::Element) elements.push_back(node);
+            stack.push_back(node);
+            node = node->first_child;
+        }
+        for (DOM::Atom name : names) {
+            std::vector<const DOM::Node*> by_tag, by_class;
+            const DOM::Node* by_id = nullptr;
+            for (const DOM::Node* element : elements) {
+                if (element->element_data.tag == name) by_tag.push_back(element);
+                if (element->element_data.has_class(name)) by_class.push_back(element);
+                if (!by_id && element->element_data.id == name) by_id = element;
+            }
+            const auto& tags = document.elements_by_tag(name);
+            const auto& classes = document.elements_by_class(name);
+            CHECK(std::vector<const DOM::Node*>(tags.begin(), tags.end()) == by_tag);
+            CHECK(std::vector<const DOM::Node*>(classes.begin(), classes.end()) == by_class);
+            CHECK(document.element_by_id(name) == by_id);
+        }
+    }
+
+    // The id, class and tag indexes stay in document order as subtrees are appended
+    // anywhere in the tree and children are removed.
+    void dom_indexes() {
+        auto document = HTML::Parser("<html><body><div id=a class=x><p class=y>t</p></div><span id=b>u</span>"
+                                     "<div class=\"x y\"><p id=a>v</p></div></body></html>")
+                            .parse_document();
+        const DOM::Atom tags[] = { DOM::Atoms::div, DOM::Atoms::p, DOM::Atoms::span };
+        const DOM::Atom names[] = { DOM::intern("a"), DOM::intern("b"), DOM::intern("x"), DOM::intern("y") };
+        std::vector<DOM::Atom> checked(std::begin(tags), std::end(tags));
+        checked.insert(checked.end(), std::begin(names), std::end(names));
+        check_indexes(*document, checked);
+
+        std::mt19937 random(3);
+        for (int round = 0; round < 300; ++round) {
+            std::vector<DOM::Node*> elements;
+            std::vector<DOM::Node*> stack{ document->root() };
+            while (!stack.empty()) {
+                DOM::Node* node = stack.back();
+                stack.pop_back();
+                if (node->type != DOM::NodeType::Element) continue;
+                elements.push_back(node);
+                for (DOM::Node* child : node->children()) stack.push_back(child);
+            }
+            DOM::Node* target = elements[random() % elements.size()];
+            switch (random() % 4) {
+                case 0:
+                    if (target != document->root()) document->remove_children(target);
+                    break;
+                case 1:
+                    document->append_child(target, document->create_text_node("text"));
+                    break;
+                default: {
+                    DOM::Attr attributes[] = { { DOM::Atoms::id, DOM::atom_name(names[random() % 4]) },
+                                               { DOM::Atoms::class_, random() % 2 ? "x" : "x y" } };
+                    DOM::Node* element = document->create_element_node(tags[random() % 3], attributes, 1 + random() % 2);
+                    // Half of the subtrees get a child before they are appended.
+                    if (random() % 2) {
+                        DOM::Attr child_attributes[] = { { DOM::Atoms::class_, "y" } };
+                        document->append_child(element, document->create_element_node(DOM::Atoms::p, child_attributes, 1));
+                    }
+                    document->append_child(target, element);
+                    break;
+                }
+            }
+            check_indexes(*document, checked);
+        }
+    }
+
+    // The page loader applies the same stylesheet links the preload scanner fetches.
+    void stylesheet_links() {
+        CHECK(HTML::is_stylesheet_link("stylesheet"));
+        CHECK(HTML::is_stylesheet_link(" StyleSheet  preload"));
+        CHECK(!HTML::is_stylesheet_link("alternate stylesheet"));
+        CHECK(!HTML::is_stylesheet_link("stylesheets"));
+        CHECK(!HTML::is_stylesheet_link("icon"));
+
+        std::vector<std::string> preloaded;
+        HTML::PreloadScanner scanner([&](const HTML::PreloadRequest& request) { preloaded.push_back(request.url); });
+        scanner.feed("<link rel=stylesheet href=a.css><link rel=\"alternate stylesheet\" href=b.css>");
+        scanner.finish();
+        CHECK(preloaded == std::vector<std::string>{ "a.css" });
+    }
+
+    // The used line height of the first element with the given id, or -1.
+    float line_height_of(const Style::StyledNode& root, std::string_view id) {
+        std::vector<const Style::StyledNode*> stack{ &root };
+        while (!stack.empty()) {
+            const Style::StyledNode* styled = stack.back();
+            stack.pop_back();
+            if (styled->node->type == DOM::NodeType::Element && styled->node->element_data.id == DOM::intern(id)) {
+                return styled->style->inherited->used_line_height();
+            }
+            for (const auto& child : styled->children) stack.push_back(child.get());
+        }
+        return -1.0f;
+    }
+
+    // A unitless line-height is inherited as the number and scales with each
+    // element's own font; lengths, em included, are inherited as px.
+    void style_line_height() {
+        const char* html =
+            "<html><body>"
+            "<div id=unitless><h1 id=big><span id=bigger>a</span></h1><p id=same>b</p></div>"
+            "<section id=em><h1 id=em-big>c</h1></section>"
+            "<article id=px><h1 id=px-big>d</h1><p id=normal>e</p></article>"
+            "</body></html>";
+        const char* css =
+            "div, section, article { font-size: 10px; }"
+            "div { line-height: 1.5; } section { line-height: 1.5em; } article { line-height: 12px; }"
+            "h1 { font-size: 40px; } span { font-size: 20px; line-height: inherit; }"
+            "#normal { line-height: normal; }";
+        auto document = HTML::Parser(html).parse_document();
+        CSS::Stylesheet parsed = CSS::Parser(css).parse_stylesheet();
+        // A compiled sheet read back from the cache format must style the same.
+        std::string compiled = CSS::serialize_stylesheet(parsed, 1);
+        auto cached = CSS::deserialize_stylesheet(compiled.data(), compiled.size(), 1);
+        CHECK(cached.has_value());
+        if (!cached) return;
+
+        for (const CSS::Stylesheet* sheet : { &parsed, &*cached }) {
+            std::vector<const CSS::Stylesheet*> stylesheets{ sheet };
+            Style::RuleIndex rules(stylesheets);
+            auto styled = Style::style_tree(document->root(), rules);
+            CHECK(line_height_of(*styled, "unitless") == 15.0f);
+            CHECK(line_height_of(*styled, "big") == 60.0f);
+            CHECK(line_height_of(*styled, "bigger") == 30.0f);
+            CHECK(line_height_of(*styled, "same") == 15.0f);
+            CHECK(line_height_of(*styled, "em") == 15.0f);
+            CHECK(line_height_of(*styled, "em-big") == 15.0f);
+            CHECK(line_height_of(*styled, "px-big") == 12.0f);
+            CHECK(line_height_of(*styled, "normal") == 12.0f);
+        }
+    }
+
+    const Tools::Test Tests[] = {
+        { "scanner_levels", scanner_levels },
+        { "parser_chunk_splits", parser_chunk_splits },
+        { "parser_raw_text_end_tags", parser_raw_text_end_tags },
+        { "parser_deep_nesting", parser_deep_nesting },
+        { "dom_indexes", dom_indexes },
+        { "stylesheet_links", stylesheet_links },
+        { "style_line_height", style_line_height },
+    };
+}
+
+int main(int argc, char** argv) {
+    return Tools::run_tests(argc, argv, Tests);
+}
\ No newline at end of file
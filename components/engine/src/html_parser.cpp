@@ -1,109 +1,402 @@
 #include "html_parser.h"
-#include <cassert>
 #include <algorithm>
 
 namespace HTML {
 
-    Parser::Parser(std::string input) : m_input(std::move(input)) {}
+    namespace {
+        namespace Tag = DOM::Atoms;
 
-    char Parser::next_char() { return m_input[m_pos]; }
-    bool Parser::eof() { return m_pos >= m_input.length(); }
-    bool Parser::starts_with(const std::string& s) { return m_input.substr(m_pos, s.length()) == s; }
-    char Parser::consume_char() { return m_input[m_pos++]; }
+        using Scan::is_space;
+        using Scan::is_alpha;
+        using Scan::is_alnum;
+        using Scan::lower;
 
-    std::string Parser::consume_while(std::function<bool(char)> test) {
-        std::string result;
-        while (!eof() && test(next_char())) {
-            result += consume_char();
+        bool is_one_of(DOM::Atom tag, std::initializer_list<DOM::Atom> names) {
+            return std::find(names.begin(), names.end(), tag) != names.end();
+        }
+
+        // Elements that never have children or an end tag.
+        bool is_void_element(DOM::Atom tag) {
+            switch (tag) {
+                case Tag::area: case Tag::base: case Tag::br: case Tag::col: case Tag::embed:
+                case Tag::hr: case Tag::img: case Tag::input: case Tag::link: case Tag::meta:
+                case Tag::param: case Tag::source: case Tag::track: case Tag::wbr:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        // Elements whose content is text up to their own end tag, never markup.
+        bool is_raw_text_element(DOM::Atom tag) {
+            return tag == Tag::script || tag == Tag::style;
+        }
+
+        // Start tags that close an open <p>.
+        bool closes_paragraph(DOM::Atom tag) {
+            switch (tag) {
+                case Tag::address: case Tag::article: case Tag::aside: case Tag::blockquote:
+                case Tag::div: case Tag::dl: case Tag::fieldset: case Tag::footer: case Tag::form:
+                case Tag::h1: case Tag::h2: case Tag::h3: case Tag::h4: case Tag::h5: case Tag::h6:
+                case Tag::header: case Tag::hr: case Tag::main: case Tag::nav: case Tag::ol:
+                case Tag::p: case Tag::pre: case Tag::section: case Tag::table: case Tag::ul:
+                    return true;
+                default:
+                    return false;
+            }
         }
-        return result;
     }
 
+    Parser::Parser(std::string input)
+        : m_input(std::move(input)), m_finished(true), m_document(std::make_unique<DOM::Document>()) {}
+
+    Parser::Parser() : m_document(std::make_unique<DOM::Document>()) {}
+
     void Parser::consume_whitespace() {
-        consume_while(isspace);
+        m_pos = Scan::skip_whitespace(m_input, m_pos);
+    }
+
+    std::string_view Parser::consume_until(const Scan::DelimiterSet& delimiters) {
+        size_t start = m_pos;
+        m_pos = Scan::find_first_of(m_input, m_pos, delimiters);
+        return std::string_view(m_input).substr(start, m_pos - start);
+    }
+
+    std::unique_ptr<DOM::Document> Parser::parse_document() {
+        return finish();
+    }
+
+    void Parser::feed(std::string_view chunk) {
+        if (m_finished) return;
+        m_input.append(chunk.data(), chunk.size());
+        while (build_next_node()) {}
+
+        // Drop the consumed prefix once it dominates the buffer. Nothing refers into it:
+        // every completed token has already been copied into its DOM node.
+        if (m_pos > 4096 && m_pos * 2 > m_input.length()) {
+            m_input.erase(0, m_pos);
+            m_text_scan_pos -= std::min(m_text_scan_pos, m_pos);
+            m_tag_scan_pos -= std::min(m_tag_scan_pos, m_pos);
+            m_pos = 0;
+        }
+    }
+
+    std::unique_ptr<DOM::Document> Parser::finish() {
+        m_finished = true;
+        while (build_next_node()) {}
+        while (!m_open_elements.empty()) {
+            close_element();
+        }
+        m_input.clear();
+        m_pos = 0;
+        return std::move(m_document);
     }
 
-    std::vector<std::unique_ptr<DOM::Node>> Parser::parse_nodes() {
-        std::vector<std::unique_ptr<DOM::Node>> nodes;
+    // Builds at most one node, or consumes one end tag or markup declaration, from the
+    // buffered input. Returns false if the buffer is exhausted or ends in an incomplete
+    // token; in that case the token is left unconsumed until more input arrives.
+    // Tree construction is a loop over m_open_elements, so nesting depth costs heap,
+    // not call stack.
+    bool Parser::build_next_node() {
+        if (!m_open_elements.empty() && is_raw_text_element(m_open_elements.back()->element_data.tag)) {
+            return build_raw_text();
+        }
+
+        consume_whitespace();
+        if (eof()) return false;
+
+        if (starts_with("</")) {
+            return build_end_tag();
+        }
+
+        size_t token_start = m_pos;
+        if (starts_with("<!") || starts_with("<?")) {
+            // Comments, doctypes and processing instructions don't become nodes.
+            bool comment = starts_with("<!--");
+            size_t end = comment ? m_input.find("-->", m_pos + 4) : m_input.find('>', m_pos);
+            if (end == std::string::npos) {
+                if (!m_finished) return false;
+                m_pos = m_input.length();
+                return true;
+            }
+            m_pos = end + (comment ? 3 : 1);
+            return true;
+        }
+
+        if (next_char() == '<' && m_pos + 1 == m_input.length() && !m_finished) {
+            return false; // Can't tell a tag from a literal '<' yet.
+        }
+
+        if (next_char() == '<' && is_alpha(m_input[m_pos + 1])) {
+            // Wait for the whole tag before tokenizing it, so a tag split over many
+            // chunks is read once and no half-read name ("di" of "div") is interned.
+            if (!m_finished && !start_tag_complete()) return false;
+            consume_char(); // '<'
+            std::string_view tag_name = parse_tag_name();
+            parse_attributes();
+            if (eof()) {
+                if (!m_finished) {
+                    m_pos = token_start;
+                    return false;
+                }
+            } else {
+                consume_char(); // '>'
+            }
+            open_element(DOM::intern(tag_name));
+            return true;
+        }
+
+        // Text runs until the next markup. Remember how far we scanned so a long run
+        // split over many chunks is not rescanned from its start every time.
+        m_pos = find_markup_start(std::max(m_pos + (next_char() == '<' ? 1 : 0), m_text_scan_pos));
+        if (eof() && !m_finished) {
+            // Rescan the last byte next time: it may be a '<' whose meaning isn't known yet.
+            m_text_scan_pos = std::max(token_start, m_input.length() - 1);
+            m_pos = token_start;
+            return false;
+        }
+        m_text_scan_pos = 0;
+        append_text(token_start, m_pos);
+        return true;
+    }
+
+    // Position of the next '<' that starts a tag, end tag or markup declaration, or the
+    // end of the buffer. A '<' followed by anything else, as in "a < b", is text.
+    size_t Parser::find_markup_start(size_t from) const {
         while (true) {
-            consume_whitespace();
-            if (eof() || starts_with("</")) {
-                break;
+            size_t lt = Scan::find_first_of(m_input, from, '<');
+            if (lt + 1 >= m_input.length()) return m_input.length();
+            char c = m_input[lt + 1];
+            if (is_alpha(c) || c == '/' || c == '!' || c == '?') return lt;
+            from = lt + 1;
+        }
+    }
+
+    // Whether the start tag at m_pos has its closing '>' in the buffer yet, skipping
+    // over quoted attribute values. Resumes where the last call stopped.
+    bool Parser::start_tag_complete() {
+        size_t pos = std::max(m_pos + 1, m_tag_scan_pos);
+        while (true) {
+            pos = m_tag_scan_quote ? Scan::find_first_of(m_input, pos, m_tag_scan_quote)
+                                   : Scan::find_first_of(m_input, pos, Scan::DelimiterSet('>', '"', '\''));
+            if (pos == m_input.length()) {
+                m_tag_scan_pos = pos;
+                return false;
+            }
+            char c = m_input[pos++];
+            if (m_tag_scan_quote) {
+                m_tag_scan_quote = 0;
+            } else if (c == '>') {
+                m_tag_scan_pos = 0;
+                return true;
+            } else {
+                m_tag_scan_quote = c;
             }
-            nodes.push_back(parse_node());
         }
-        return nodes;
     }
 
-    std::unique_ptr<DOM::Node> Parser::parse_node() {
-        if (next_char() == '<') {
-            return parse_element();
+    bool Parser::build_end_tag() {
+        if (!m_finished && Scan::find_first_of(m_input, m_pos, '>') == m_input.length()) {
+            return false;
+        }
+        m_pos += 2; // "</"
+        // A name that was never interned can't be open, so don't intern it now.
+        DOM::Atom tag = DOM::AtomTable::global().find(parse_tag_name());
+        consume_until('>');
+        if (!eof()) consume_char(); // '>'
+        if (tag != DOM::Atoms::Null) close_elements_to(tag);
+        return true;
+    }
+
+    // Content of <script> and <style>: everything up to the matching end tag is one
+    // text node, even if it contains '<'.
+    bool Parser::build_raw_text() {
+        std::string_view tag = m_open_elements.back()->element_data.tag_name();
+        size_t scan = std::max(m_pos, m_text_scan_pos);
+        size_t end_tag = std::string::npos;
+        while (end_tag == std::string::npos) {
+            scan = Scan::find_first_of(m_input, scan, '<');
+            size_t name_end = scan + 2 + tag.length();
+            // Not enough input to tell, unless no more is coming.
+            if (name_end > m_input.length() || (name_end == m_input.length() && !m_finished)) break;
+            bool match = m_input[scan + 1] == '/';
+            for (size_t i = 0; match && i < tag.length(); ++i) {
+                match = lower(m_input[scan + 2 + i]) == tag[i];
+            }
+            // The name has to end there: "</scriptx>" is text inside a <script>.
+            char after = name_end < m_input.length() ? m_input[name_end] : '>';
+            if (match && (is_space(after) || after == '/' || after == '>')) end_tag = scan;
+            ++scan;
+        }
+
+        if (end_tag == std::string::npos) {
+            if (!m_finished) {
+                m_text_scan_pos = std::min(scan, m_input.length());
+                return false;
+            }
+            end_tag = m_input.length();
+        }
+        m_text_scan_pos = 0;
+
+        consume_whitespace();
+        if (m_pos < end_tag) append_text(m_pos, end_tag);
+        m_pos = end_tag;
+        if (eof()) {
+            close_element();
+            return false;
+        }
+        return build_end_tag();
+    }
+
+    void Parser::append_text(size_t start, size_t end) {
+        DOM::Node* text = m_document->create_text_node(std::string_view(m_input).substr(start, end - start));
+        append_node(text);
+        if (m_on_node_complete) m_on_node_complete(*text);
+    }
+
+    // Uses the attributes collected by the last parse_attributes() call.
+    void Parser::open_element(DOM::Atom tag) {
+        close_implied_elements(tag);
+
+        m_attributes.clear();
+        for (const AttrToken& token : m_attribute_tokens) {
+            DOM::Atom name = DOM::intern(token.name);
+            // Like browsers, keep the first of duplicated attributes.
+            bool duplicate = std::any_of(m_attributes.begin(), m_attributes.end(),
+                                         [name](const DOM::Attr& attr) { return attr.name == name; });
+            if (!duplicate) m_attributes.push_back({ name, token.value });
+        }
+
+        DOM::Node* created = m_document->create_element_node(tag, m_attributes.data(), m_attributes.size());
+        append_node(created);
+        if (is_void_element(tag)) {
+            if (m_on_node_complete) m_on_node_complete(*created);
         } else {
-            return parse_text();
+            m_open_elements.push_back(created);
+            ++m_open_tag_counts[tag];
         }
     }
 
-    std::unique_ptr<DOM::Node> Parser::parse_text() {
-        return DOM::create_text_node(consume_while([](char c) { return c != '<'; }));
+    void Parser::append_node(DOM::Node* node) {
+        m_document->append_child(m_open_elements.empty() ? nullptr : m_open_elements.back(), node);
     }
 
-    std::unique_ptr<DOM::Node> Parser::parse_element() {
-        assert(consume_char() == '<');
-        std::string tag_name = parse_tag_name();
-        std::transform(tag_name.begin(), tag_name.end(), tag_name.begin(), ::tolower);
-        DOM::AttrMap attrs = parse_attributes();
-        assert(consume_char() == '>');
+    void Parser::close_element() {
+        DOM::Node* element = m_open_elements.back();
+        m_open_elements.pop_back();
+        --m_open_tag_counts[element->element_data.tag];
+        if (m_on_node_complete) m_on_node_complete(*element);
+    }
 
-        auto children = parse_nodes();
+    // An end tag closes the nearest open element with the same name and everything
+    // opened inside it. An end tag that matches nothing open is ignored.
+    void Parser::close_elements_to(DOM::Atom tag) {
+        close_open_element({ tag }, {});
+    }
 
-        if (starts_with("</")) {
-            assert(consume_char() == '<');
-            assert(consume_char() == '/');
-            std::string closing_tag = parse_tag_name();
-            std::transform(closing_tag.begin(), closing_tag.end(), closing_tag.begin(), ::tolower);
-            // We don't assert equality for robustness, but we consume the tag.
-            assert(consume_char() == '>');
+    // Closes the nearest open element named in `targets` and everything opened inside
+    // it, unless one of `boundaries` is open above it.
+    void Parser::close_open_element(std::initializer_list<DOM::Atom> targets,
+                                    std::initializer_list<DOM::Atom> boundaries) {
+        // Most start tags have nothing to close; don't walk a deep stack to find that out.
+        bool any_open = false;
+        for (DOM::Atom target : targets) {
+            auto it = m_open_tag_counts.find(target);
+            any_open = any_open || (it != m_open_tag_counts.end() && it->second > 0);
+        }
+        if (!any_open) return;
+
+        for (size_t i = m_open_elements.size(); i-- > 0;) {
+            DOM::Atom open = m_open_elements[i]->element_data.tag;
+            if (is_one_of(open, targets)) {
+                while (m_open_elements.size() > i) {
+                    close_element();
+                }
+                return;
+            }
+            if (is_one_of(open, boundaries)) return;
+        }
+    }
+
+    // End tags the author may leave out: "<li>a<li>b" and "<p>a<div>" close the
+    // previous <li> and the <p> before opening the new element.
+    void Parser::close_implied_elements(DOM::Atom tag) {
+        switch (tag) {
+            case Tag::li:
+                close_open_element({ Tag::li }, { Tag::ul, Tag::ol });
+                break;
+            case Tag::dt: case Tag::dd:
+                close_open_element({ Tag::dt, Tag::dd }, { Tag::dl });
+                break;
+            case Tag::tr:
+                close_open_element({ Tag::tr }, { Tag::table });
+                break;
+            case Tag::td: case Tag::th:
+                close_open_element({ Tag::td, Tag::th }, { Tag::tr, Tag::table });
+                break;
+            case Tag::option:
+                close_open_element({ Tag::option }, { Tag::select });
+                break;
+            default:
+                break;
+        }
+        if (closes_paragraph(tag)) {
+            close_open_element({ Tag::p }, { Tag::table, Tag::td, Tag::th, Tag::button });
         }
+    }
 
-        return DOM::create_element_node(tag_name, std::move(attrs), std::move(children));
+    // Tag and attribute names are case-insensitive. The parser owns its buffer, so it
+    // lowercases them where they are instead of building new strings.
+    std::string_view Parser::lowercase_in_place(size_t start, size_t end) {
+        for (size_t i = start; i < end; ++i) {
+            m_input[i] = lower(m_input[i]);
+        }
+        return std::string_view(m_input).substr(start, end - start);
     }
 
-    std::string Parser::parse_tag_name() {
-        return consume_while([](char c) { return isalnum(c); });
+    std::string_view Parser::parse_tag_name() {
+        size_t start = m_pos;
+        consume_while(is_alnum);
+        return lowercase_in_place(start, m_pos);
     }
 
-    // --- THIS IS THE UPGRADED FUNCTION ---
-    DOM::AttrMap Parser::parse_attributes() {
-        DOM::AttrMap attributes;
+    void Parser::parse_attributes() {
+        m_attribute_tokens.clear();
         while (true) {
             consume_whitespace();
-            if (next_char() == '>') {
+            if (eof() || next_char() == '>') {
                 break;
             }
-            std::string name = parse_tag_name();
-            std::string value = ""; // Default to empty string for boolean attributes
+            if (next_char() == '/') {
+                consume_char(); // self-closing marker, e.g. <br/>
+                continue;
+            }
+            size_t name_start = m_pos;
+            consume_while([](char c) { return !is_space(c) && c != '=' && c != '>' && c != '/'; });
+            std::string_view name = lowercase_in_place(name_start, m_pos);
+            std::string_view value; // Default to empty string for boolean attributes
 
             consume_whitespace();
             if (!eof() && next_char() == '=') {
                 consume_char(); // consume '='
                 value = parse_attr_value();
             }
-            attributes[name] = value;
+            m_attribute_tokens.push_back({ name, value });
         }
-        return attributes;
     }
 
-    std::string Parser::parse_attr_value() {
+    std::string_view Parser::parse_attr_value() {
         consume_whitespace();
+        if (eof()) return {};
         char open_quote = next_char();
         if (open_quote == '"' || open_quote == '\'') {
             consume_char();
-            std::string value = consume_while([open_quote](char c) { return c != open_quote; });
-            assert(consume_char() == open_quote);
+            std::string_view value = consume_until(open_quote);
+            if (!eof()) consume_char(); // closing quote
             return value;
         } else {
             // Handle unquoted attributes
-            return consume_while([](char c) { return !isspace(c) && c != '>'; });
+            return consume_while([](char c) { return !is_space(c) && c != '>'; });
         }
     }
 }
\ No newline at end of file
@@ -2,39 +2,98 @@
 #define HTML_PARSER_H
 
 #include "dom.h"
+#include "text_scanner.h"
 #include <string>
+#include <string_view>
 #include <vector>
+#include <memory>
 #include <functional>
-#include <unordered_set>
+#include <initializer_list>
+#include <unordered_map>
 
 namespace HTML {
     class Parser {
     public:
+        // One-shot parsing of a complete document.
         Parser(std::string input);
         // --- THIS IS THE PUBLIC ENTRY POINT ---
-        std::vector<std::unique_ptr<DOM::Node>> parse_nodes();
+        std::unique_ptr<DOM::Document> parse_document();
+
+        // Incremental parsing: feed() the document in chunks as it arrives and call
+        // finish() once at the end. Elements are attached to their parent as soon as
+        // their start tag is complete, so document() is always a valid partial tree.
+        // The result is the same DOM parse_document() gives for the whole input, for
+        // any split into chunks.
+        Parser();
+        void feed(std::string_view chunk);
+        std::unique_ptr<DOM::Document> finish();
+        const DOM::Document& document() const { return *m_document; }
+
+        // Called for each text node when it is created and for each element when its
+        // end tag (or the end of input) closes it.
+        void set_node_callback(std::function<void(DOM::Node&)> callback) { m_on_node_complete = std::move(callback); }
 
     private:
+        // The parser keeps the one copy of the source it was given. Every token is a
+        // string_view slice into it; strings are only built when a DOM node needs one.
         std::string m_input;
         size_t m_pos = 0;
 
-        // --- THIS IS THE NEW PRIVATE, RECURSIVE HELPER ---
-        std::vector<std::unique_ptr<DOM::Node>> parse_nodes_recursive(const std::string& parent_tag);
+        // Incremental parsing state, kept between feed() calls.
+        bool m_finished = false;
+        size_t m_text_scan_pos = 0;
+        // How far start_tag_complete() got into a start tag not yet complete, and the
+        // quote it was inside of, if any.
+        size_t m_tag_scan_pos = 0;
+        char m_tag_scan_quote = 0;
+        std::unique_ptr<DOM::Document> m_document;
+        std::vector<DOM::Node*> m_open_elements;
+        std::unordered_map<DOM::Atom, size_t> m_open_tag_counts;
+        // Reused for every start tag; names and values point into m_input until the
+        // element is created. Names are interned only then.
+        struct AttrToken {
+            std::string_view name;
+            std::string_view value;
+        };
+        std::vector<AttrToken> m_attribute_tokens;
+        std::vector<DOM::Attr> m_attributes;
+        std::function<void(DOM::Node&)> m_on_node_complete;
+
+        char next_char() const { return m_input[m_pos]; }
+        bool eof() const { return m_pos >= m_input.length(); }
+        bool starts_with(std::string_view s) const { return m_input.compare(m_pos, s.length(), s) == 0; }
+        char consume_char() { return m_input[m_pos++]; }
 
-        char next_char();
-        bool eof();
-        bool starts_with(const std::string& s);
-        char consume_char();
-        std::string consume_while(std::function<bool(char)> test);
+        template<typename Pred>
+        std::string_view consume_while(Pred test) {
+            size_t start = m_pos;
+            while (m_pos < m_input.length() && test(m_input[m_pos])) {
+                ++m_pos;
+            }
+            return std::string_view(m_input).substr(start, m_pos - start);
+        }
+
+        std::string_view consume_until(const Scan::DelimiterSet& delimiters);
         void consume_whitespace();
 
-        std::unique_ptr<DOM::Node> parse_node();
-        std::unique_ptr<DOM::Node> parse_text();
-        std::unique_ptr<DOM::Node> parse_element();
-        std::string parse_tag_name();
-        DOM::AttrMap parse_attributes();
-        std::pair<std::string, std::string> parse_attr();
-        std::string parse_attr_value();
+        bool build_next_node();
+        bool start_tag_complete();
+        bool build_end_tag();
+        bool build_raw_text();
+        size_t find_markup_start(size_t from) const;
+        void append_text(size_t start, size_t end);
+        void open_element(DOM::Atom tag);
+        void append_node(DOM::Node* node);
+        void close_element();
+        void close_elements_to(DOM::Atom tag);
+        void close_open_element(std::initializer_list<DOM::Atom> targets,
+                                std::initializer_list<DOM::Atom> boundaries);
+        void close_implied_elements(DOM::Atom tag);
+
+        std::string_view lowercase_in_place(size_t start, size_t end);
+        std::string_view parse_tag_name();
+        void parse_attributes();
+        std::string_view parse_attr_value();
     };
 }
 
@@ -1,61 +1,308 @@
 #include "javascript.h"
+#include "css_parser.h"
+#include "style.h"
 #include <iostream>
 #include <stdexcept>
 #include <functional>
+#include <algorithm>
+#include <cctype>
+#include <sstream>
 
 namespace JS {
 
-    DOM::Node* find_node_by_id(DOM::Node* node, const std::string& id) {
-        if (!node) return nullptr;
-        if (node->type == DOM::NodeType::Element) {
-            auto it = node->element_data.attributes.find("id");
-            if (it != node->element_data.attributes.end() && it->second == id) {
-                return node;
+    namespace {
+        // Hidden, so script can't see or forge it.
+        const char* const NodePointer = "\xff""node_ptr";
+
+        // Defines an accessor on the object at the top of the stack.
+        void define_accessor(duk_context* ctx, const char* name, duk_c_function getter, duk_c_function setter) {
+            duk_push_string(ctx, name);
+            duk_uint_t flags = 0;
+            duk_idx_t object = -2;
+            if (getter) {
+                duk_push_c_function(ctx, getter, 0);
+                flags |= DUK_DEFPROP_HAVE_GETTER;
+                --object;
+            }
+            if (setter) {
+                duk_push_c_function(ctx, setter, 1);
+                flags |= DUK_DEFPROP_HAVE_SETTER;
+                --object;
+            }
+            duk_def_prop(ctx, object, flags);
+        }
+
+        void collect_elements(const DOM::Document& document, std::vector<DOM::Node*>& out) {
+            std::vector<DOM::Node*> pending;
+            for (DOM::Node* node : document.top_level_nodes()) pending.push_back(node);
+            std::reverse(pending.begin(), pending.end());
+            while (!pending.empty()) {
+                DOM::Node* node = pending.back();
+                pending.pop_back();
+                if (node->type == DOM::NodeType::Element) out.push_back(node);
+                for (DOM::Node* child = node->last_child; child; child = child->prev_sibling) {
+                    pending.push_back(child);
+                }
             }
         }
-        for (auto& child : node->children) {
-            if (auto found = find_node_by_id(child.get(), id)) {
-                return found;
+
+        // Elements matching any selector in the list, in document order. A single
+        // selector starts from the narrowest index its rightmost compound names instead
+        // of the whole tree.
+        std::vector<DOM::Node*> query_selector_all(DOM::Document& document, const std::string& selectors, bool first_only) {
+            std::vector<CSS::Selector> list = CSS::Parser(selectors).parse_selector_list();
+            std::vector<DOM::Node*> matches;
+            if (list.empty()) return matches;
+
+            std::vector<DOM::Node*> all;
+            const std::vector<DOM::Node*>* candidates = &all;
+            if (list.size() == 1 && list[0].id != DOM::Atoms::Null) {
+                if (DOM::Node* node = document.element_by_id(list[0].id)) all.push_back(node);
+            } else if (list.size() == 1 && !list[0].classes.empty()) {
+                candidates = &document.elements_by_class(list[0].classes[0]);
+            } else if (list.size() == 1 && list[0].tag != DOM::Atoms::Null) {
+                candidates = &document.elements_by_tag(list[0].tag);
+            } else {
+                collect_elements(document, all);
+            }
+
+            for (DOM::Node* node : *candidates) {
+                for (const CSS::Selector& selector : list) {
+                    if (Style::selector_matches(node, selector)) {
+                        matches.push_back(node);
+                        break;
+                    }
+                }
+                if (first_only && !matches.empty()) break;
             }
+            return matches;
         }
-        return nullptr;
     }
 
-    int innerHTML_setter(duk_context* ctx) {
-        const char* new_text = duk_require_string(ctx, 0);
-        duk_push_current_function(ctx);
-        duk_get_prop_string(ctx, -1, "\xff""node_ptr");
-        DOM::Node* n = static_cast<DOM::Node*>(duk_require_pointer(ctx, -1));
+    JSEngine* JSEngine::from_context(duk_context* ctx) {
+        duk_push_global_stash(ctx);
+        duk_get_prop_string(ctx, -1, "js_engine_ptr");
+        JSEngine* engine = static_cast<JSEngine*>(duk_to_pointer(ctx, -1));
+        duk_pop_2(ctx);
+        return engine;
+    }
+
+    DOM::Node* JSEngine::this_node(duk_context* ctx) {
+        duk_push_this(ctx);
+        duk_get_prop_string(ctx, -1, NodePointer);
+        DOM::Node* node = static_cast<DOM::Node*>(duk_get_pointer(ctx, -1));
         duk_pop_2(ctx);
+        return node;
+    }
 
-        if (n) {
-            n->children.clear();
-            n->children.push_back(DOM::create_text_node(new_text));
+    int JSEngine::native_set_inner_html(duk_context* ctx) {
+        const char* new_text = duk_require_string(ctx, 0);
+        DOM::Node* n = this_node(ctx);
+
+        JSEngine* engine = from_context(ctx);
+        if (n && engine && engine->m_document) {
+            engine->m_document->remove_children(n);
+            engine->m_document->append_child(n, engine->m_document->create_text_node(new_text));
         }
         
         return 0;
     }
 
-    int JSEngine::native_get_element_by_id(duk_context* ctx) {
+    int JSEngine::native_get_tag_name(duk_context* ctx) {
+        DOM::Node* node = this_node(ctx);
+        if (!node || node->type != DOM::NodeType::Element) return 0;
+        std::string name(node->element_data.tag_name());
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::toupper(c); });
+        duk_push_lstring(ctx, name.data(), name.size());
+        return 1;
+    }
+
+    int JSEngine::native_get_id(duk_context* ctx) {
+        DOM::Node* node = this_node(ctx);
+        if (!node || node->type != DOM::NodeType::Element) return 0;
+        std::string_view id = node->element_data.get_attribute(DOM::Atoms::id);
+        duk_push_lstring(ctx, id.data(), id.size());
+        return 1;
+    }
+
+    int JSEngine::native_get_node_type(duk_context* ctx) {
+        DOM::Node* node = this_node(ctx);
+        if (!node) return 0;
+        duk_push_int(ctx, node->type == DOM::NodeType::Element ? 1 : 3);
+        return 1;
+    }
+
+    int JSEngine::native_get_parent_node(duk_context* ctx) {
+        DOM::Node* node = this_node(ctx);
+        JSEngine* engine = from_context(ctx);
+        if (!node || !engine) return 0;
+        engine->push_node(ctx, node->parent);
+        return 1;
+    }
+
+    void JSEngine::push_node(duk_context* ctx, DOM::Node* node) {
+        if (!node) {
+            duk_push_null(ctx);
+            return;
+        }
         duk_push_global_stash(ctx);
-        duk_get_prop_string(ctx, -1, "js_engine_ptr");
-        JSEngine* engine = static_cast<JSEngine*>(duk_to_pointer(ctx, -1));
-        duk_pop_2(ctx);
+        duk_get_prop_string(ctx, -1, "node_wrappers");
+        auto it = m_wrapper_slots.find(node);
+        if (it != m_wrapper_slots.end()) {
+            duk_get_prop_index(ctx, -1, it->second);
+        } else {
+            duk_push_object(ctx);
+            duk_get_prop_string(ctx, -3, node->type == DOM::NodeType::Element ? "element_prototype" : "node_prototype");
+            duk_set_prototype(ctx, -2);
+            duk_push_pointer(ctx, node);
+            duk_put_prop_string(ctx, -2, NodePointer);
+
+            duk_uarridx_t slot = m_wrapper_slot_count;
+            if (!m_free_wrapper_slots.empty()) {
+                slot = m_free_wrapper_slots.back();
+                m_free_wrapper_slots.pop_back();
+            } else {
+                ++m_wrapper_slot_count;
+            }
+            duk_dup_top(ctx);
+            duk_put_prop_index(ctx, -3, slot);
+            m_wrapper_slots.emplace(node, slot);
+        }
+        // Leaves only the wrapper.
+        duk_replace(ctx, -3);
+        duk_pop(ctx);
+    }
+
+    void JSEngine::push_node_array(duk_context* ctx, const std::vector<DOM::Node*>& nodes) {
+        duk_idx_t array = duk_push_array(ctx);
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            push_node(ctx, nodes[i]);
+            duk_put_prop_index(ctx, array, static_cast<duk_uarridx_t>(i));
+        }
+    }
+
+    void JSEngine::node_removed(DOM::Node* node) {
+        auto it = m_wrapper_slots.find(node);
+        if (it == m_wrapper_slots.end()) return;
+        duk_push_global_stash(m_ctx);
+        duk_get_prop_string(m_ctx, -1, "node_wrappers");
+        duk_get_prop_index(m_ctx, -1, it->second);
+        duk_push_pointer(m_ctx, nullptr);
+        duk_put_prop_string(m_ctx, -2, NodePointer);
+        duk_pop(m_ctx);
+        duk_push_undefined(m_ctx);
+        duk_put_prop_index(m_ctx, -2, it->second);
+        duk_pop_2(m_ctx);
+        m_free_wrapper_slots.push_back(it->second);
+        m_wrapper_slots.erase(it);
+    }
+
+    void JSEngine::document_destroyed(DOM::Document* document) {
+        if (document != m_document) return;
+        m_document = nullptr;
+        clear_wrappers();
+    }
+
+    void JSEngine::clear_wrappers() {
+        duk_push_global_stash(m_ctx);
+        duk_get_prop_string(m_ctx, -1, "node_wrappers");
+        for (const auto& entry : m_wrapper_slots) {
+            duk_get_prop_index(m_ctx, -1, entry.second);
+            duk_push_pointer(m_ctx, nullptr);
+            duk_put_prop_string(m_ctx, -2, NodePointer);
+            duk_pop(m_ctx);
+        }
+        duk_pop(m_ctx);
+        duk_push_array(m_ctx);
+        duk_put_prop_string(m_ctx, -2, "node_wrappers");
+        duk_pop(m_ctx);
+        m_wrapper_slots.clear();
+        m_free_wrapper_slots.clear();
+        m_wrapper_slot_count = 0;
+    }
+
+    int JSEngine::native_get_element_by_id(duk_context* ctx) {
+        JSEngine* engine = from_context(ctx);
 
         if (!engine || !engine->m_document) { return 0; }
 
-        const char* id = duk_require_string(ctx, 0);
-        DOM::Node* found_node = find_node_by_id(engine->m_document, id);
+        // An id that was never interned isn't on any element.
+        DOM::Atom id = DOM::AtomTable::global().find(duk_require_string(ctx, 0));
+        DOM::Node* found_node = id != DOM::Atoms::Null ? engine->m_document->element_by_id(id) : nullptr;
 
-        if (!found_node) { return 0; }
+        if (found_node) {
+            engine->push_node(ctx, found_node);
+        } else {
+            duk_push_null(ctx);
+        }
+        return 1;
+    }
 
-        duk_push_object(ctx);
-        duk_push_string(ctx, "innerHTML");
-        duk_push_c_function(ctx, innerHTML_setter, 1);
-        duk_push_pointer(ctx, found_node);
-        duk_put_prop_string(ctx, -2, "\xff""node_ptr");
-        duk_def_prop(ctx, -3, DUK_DEFPROP_HAVE_SETTER);
+    int JSEngine::native_get_elements_by_class_name(duk_context* ctx) {
+        JSEngine* engine = from_context(ctx);
+        std::istringstream names(duk_require_string(ctx, 0));
+        if (!engine || !engine->m_document) { return 0; }
+
+        // Elements that have every class in the space-separated list.
+        std::vector<DOM::Atom> classes;
+        std::string name;
+        bool unknown = false;
+        while (names >> name) {
+            DOM::Atom atom = DOM::AtomTable::global().find(name);
+            unknown = unknown || atom == DOM::Atoms::Null;
+            classes.push_back(atom);
+        }
 
+        std::vector<DOM::Node*> matches;
+        if (!classes.empty() && !unknown) {
+            for (DOM::Node* node : engine->m_document->elements_by_class(classes[0])) {
+                bool all = std::all_of(classes.begin() + 1, classes.end(),
+                                       [node](DOM::Atom atom) { return node->element_data.has_class(atom); });
+                if (all) matches.push_back(node);
+            }
+        }
+        engine->push_node_array(ctx, matches);
+        return 1;
+    }
+
+    int JSEngine::native_get_elements_by_tag_name(duk_context* ctx) {
+        JSEngine* engine = from_context(ctx);
+        std::string name = duk_require_string(ctx, 0);
+        if (!engine || !engine->m_document) { return 0; }
+
+        std::vector<DOM::Node*> matches;
+        if (name == "*") {
+            collect_elements(*engine->m_document, matches);
+        } else {
+            // Tag names are stored lowercase.
+            std::transform(name.begin(), name.end(), name.begin(), Scan::lower);
+            DOM::Atom tag = DOM::AtomTable::global().find(name);
+            if (tag != DOM::Atoms::Null) matches = engine->m_document->elements_by_tag(tag);
+        }
+        engine->push_node_array(ctx, matches);
+        return 1;
+    }
+
+    int JSEngine::native_query_selector(duk_context* ctx) {
+        JSEngine* engine = from_context(ctx);
+        std::string selectors = duk_require_string(ctx, 0);
+        if (!engine || !engine->m_document) { return 0; }
+
+        std::vector<DOM::Node*> matches = query_selector_all(*engine->m_document, selectors, true);
+        if (matches.empty()) {
+            duk_push_null(ctx);
+        } else {
+            engine->push_node(ctx, matches.front());
+        }
+        return 1;
+    }
+
+    int JSEngine::native_query_selector_all(duk_context* ctx) {
+        JSEngine* engine = from_context(ctx);
+        std::string selectors = duk_require_string(ctx, 0);
+        if (!engine || !engine->m_document) { return 0; }
+
+        engine->push_node_array(ctx, query_selector_all(*engine->m_document, selectors, false));
         return 1;
     }
 
@@ -66,6 +313,21 @@ namespace JS {
         duk_push_global_stash(m_ctx);
         duk_push_pointer(m_ctx, this);
         duk_put_prop_string(m_ctx, -2, "js_engine_ptr");
+        duk_push_array(m_ctx);
+        duk_put_prop_string(m_ctx, -2, "node_wrappers");
+
+        // Element.prototype inherits from Node.prototype, as in the DOM.
+        duk_push_object(m_ctx);
+        define_accessor(m_ctx, "nodeType", native_get_node_type, nullptr);
+        define_accessor(m_ctx, "parentNode", native_get_parent_node, nullptr);
+        duk_push_object(m_ctx);
+        duk_dup(m_ctx, -2);
+        duk_set_prototype(m_ctx, -2);
+        define_accessor(m_ctx, "tagName", native_get_tag_name, nullptr);
+        define_accessor(m_ctx, "id", native_get_id, nullptr);
+        define_accessor(m_ctx, "innerHTML", nullptr, native_set_inner_html);
+        duk_put_prop_string(m_ctx, -3, "element_prototype");
+        duk_put_prop_string(m_ctx, -2, "node_prototype");
         duk_pop(m_ctx);
 
         duk_push_global_object(m_ctx);
@@ -78,16 +340,30 @@ namespace JS {
         duk_push_object(m_ctx);
         duk_push_c_function(m_ctx, native_get_element_by_id, 1);
         duk_put_prop_string(m_ctx, -2, "getElementById");
+        duk_push_c_function(m_ctx, native_get_elements_by_class_name, 1);
+        duk_put_prop_string(m_ctx, -2, "getElementsByClassName");
+        duk_push_c_function(m_ctx, native_get_elements_by_tag_name, 1);
+        duk_put_prop_string(m_ctx, -2, "getElementsByTagName");
+        duk_push_c_function(m_ctx, native_query_selector, 1);
+        duk_put_prop_string(m_ctx, -2, "querySelector");
+        duk_push_c_function(m_ctx, native_query_selector_all, 1);
+        duk_put_prop_string(m_ctx, -2, "querySelectorAll");
         duk_put_prop_string(m_ctx, -2, "document");
 
         duk_pop(m_ctx);
     }
 
-    void JSEngine::set_document(DOM::Node* doc) {
+    void JSEngine::set_document(DOM::Document* doc) {
+        if (m_document) m_document->remove_observer(this);
+        clear_wrappers();
         m_document = doc;
+        if (m_document) m_document->add_observer(this);
     }
 
-    JSEngine::~JSEngine() { if (m_ctx) { duk_destroy_heap(m_ctx); } }
+    JSEngine::~JSEngine() {
+        if (m_document) m_document->remove_observer(this);
+        if (m_ctx) { duk_destroy_heap(m_ctx); }
+    }
 
     bool JSEngine::run_script(const std::string& script) {
         if (duk_peval_string(m_ctx, script.c_str()) != 0) {
@@ -105,10 +381,7 @@ namespace JS {
     }
 
     int JSEngine::native_console_log(duk_context* ctx) {
-        duk_push_global_stash(ctx);
-        duk_get_prop_string(ctx, -1, "js_engine_ptr");
-        JSEngine* engine = static_cast<JSEngine*>(duk_to_pointer(ctx, -1));
-        duk_pop_2(ctx);
+        JSEngine* engine = from_context(ctx);
         if (engine) {
             std::string log_message;
             int arg_count = duk_get_top(ctx);
@@ -2,31 +2,60 @@
 #define JAVASCRIPT_H
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include "duktape.h"
 #include "dom.h" // Include DOM header
 
 namespace JS {
 
-    class JSEngine {
+    // Nodes reach script as wrapper objects, one per node for as long as the node is
+    // in the document, so lookups return the same object and `===` holds. Wrappers
+    // share a Node and an Element prototype that carry the accessors. A wrapper whose
+    // node is removed, or whose document is replaced, stays valid to hold but no
+    // longer reaches any node.
+    class JSEngine : public DOM::DocumentObserver {
     public:
         JSEngine();
         ~JSEngine();
 
-        // Give the JS engine a pointer to the document root
-        void set_document(DOM::Node* doc);
+        // Give the JS engine a pointer to the document
+        void set_document(DOM::Document* doc);
 
         bool run_script(const std::string& script);
         const std::vector<std::string>& get_logs() const;
 
+        void node_removed(DOM::Node* node) override;
+        void document_destroyed(DOM::Document* document) override;
+
     private:
         duk_context* m_ctx;
         std::vector<std::string> m_logs;
-        DOM::Node* m_document = nullptr;
+        DOM::Document* m_document = nullptr;
+        // Wrappers live in an array in the global stash, which keeps them alive; these
+        // are their indexes there.
+        std::unordered_map<const DOM::Node*, duk_uarridx_t> m_wrapper_slots;
+        std::vector<duk_uarridx_t> m_free_wrapper_slots;
+        duk_uarridx_t m_wrapper_slot_count = 0;
 
         // C++ functions that will be callable from JavaScript
         static int native_console_log(duk_context* ctx);
         static int native_get_element_by_id(duk_context* ctx);
+        static int native_get_elements_by_class_name(duk_context* ctx);
+        static int native_get_elements_by_tag_name(duk_context* ctx);
+        static int native_query_selector(duk_context* ctx);
+        static int native_query_selector_all(duk_context* ctx);
+        static int native_set_inner_html(duk_context* ctx);
+        static int native_get_tag_name(duk_context* ctx);
+        static int native_get_id(duk_context* ctx);
+        static int native_get_node_type(duk_context* ctx);
+        static int native_get_parent_node(duk_context* ctx);
+        static JSEngine* from_context(duk_context* ctx);
+        // The node of the wrapper `this` is, or null if it no longer has one.
+        static DOM::Node* this_node(duk_context* ctx);
+        void push_node(duk_context* ctx, DOM::Node* node);
+        void push_node_array(duk_context* ctx, const std::vector<DOM::Node*>& nodes);
+        void clear_wrappers();
     };
 
 } // namespace JS
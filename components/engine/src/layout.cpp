@@ -1,164 +1,598 @@
 #include "layout.h"
+#include "thread_pool.h"
 #include <string>
 #include <iostream>
 #include <algorithm>
 #include <numeric>
-#include <cmath> // For std::ceil
+#include <chrono>
+#include <mutex>
 
 namespace Layout {
 
-    std::unique_ptr<LayoutBox> build_layout_box(const Style::StyledNode* styled_node);
+    namespace {
+        using Engine::ParallelThreshold;
+        using Engine::TaskGrain;
+    }
+
+    struct LayoutTree::LayoutContext {
+        LayoutContext(TextRunCache& text_cache, LayoutStats& stats, std::vector<TextLine>& line_buffer, ParallelLayoutJob* job)
+            : text_cache(text_cache), stats(stats), line_buffer(line_buffer), job(job) {}
+
+        TextRunCache& text_cache;
+        LayoutStats& stats;
+        std::vector<TextLine>& line_buffer;
+        ParallelLayoutJob* job;
+        // With a job, m_lines can't grow while tasks run, so lines that outgrow their
+        // range are collected here, with their boxes, and appended afterwards.
+        std::vector<TextLine> deferred_lines;
+        std::vector<std::pair<BoxId, uint32_t>> deferred_boxes; // Box, first line in deferred_lines.
+    };
+
+    // State shared by the tasks of one parallel layout.
+    struct LayoutTree::ParallelLayoutJob {
+        explicit ParallelLayoutJob(Engine::ThreadPool& pool) : pool(pool) {}
+
+        Engine::ThreadPool& pool;
+        std::mutex mutex; // Guards the text cache and everything below.
+        LayoutStats stats;
+        std::vector<std::vector<TextLine>> deferred_lines;
+        std::vector<std::vector<std::pair<BoxId, uint32_t>>> deferred_boxes;
+
+        void finish_task(LayoutContext& context) {
+            std::lock_guard<std::mutex> lock(mutex);
+            stats += context.stats;
+            deferred_lines.push_back(std::move(context.deferred_lines));
+            deferred_boxes.push_back(std::move(context.deferred_boxes));
+        }
+    };
+
+    LayoutTree layout_tree(const Style::StyledNode& root, Rect viewport, TextRunCache& text_cache) {
+        LayoutTree tree;
+        tree.build(root);
+        tree.layout(viewport, text_cache);
+        return tree;
+    }
+
+    // Whitespace-only text gets no box.
+    bool generates_box(const Style::StyledNode& styled_node) {
+        const DOM::Node* node = styled_node.node;
+        return node->type == DOM::NodeType::Element ||
+               (node->type == DOM::NodeType::Text && node->text_data.find_first_not_of(" \t\n\r") != std::string_view::npos);
+    }
+
+    BoxType box_type_for(const Style::StyledNode& styled_node) {
+        if (styled_node.node->type == DOM::NodeType::Text) return Layout::BoxType::Anonymous;
+        CSS::Display display = styled_node.style->box->display;
+        if (display == CSS::Display::Flex) return Layout::BoxType::Flex;
+        if (display == CSS::Display::Block) return Layout::BoxType::Block;
+        return Layout::BoxType::Inline;
+    }
+
+    Font font_for(const Style::InheritedStyle& style) {
+        Font font;
+        font.family = style.font_family;
+        font.weight = style.font_weight;
+        font.size = style.font_size;
+        return font;
+    }
+
+    void LayoutTree::clear() {
+        // clear() keeps the arrays' capacity for the next build.
+        m_rects.clear();
+        m_nodes.clear();
+        m_edges.clear();
+        m_data.clear();
+        m_lines.clear();
+        m_detached = 0;
+        m_subtree_sizes_valid = false;
+    }
+
+    void LayoutTree::build(const Style::StyledNode& root) {
+        clear();
+        build_box(root, NoBox);
+    }
+
+    BoxId LayoutTree::build_box(const Style::StyledNode& styled_node, BoxId parent) {
+        BoxId box = static_cast<BoxId>(m_nodes.size());
+        BoxNode node;
+        node.parent = parent;
+        node.box_type = box_type_for(styled_node);
+        m_nodes.push_back(node);
+        m_rects.emplace_back();
+        m_edges.emplace_back();
+        BoxData data;
+        data.styled_node = &styled_node;
+        m_data.push_back(data);
+
+        build_children(box, styled_node);
+        return box;
+    }
+
+    void LayoutTree::build_children(BoxId box, const Style::StyledNode& styled_node) {
+        // Indices, not references: building a child may grow the arrays.
+        BoxId previous = NoBox;
+        for (const auto& child : styled_node.children) {
+            if (!generates_box(*child)) continue;
+            BoxId child_box = build_box(*child, box);
+            if (previous == NoBox) {
+                m_nodes[box].first_child = child_box;
+            } else {
+                m_nodes[previous].next_sibling = child_box;
+            }
+            previous = child_box;
+        }
+    }
+
+    void LayoutTree::mark_needs_layout(BoxId box) {
+        m_nodes[box].needs_layout = true;
+        for (BoxId ancestor = m_nodes[box].parent; ancestor != NoBox && !m_nodes[ancestor].child_needs_layout;
+             ancestor = m_nodes[ancestor].parent) {
+            m_nodes[ancestor].child_needs_layout = true;
+        }
+    }
+
+    // Whether anything a box's own layout reads differs in its new style: its box
+    // properties, or for text, its font, line height and content. Text nodes never
+    // change content, and their text is never freed while the document lives, so
+    // the same characters at the same address are the same text.
+    bool LayoutTree::layout_inputs_changed(BoxId box, const Style::StyledNode& styled_node) const {
+        if (m_nodes[box].box_type != box_type_for(styled_node)) return true;
+        const Style::ComputedStyle& old_style = *m_data[box].styled_node->style;
+        const Style::ComputedStyle& new_style = *styled_node.style;
+        if (m_nodes[box].box_type == Layout::BoxType::Anonymous) {
+            std::string_view text = m_data[box].text;
+            std::string_view new_text = styled_node.node->text_data;
+            return font_for(*old_style.inherited) != font_for(*new_style.inherited) ||
+                   old_style.inherited->used_line_height() != new_style.inherited->used_line_height() ||
+                   text.data() != new_text.data() || text.size() != new_text.size();
+        }
+        return !(*old_style.box == *new_style.box);
+    }
+
+    size_t LayoutTree::subtree_size(BoxId box) const {
+        size_t size = 1;
+        for (BoxId child = m_nodes[box].first_child; child != NoBox; child = m_nodes[child].next_sibling) {
+            size += subtree_size(child);
+        }
+        return size;
+    }
+
+    void LayoutTree::update_box(BoxId box, const Style::StyledNode& styled_node) {
+        if (layout_inputs_changed(box, styled_node)) mark_needs_layout(box);
+        BoxType box_type = box_type_for(styled_node);
+        if (m_nodes[box].box_type != box_type) {
+            // Nothing carries over, not even margins and padding.
+            m_nodes[box].box_type = box_type;
+            m_rects[box] = Rect();
+            m_edges[box] = BoxEdges();
+        }
+
+        // The old styled nodes are still alive, so children are matched by DOM node.
+        BoxId child_box = m_nodes[box].first_child;
+        bool same_children = true;
+        for (const auto& child : styled_node.children) {
+            if (!generates_box(*child)) continue;
+            if (child_box == NoBox || m_data[child_box].styled_node->node != child->node) {
+                same_children = false;
+                break;
+            }
+            child_box = m_nodes[child_box].next_sibling;
+        }
+        same_children = same_children && child_box == NoBox;
+
+        m_data[box].styled_node = &styled_node;
+        if (same_children) {
+            child_box = m_nodes[box].first_child;
+            for (const auto& child : styled_node.children) {
+                if (!generates_box(*child)) continue;
+                update_box(child_box, *child);
+                child_box = m_nodes[child_box].next_sibling;
+            }
+        } else {
+            // The old children stay in the arrays, unlinked, until the next compaction.
+            for (child_box = m_nodes[box].first_child; child_box != NoBox; child_box = m_nodes[child_box].next_sibling) {
+                m_detached += subtree_size(child_box);
+            }
+            m_nodes[box].first_child = NoBox;
+            build_children(box, styled_node);
+            mark_needs_layout(box);
+            m_subtree_sizes_valid = false;
+        }
+    }
+
+    void LayoutTree::update(const Style::StyledNode& root) {
+        if (empty() || m_data[0].styled_node->node != root.node) {
+            build(root);
+            return;
+        }
+        update_box(0, root);
+        if (m_detached > m_nodes.size() / 2) compact();
+    }
+
+    // Copies the live boxes, in document order, into fresh arrays.
+    void LayoutTree::compact() {
+        LayoutTree live;
+        size_t live_size = m_nodes.size() - m_detached;
+        live.m_rects.reserve(live_size);
+        live.m_nodes.reserve(live_size);
+        live.m_edges.reserve(live_size);
+        live.m_data.reserve(live_size);
+        live.m_lines.reserve(m_lines.size());
+
+        std::vector<std::pair<BoxId, BoxId>> stack; // (box, its copy's parent)
+        std::vector<BoxId> last_copied_child(live_size, NoBox);
+        stack.emplace_back(0, NoBox);
+        while (!stack.empty()) {
+            auto [box, parent] = stack.back();
+            stack.pop_back();
+
+            BoxId copy = static_cast<BoxId>(live.m_nodes.size());
+            BoxNode node = m_nodes[box];
+            node.parent = parent;
+            node.first_child = NoBox;
+            node.next_sibling = NoBox;
+            live.m_nodes.push_back(node);
+            live.m_rects.push_back(m_rects[box]);
+            live.m_edges.push_back(m_edges[box]);
+            live.m_data.push_back(m_data[box]);
+            BoxData& data = live.m_data.back();
+            data.first_line = static_cast<uint32_t>(live.m_lines.size());
+            data.line_capacity = data.line_count;
+            live.m_lines.insert(live.m_lines.end(), m_lines.begin() + m_data[box].first_line,
+                                m_lines.begin() + m_data[box].first_line + data.line_count);
+            if (parent != NoBox) {
+                if (last_copied_child[parent] == NoBox) {
+                    live.m_nodes[parent].first_child = copy;
+                } else {
+                    live.m_nodes[last_copied_child[parent]].next_sibling = copy;
+                }
+                last_copied_child[parent] = copy;
+            }
 
-    template<typename T>
-    T get_value(const Style::StyledNode* node, const std::string& prop_name) {
-        if (!node) return T{};
-        auto it = node->specified_values.find(prop_name);
-        if (it != node->specified_values.end()) {
-            if (const T* val = std::get_if<T>(&it->second)) {
-                return *val;
+            // Pushed last child first, so children are copied in order.
+            size_t first = stack.size();
+            for (BoxId child = m_nodes[box].first_child; child != NoBox; child = m_nodes[child].next_sibling) {
+                stack.emplace_back(child, copy);
             }
+            std::reverse(stack.begin() + first, stack.end());
         }
-        return T{};
+
+        m_rects.swap(live.m_rects);
+        m_nodes.swap(live.m_nodes);
+        m_edges.swap(live.m_edges);
+        m_data.swap(live.m_data);
+        m_lines.swap(live.m_lines);
+        m_detached = 0;
+        m_subtree_sizes_valid = false;
+    }
+
+    // Records the size of every subtree below `box`, which detached boxes don't get.
+    uint32_t LayoutTree::count_subtree(BoxId box) {
+        uint32_t size = 1;
+        for (BoxId child = m_nodes[box].first_child; child != NoBox; child = m_nodes[child].next_sibling) {
+            size += count_subtree(child);
+        }
+        m_subtree_sizes[box] = size;
+        return size;
+    }
+
+    void LayoutTree::layout(Rect viewport, TextRunCache& text_cache, LayoutStats* stats) {
+        if (empty()) return;
+        run_layout(viewport, text_cache, nullptr, stats);
     }
 
-    float get_px_value(const Style::StyledNode* node, const std::string& prop_name) {
-        return get_value<float>(node, prop_name);
+    void LayoutTree::parallel_layout(Rect viewport, TextRunCache& text_cache, Engine::ThreadPool& pool, LayoutStats* stats) {
+        if (empty()) return;
+        if (!m_subtree_sizes_valid) {
+            m_subtree_sizes.resize(m_nodes.size());
+            count_subtree(0);
+            m_subtree_sizes_valid = true;
+        }
+        if (m_subtree_sizes[0] < ParallelThreshold) {
+            run_layout(viewport, text_cache, nullptr, stats);
+            return;
+        }
+        ParallelLayoutJob job(pool);
+        run_layout(viewport, text_cache, &job, stats);
     }
 
-    void layout_block(LayoutBox* box, Dimensions containing_block);
-    void layout_flex(LayoutBox* box, Dimensions containing_block);
+    void LayoutTree::run_layout(Rect viewport, TextRunCache& text_cache, ParallelLayoutJob* job, LayoutStats* stats) {
+        auto start = std::chrono::steady_clock::now();
+        LayoutStats local_stats;
+        LayoutContext context(text_cache, stats ? *stats : local_stats, m_line_buffer, job);
+        TextRunCacheStats cache_before = text_cache.stats();
+        layout_box(0, viewport, context);
+        if (job) {
+            // Every task has finished: a box whose children were laid out in parallel
+            // waited for them.
+            job->deferred_lines.push_back(std::move(context.deferred_lines));
+            job->deferred_boxes.push_back(std::move(context.deferred_boxes));
+            for (size_t i = 0; i < job->deferred_boxes.size(); ++i) {
+                const std::vector<TextLine>& lines = job->deferred_lines[i];
+                for (auto [box, first] : job->deferred_boxes[i]) {
+                    BoxData& data = m_data[box];
+                    data.first_line = static_cast<uint32_t>(m_lines.size());
+                    m_lines.insert(m_lines.end(), lines.begin() + first, lines.begin() + first + data.line_count);
+                }
+            }
+            context.stats += job->stats;
+        }
+        TextRunCacheStats cache_after = text_cache.stats();
+        context.stats.text_cache_hits += cache_after.hits - cache_before.hits;
+        context.stats.text_runs_measured += cache_after.misses - cache_before.misses;
+        context.stats.text_measure_ms += cache_after.measure_ms - cache_before.measure_ms;
+        context.stats.layout_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
 
-    std::unique_ptr<LayoutBox> layout_tree(const Style::StyledNode& root, Dimensions viewport) {
-        auto root_box = build_layout_box(&root);
-        if (root_box->box_type == Layout::BoxType::Flex) {
-            layout_flex(root_box.get(), viewport);
+    // Positions a laid out subtree in a containing block of the width it was laid out
+    // in, which is all a clean box needs when only its containing block moved. Every
+    // position is computed from the containing block the way layout computes it, not
+    // shifted from the old one, so a box ends up at the same float coordinates however
+    // it got there.
+    void LayoutTree::place_box(BoxId box, Rect containing_block) {
+        m_data[box].containing_block = containing_block;
+        Rect& rect = m_rects[box];
+        BoxType type = m_nodes[box].box_type;
+        if (type == Layout::BoxType::Anonymous) {
+            rect.x = containing_block.x;
+            rect.y = containing_block.y;
+        } else if (type == Layout::BoxType::Flex) {
+            rect.x = containing_block.x;
+            rect.y = containing_block.y;
+            for (BoxId child = m_nodes[box].first_child; child != NoBox; child = m_nodes[child].next_sibling) {
+                place_box(child, containing_block);
+            }
+            position_flex_items(box);
         } else {
-            layout_block(root_box.get(), viewport);
+            rect.x = containing_block.x + m_edges[box].margin.left;
+            rect.y = containing_block.y;
+            Rect content_box = content_box_of(box);
+            float children_height = 0.0f;
+            for (BoxId child = m_nodes[box].first_child; child != NoBox; child = m_nodes[child].next_sibling) {
+                Rect child_cb = content_box;
+                child_cb.y += children_height;
+                place_box(child, child_cb);
+                children_height = stack_child(children_height, child);
+            }
         }
-        return root_box;
     }
 
-    std::unique_ptr<LayoutBox> build_layout_box(const Style::StyledNode* styled_node) {
-        auto box = std::make_unique<LayoutBox>();
-        box->styled_node = styled_node;
+    // The area a block's children are laid out in, once its own rect is set.
+    Rect LayoutTree::content_box_of(BoxId box) const {
+        const Rect& rect = m_rects[box];
+        const EdgeSizes& padding = m_edges[box].padding;
+        Rect content_box;
+        content_box.x = rect.x + padding.left;
+        content_box.y = rect.y + padding.top;
+        content_box.width = rect.width - padding.left - padding.right;
+        return content_box;
+    }
+
+    // The height of a block's children up to and including `child`. Text boxes have no
+    // margins, so for them this just adds their height.
+    float LayoutTree::stack_child(float children_height, BoxId child) const {
+        const EdgeSizes& child_margin = m_edges[child].margin;
+        return children_height + (child_margin.top + m_rects[child].height + child_margin.bottom);
+    }
+
+    void LayoutTree::layout_box(BoxId box, Rect containing_block, LayoutContext& context) {
+        BoxNode& node = m_nodes[box];
+        Rect& last_containing_block = m_data[box].containing_block;
+        if (!node.needs_layout && !node.child_needs_layout && last_containing_block.width == containing_block.width) {
+            if (containing_block.x != last_containing_block.x || containing_block.y != last_containing_block.y) {
+                place_box(box, containing_block);
+                ++context.stats.boxes_moved;
+            } else {
+                ++context.stats.boxes_reused;
+            }
+            return;
+        }
 
-        if (styled_node->node->type == DOM::NodeType::Text) {
-            box->box_type = Layout::BoxType::Anonymous;
+        last_containing_block = containing_block;
+        ++context.stats.boxes_laid_out;
+        if (node.box_type == Layout::BoxType::Flex) {
+            layout_flex(box, containing_block, context);
+        } else if (node.box_type == Layout::BoxType::Anonymous) {
+            layout_text(box, containing_block, context);
         } else {
-            auto display = get_value<CSS::Display>(styled_node, "display");
-            if (display == CSS::Display::Flex) box->box_type = Layout::BoxType::Flex;
-            else if (display == CSS::Display::Block) box->box_type = Layout::BoxType::Block;
-            else box->box_type = Layout::BoxType::Inline;
+            layout_block(box, containing_block, context);
         }
+        m_nodes[box].needs_layout = false;
+        m_nodes[box].child_needs_layout = false;
+    }
 
-        for (const auto& child : styled_node->children) {
-            if (child->node->type == DOM::NodeType::Element || 
-               (child->node->type == DOM::NodeType::Text && child->node->text_data.find_first_not_of(" \t\n\r") != std::string::npos)) {
-                box->children.push_back(build_layout_box(child.get()));
+    // Lays out the siblings from `first` up to `end`. With `at_previous_y`, each goes
+    // where it was last laid out, for the caller to move into place.
+    void LayoutTree::layout_children(BoxId first, BoxId end, Rect containing_block, bool at_previous_y, LayoutContext& context) {
+        for (BoxId child = first; child != end; child = m_nodes[child].next_sibling) {
+            Rect child_cb = containing_block;
+            if (at_previous_y) child_cb.y = m_data[child].containing_block.y;
+            layout_box(child, child_cb, context);
+        }
+    }
+
+    // The children are cut, in order, into runs of at least TaskGrain boxes. Every
+    // run but the last becomes a task; the last is laid out here before waiting.
+    // A task writes only the boxes of its own subtrees.
+    void LayoutTree::layout_children_parallel(BoxId box, Rect containing_block, bool at_previous_y, LayoutContext& context) {
+        ParallelLayoutJob& job = *context.job;
+        TextRunCache& text_cache = context.text_cache;
+        Engine::TaskGroup tasks(job.pool);
+        BoxId run_first = NoBox;
+        size_t run_boxes = 0;
+        for (BoxId child = m_nodes[box].first_child; child != NoBox; child = m_nodes[child].next_sibling) {
+            if (run_first == NoBox) {
+                run_first = child;
+                run_boxes = 0;
+            }
+            run_boxes += m_subtree_sizes[child];
+            BoxId run_end = m_nodes[child].next_sibling;
+            // The last run is left to this thread, which would otherwise only wait.
+            if (run_boxes >= TaskGrain && run_end != NoBox) {
+                tasks.run([this, &job, &text_cache, run_first, run_end, containing_block, at_previous_y] {
+                    LayoutStats stats;
+                    std::vector<TextLine> line_buffer;
+                    LayoutContext task_context(text_cache, stats, line_buffer, &job);
+                    layout_children(run_first, run_end, containing_block, at_previous_y, task_context);
+                    job.finish_task(task_context);
+                });
+                run_first = NoBox;
             }
         }
-        return box;
+        if (run_first != NoBox) layout_children(run_first, NoBox, containing_block, at_previous_y, context);
+        tasks.wait();
     }
 
-    void layout_flex(LayoutBox* box, Dimensions containing_block) {
-        box->dimensions.x = containing_block.x;
-        box->dimensions.y = containing_block.y;
-        box->dimensions.width = containing_block.width;
-        
-        for (auto& child : box->children) {
-            layout_block(child.get(), containing_block);
+    void LayoutTree::layout_flex(BoxId box, Rect containing_block, LayoutContext& context) {
+        m_rects[box].x = containing_block.x;
+        m_rects[box].y = containing_block.y;
+        m_rects[box].width = containing_block.width;
+
+        // Flex items are all laid out in the container's own containing block.
+        if (context.job && m_subtree_sizes[box] > TaskGrain) {
+            layout_children_parallel(box, containing_block, false, context);
+        } else {
+            layout_children(m_nodes[box].first_child, NoBox, containing_block, false, context);
         }
 
+        float max_child_height = position_flex_items(box);
+        const Style::BoxStyle& style = *m_data[box].styled_node->style->box;
+        m_rects[box].height = style.height.kind == Style::ComputedLength::Kind::Px ? style.height.value : max_child_height;
+    }
+
+    // Places laid out flex items side by side along the container's top, spaced by
+    // justify-content, and returns the tallest one's height. Only the items' own rects
+    // move; their contents stay where they were laid out.
+    float LayoutTree::position_flex_items(BoxId box) {
         float total_children_width = 0.0f;
-        for (const auto& child : box->children) {
-            total_children_width += child->dimensions.width;
+        size_t child_count = 0;
+        for (BoxId child = m_nodes[box].first_child; child != NoBox; child = m_nodes[child].next_sibling) {
+            total_children_width += m_rects[child].width;
+            ++child_count;
         }
 
-        float remaining_space = box->dimensions.width - total_children_width;
+        const Rect& rect = m_rects[box];
+        float remaining_space = rect.width - total_children_width;
         float spacing = 0.0f;
         float offset = 0.0f;
 
-        auto justify = get_value<CSS::JustifyContent>(box->styled_node, "justify-content");
+        const Style::BoxStyle& style = *m_data[box].styled_node->style->box;
+        CSS::JustifyContent justify = style.justify_content;
         if (justify == CSS::JustifyContent::FlexEnd) offset = remaining_space;
         else if (justify == CSS::JustifyContent::Center) offset = remaining_space / 2.0f;
         else if (justify == CSS::JustifyContent::SpaceBetween) {
-            if (box->children.size() > 1) spacing = remaining_space / (box->children.size() - 1);
+            if (child_count > 1) spacing = remaining_space / (child_count - 1);
         } else if (justify == CSS::JustifyContent::SpaceAround) {
-            if (!box->children.empty()) {
-                spacing = remaining_space / box->children.size();
+            if (child_count > 0) {
+                spacing = remaining_space / child_count;
                 offset = spacing / 2.0f;
             }
         }
 
-        float current_x = box->dimensions.x + offset;
+        float current_x = rect.x + offset;
         float max_child_height = 0.0f;
 
-        for (auto& child : box->children) {
-            child->dimensions.x = current_x;
-            child->dimensions.y = box->dimensions.y;
-            current_x += child->dimensions.width + spacing;
-            max_child_height = std::max(max_child_height, child->dimensions.height);
-        }
-
-        box->dimensions.height = get_px_value(box->styled_node, "height") > 0 ? get_px_value(box->styled_node, "height") : max_child_height;
-    }
-
-    void layout_block(LayoutBox* box, Dimensions containing_block) {
-        box->dimensions.margin.top = get_px_value(box->styled_node, "margin-top");
-        box->dimensions.margin.bottom = get_px_value(box->styled_node, "margin-bottom");
-        box->dimensions.margin.left = get_px_value(box->styled_node, "margin-left");
-        box->dimensions.margin.right = get_px_value(box->styled_node, "margin-right");
-        box->dimensions.padding.top = get_px_value(box->styled_node, "padding-top");
-        box->dimensions.padding.bottom = get_px_value(box->styled_node, "padding-bottom");
-        box->dimensions.padding.left = get_px_value(box->styled_node, "padding-left");
-        box->dimensions.padding.right = get_px_value(box->styled_node, "padding-right");
-
-        box->dimensions.x = containing_block.x + box->dimensions.margin.left;
-        box->dimensions.y = containing_block.y;
-        
-        float total_horizontal_space = box->dimensions.padding.left + box->dimensions.padding.right +
-                                       box->dimensions.margin.left + box->dimensions.margin.right;
-        box->dimensions.width = get_px_value(box->styled_node, "width") > 0 ? get_px_value(box->styled_node, "width") : containing_block.width - total_horizontal_space;
-
-        Dimensions content_box;
-        content_box.x = box->dimensions.x + box->dimensions.padding.left;
-        content_box.y = box->dimensions.y + box->dimensions.padding.top;
-        content_box.width = box->dimensions.width - box->dimensions.padding.left - box->dimensions.padding.right;
-        
-        float children_height = 0.0f;
-        for (auto& child : box->children) {
-            Dimensions child_cb = content_box;
-            child_cb.y += children_height;
-
-            if (child->box_type == Layout::BoxType::Anonymous) {
-                child->dimensions.x = child_cb.x;
-                child->dimensions.y = child_cb.y;
-                child->dimensions.width = child_cb.width;
-                
-                float font_size = get_px_value(child->styled_node, "font-size") > 0 ? get_px_value(child->styled_node, "font-size") : 16.0f;
-                float chars_per_line = child->dimensions.width / (font_size * 0.6f);
-                if (chars_per_line > 0) {
-                    float num_lines = std::ceil(child->styled_node->node->text_data.length() / chars_per_line);
-                    child->dimensions.height = num_lines * font_size * 1.2f;
-                } else {
-                    child->dimensions.height = font_size * 1.2f;
-                }
+        for (BoxId child = m_nodes[box].first_child; child != NoBox; child = m_nodes[child].next_sibling) {
+            Rect& child_rect = m_rects[child];
+            child_rect.x = current_x;
+            child_rect.y = rect.y;
+            current_x += child_rect.width + spacing;
+            max_child_height = std::max(max_child_height, child_rect.height);
+        }
+        return max_child_height;
+    }
 
-                children_height += child->dimensions.height;
-            } else if (child->box_type == Layout::BoxType::Flex) {
-                layout_flex(child.get(), child_cb);
-                children_height += child->dimensions.margin.top + child->dimensions.height + child->dimensions.margin.bottom;
-            } else {
-                layout_block(child.get(), child_cb);
-                children_height += child->dimensions.margin.top + child->dimensions.height + child->dimensions.margin.bottom;
+    void LayoutTree::layout_text(BoxId box, Rect containing_block, LayoutContext& context) {
+        Rect& rect = m_rects[box];
+        rect.x = containing_block.x;
+        rect.y = containing_block.y;
+        rect.width = containing_block.width;
+
+        BoxData& data = m_data[box];
+        const Style::InheritedStyle& text_style = *data.styled_node->style->inherited;
+        Font font = font_for(text_style);
+        std::string_view text = data.styled_node->node->text_data;
+        if (data.text_run && data.text_run->font == font && data.text.data() == text.data() && data.text.size() == text.size()) {
+            ++context.stats.text_runs_kept;
+        } else if (context.job) {
+            std::lock_guard<std::mutex> lock(context.job->mutex);
+            data.text_run = context.text_cache.get(text, font);
+            data.text = text;
+        } else {
+            data.text_run = context.text_cache.get(text, font);
+            data.text = text;
+        }
+        break_lines(*data.text_run, rect.width, context.line_buffer);
+        store_lines(box, context.line_buffer, context);
+        rect.height = data.line_count * text_style.used_line_height();
+    }
+
+    // Lines that no longer fit their range get a new one at the end; the old one is
+    // only reclaimed by a rebuild or compaction.
+    void LayoutTree::store_lines(BoxId box, const std::vector<TextLine>& lines, LayoutContext& context) {
+        BoxData& data = m_data[box];
+        if (lines.size() > data.line_capacity && context.job) {
+            context.deferred_boxes.emplace_back(box, static_cast<uint32_t>(context.deferred_lines.size()));
+            context.deferred_lines.insert(context.deferred_lines.end(), lines.begin(), lines.end());
+            data.line_capacity = static_cast<uint32_t>(lines.size());
+        } else if (lines.size() > data.line_capacity) {
+            data.first_line = static_cast<uint32_t>(m_lines.size());
+            data.line_capacity = static_cast<uint32_t>(lines.size());
+            m_lines.insert(m_lines.end(), lines.begin(), lines.end());
+        } else {
+            std::copy(lines.begin(), lines.end(), m_lines.begin() + data.first_line);
+        }
+        data.line_count = static_cast<uint32_t>(lines.size());
+    }
+
+    void LayoutTree::layout_block(BoxId box, Rect containing_block, LayoutContext& context) {
+        // Percentages, even vertical ones, are of the containing block's width.
+        const Style::BoxStyle& style = *m_data[box].styled_node->style->box;
+        float reference = containing_block.width;
+        BoxEdges& edges = m_edges[box];
+        edges.margin.top = style.margin_top.resolve(reference);
+        edges.margin.bottom = style.margin_bottom.resolve(reference);
+        edges.margin.left = style.margin_left.resolve(reference);
+        edges.margin.right = style.margin_right.resolve(reference);
+        edges.padding.top = style.padding_top.resolve(reference);
+        edges.padding.bottom = style.padding_bottom.resolve(reference);
+        edges.padding.left = style.padding_left.resolve(reference);
+        edges.padding.right = style.padding_right.resolve(reference);
+
+        Rect& rect = m_rects[box];
+        rect.x = containing_block.x + edges.margin.left;
+        rect.y = containing_block.y;
+
+        float total_horizontal_space = edges.padding.left + edges.padding.right + edges.margin.left + edges.margin.right;
+        rect.width = style.width.resolve(reference, containing_block.width - total_horizontal_space);
+
+        Rect content_box = content_box_of(box);
+        float padding_height = edges.padding.top + edges.padding.bottom;
+
+        float children_height = 0.0f;
+        if (context.job && m_subtree_sizes[box] > TaskGrain) {
+            layout_children_parallel(box, content_box, true, context);
+            for (BoxId child = m_nodes[box].first_child; child != NoBox; child = m_nodes[child].next_sibling) {
+                Rect child_cb = content_box;
+                child_cb.y += children_height;
+                if (child_cb.y != m_data[child].containing_block.y) place_box(child, child_cb);
+                children_height = stack_child(children_height, child);
+            }
+        } else {
+            for (BoxId child = m_nodes[box].first_child; child != NoBox; child = m_nodes[child].next_sibling) {
+                Rect child_cb = content_box;
+                child_cb.y += children_height;
+                layout_box(child, child_cb, context);
+                children_height = stack_child(children_height, child);
             }
         }
 
-        float explicit_height = get_px_value(box->styled_node, "height");
-        if (explicit_height > 0.0f) {
-            box->dimensions.height = explicit_height;
+        // A percentage height needs a definite containing block height, which block
+        // layout doesn't have, so it behaves as auto.
+        if (style.height.kind == Style::ComputedLength::Kind::Px) {
+            m_rects[box].height = style.height.value;
         } else {
-            box->dimensions.height = children_height + box->dimensions.padding.top + box->dimensions.padding.bottom;
+            m_rects[box].height = children_height + padding_height;
         }
     }
 }
\ No newline at end of file
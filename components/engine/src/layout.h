@@ -2,8 +2,13 @@
 #define LAYOUT_H
 
 #include "style.h"
+#include "text_layout.h"
+#include <cstdint>
 #include <vector>
-#include <memory>
+
+namespace Engine {
+    class ThreadPool;
+}
 
 namespace Layout {
 
@@ -11,23 +16,155 @@ namespace Layout {
         float top = 0.0f, right = 0.0f, bottom = 0.0f, left = 0.0f;
     };
 
-    struct Dimensions {
+    struct Rect {
         float x = 0.0f, y = 0.0f, width = 0.0f, height = 0.0f;
+    };
+
+    struct BoxEdges {
         EdgeSizes padding;
         EdgeSizes border;
         EdgeSizes margin;
     };
 
-    enum class BoxType { Block, Inline, Anonymous, Flex };
+    enum class BoxType : uint8_t { Block, Inline, Anonymous, Flex };
+
+    // Boxes are indices into the tree's arrays.
+    using BoxId = uint32_t;
+    constexpr BoxId NoBox = UINT32_MAX;
+
+    struct LayoutStats {
+        size_t boxes_laid_out = 0;
+        size_t boxes_moved = 0;   // Reused, shifted along with their subtree.
+        size_t boxes_reused = 0;  // Reused where they were.
+        // Text boxes laid out again keep their run when their text and font are the
+        // same, and otherwise look it up in the cache, which measures it on a miss.
+        size_t text_runs_kept = 0;
+        size_t text_cache_hits = 0;
+        size_t text_runs_measured = 0;
+        double text_measure_ms = 0.0;
+        double layout_ms = 0.0;
+
+        LayoutStats& operator+=(const LayoutStats& other) {
+            boxes_laid_out += other.boxes_laid_out;
+            boxes_moved += other.boxes_moved;
+            boxes_reused += other.boxes_reused;
+            text_runs_kept += other.text_runs_kept;
+            text_cache_hits += other.text_cache_hits;
+            text_runs_measured += other.text_runs_measured;
+            text_measure_ms += other.text_measure_ms;
+            layout_ms += other.layout_ms;
+            return *this;
+        }
+    };
+
+    // The box tree, stored as index-linked records in parallel arrays: geometry and
+    // tree links, which every traversal reads, apart from the edges and style data
+    // only laying out a box needs. A build lays the boxes out in document order and
+    // reuses the arrays' storage, so rebuilding allocates nothing once the arrays
+    // have grown to the page.
+    class LayoutTree {
+    public:
+        bool empty() const { return m_nodes.empty(); }
+        BoxId root() const { return empty() ? NoBox : 0; }
+        // Boxes in the arrays, including ones detached by update() and not yet compacted away.
+        size_t size() const { return m_nodes.size(); }
+
+        const Rect& rect(BoxId box) const { return m_rects[box]; }
+        const BoxEdges& edges(BoxId box) const { return m_edges[box]; }
+        BoxType box_type(BoxId box) const { return m_nodes[box].box_type; }
+        const Style::StyledNode* styled_node(BoxId box) const { return m_data[box].styled_node; }
+        BoxId parent(BoxId box) const { return m_nodes[box].parent; }
+        BoxId first_child(BoxId box) const { return m_nodes[box].first_child; }
+        BoxId next_sibling(BoxId box) const { return m_nodes[box].next_sibling; }
+        // For text boxes, the laid out run and its lines, top to bottom.
+        const TextRun* text_run(BoxId box) const { return m_data[box].text_run.get(); }
+        const TextLine* lines(BoxId box) const { return m_lines.data() + m_data[box].first_line; }
+        uint32_t line_count(BoxId box) const { return m_data[box].line_count; }
+
+        void clear();
+        // Replaces the tree with boxes for `root`, every one needing layout.
+        void build(const Style::StyledNode& root);
+        // Points the tree at a new style tree for the same document, as produced after
+        // a style change or DOM mutation, and marks the boxes whose layout inputs
+        // changed. A box whose children changed gets its children rebuilt; a tree for
+        // another root is rebuilt from scratch. The old style tree must still be alive.
+        void update(const Style::StyledNode& root);
+        void mark_needs_layout(BoxId box);
+
+        // Lays out the boxes that need it, and the ancestors whose content they are part
+        // of. Nothing is laid out again when nothing changed, viewport width included.
+        void layout(Rect viewport, TextRunCache& text_cache, LayoutStats* stats = nullptr);
+        // The same result as layout, to the bit, with the children of large boxes laid
+        // out concurrently on `pool`. A block's children only depend on its width, so
+        // each is laid out where it was last time and then placed below its preceding
+        // siblings once their heights are known. Trees below a size threshold are laid
+        // out on the calling thread.
+        void parallel_layout(Rect viewport, TextRunCache& text_cache, Engine::ThreadPool& pool, LayoutStats* stats = nullptr);
+
+    private:
+        struct BoxNode {
+            BoxId parent = NoBox;
+            BoxId first_child = NoBox;
+            BoxId next_sibling = NoBox;
+            BoxType box_type = BoxType::Block;
+            // Set when the box itself must be laid out again, and on its ancestors when
+            // one of their descendants must be.
+            bool needs_layout = true;
+            bool child_needs_layout = false;
+        };
+
+        struct BoxData {
+            const Style::StyledNode* styled_node = nullptr;
+            // What the last layout of the box was based on: a clean box laid out in a
+            // containing block of the same width is only moved, not laid out again.
+            Rect containing_block;
+            // The text node content and run the lines were broken from, and the lines'
+            // range in m_lines, which is reused while they fit.
+            std::string_view text;
+            std::shared_ptr<const TextRun> text_run;
+            uint32_t first_line = 0;
+            uint32_t line_count = 0;
+            uint32_t line_capacity = 0;
+        };
+
+        struct LayoutContext;
+        struct ParallelLayoutJob;
+
+        std::vector<Rect> m_rects;
+        std::vector<BoxNode> m_nodes;
+        std::vector<BoxEdges> m_edges;
+        std::vector<BoxData> m_data;
+        std::vector<TextLine> m_lines;
+        std::vector<TextLine> m_line_buffer;
+        size_t m_detached = 0; // Boxes no longer linked into the tree.
+        // The box count of every live subtree, for splitting parallel layout into
+        // tasks. Recounted after the tree's shape changes.
+        std::vector<uint32_t> m_subtree_sizes;
+        bool m_subtree_sizes_valid = false;
+
+        BoxId build_box(const Style::StyledNode& styled_node, BoxId parent);
+        void build_children(BoxId box, const Style::StyledNode& styled_node);
+        void update_box(BoxId box, const Style::StyledNode& styled_node);
+        bool layout_inputs_changed(BoxId box, const Style::StyledNode& styled_node) const;
+        size_t subtree_size(BoxId box) const;
+        uint32_t count_subtree(BoxId box);
+        void compact();
 
-    struct LayoutBox {
-        Dimensions dimensions;
-        BoxType box_type;
-        const Style::StyledNode* styled_node = nullptr;
-        std::vector<std::unique_ptr<LayoutBox>> children;
+        void run_layout(Rect viewport, TextRunCache& text_cache, ParallelLayoutJob* job, LayoutStats* stats);
+        void layout_box(BoxId box, Rect containing_block, LayoutContext& context);
+        void layout_children(BoxId first, BoxId end, Rect containing_block, bool at_previous_y, LayoutContext& context);
+        void layout_children_parallel(BoxId box, Rect containing_block, bool at_previous_y, LayoutContext& context);
+        void layout_block(BoxId box, Rect containing_block, LayoutContext& context);
+        void layout_flex(BoxId box, Rect containing_block, LayoutContext& context);
+        void layout_text(BoxId box, Rect containing_block, LayoutContext& context);
+        void store_lines(BoxId box, const std::vector<TextLine>& lines, LayoutContext& context);
+        float position_flex_items(BoxId box);
+        Rect content_box_of(BoxId box) const;
+        float stack_child(float children_height, BoxId child) const;
+        void place_box(BoxId box, Rect containing_block);
     };
 
-    std::unique_ptr<LayoutBox> layout_tree(const Style::StyledNode& root, Dimensions viewport);
+    LayoutTree layout_tree(const Style::StyledNode& root, Rect viewport, TextRunCache& text_cache);
 }
 
 #endif // LAYOUT_H
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include "preload_scanner.h"
+#include "text_scanner.h"
+#include <algorithm>
+
+namespace HTML {
+
+    namespace {
+        using Scan::is_space;
+        using Scan::is_alpha;
+        using Scan::is_alnum;
+        using Scan::equals_ignore_case;
+        using Scan::trim;
+
+        // Does the space-separated list contain `token`, as rel="stylesheet" does?
+        bool has_token(std::string_view list, std::string_view token) {
+            size_t pos = 0;
+            while (pos < list.length()) {
+                while (pos < list.length() && is_space(list[pos])) ++pos;
+                size_t start = pos;
+                while (pos < list.length() && !is_space(list[pos])) ++pos;
+                if (equals_ignore_case(list.substr(start, pos - start), token)) return true;
+            }
+            return false;
+        }
+
+        // Position of the '>' closing a tag whose name ends at `pos`, skipping over quoted
+        // attribute values, or npos if the tag is not complete yet.
+        size_t find_tag_end(std::string_view input, size_t pos) {
+            char quote = 0;
+            for (; pos < input.length(); ++pos) {
+                char c = input[pos];
+                if (quote) {
+                    if (c == quote) quote = 0;
+                } else if (c == '"' || c == '\'') {
+                    quote = c;
+                } else if (c == '>') {
+                    return pos;
+                }
+            }
+            return std::string_view::npos;
+        }
+
+        // Start of `end_tag` (lowercase, e.g. "</script") at or after pos, in any case.
+        size_t find_end_tag(std::string_view input, size_t pos, std::string_view end_tag) {
+            while (true) {
+                pos = Scan::find_first_of(input, pos, '<');
+                if (pos + end_tag.length() > input.length()) return std::string_view::npos;
+                if (equals_ignore_case(input.substr(pos, end_tag.length()), end_tag)) return pos;
+                ++pos;
+            }
+        }
+    }
+
+    bool is_stylesheet_link(std::string_view rel) {
+        return has_token(rel, "stylesheet") && !has_token(rel, "alternate");
+    }
+
+    void PreloadScanner::feed(std::string_view chunk) {
+        if (m_buffer.empty()) {
+            // The common case: nothing left over, so scan the chunk where it is.
+            size_t consumed = scan(chunk);
+            m_buffer.assign(chunk.data() + consumed, chunk.size() - consumed);
+            return;
+        }
+        m_buffer.append(chunk.data(), chunk.size());
+        size_t consumed = scan(m_buffer);
+        m_buffer.erase(0, consumed);
+    }
+
+    void PreloadScanner::finish() {
+        // Whatever is left is a tag or comment the document never closed.
+        m_buffer.clear();
+        m_raw_text_end.clear();
+    }
+
+    // Reports the subresources in `input` and returns how much of it was fully scanned.
+    // The rest is an incomplete tag or comment to retry once more input arrives.
+    size_t PreloadScanner::scan(std::string_view input) {
+        size_t pos = 0;
+        while (true) {
+            if (!m_raw_text_end.empty()) {
+                size_t end = find_end_tag(input, pos, m_raw_text_end);
+                if (end == std::string_view::npos) {
+                    // Keep enough bytes to recognize an end tag split across chunks.
+                    size_t keep = m_raw_text_end.length() - 1;
+                    return std::max(pos, input.length() > keep ? input.length() - keep : 0);
+                }
+                pos = end + m_raw_text_end.length();
+                m_raw_text_end.clear();
+            }
+
+            size_t lt = Scan::find_first_of(input, pos, '<');
+            if (lt + 1 >= input.length()) return lt;
+
+            if (input.length() - lt < 4 && std::string_view("<!--").substr(0, input.length() - lt) == input.substr(lt)) {
+                return lt; // Might be the start of a comment.
+            }
+            if (input.compare(lt, 4, "<!--") == 0) {
+                size_t end = input.find("-->", lt + 4);
+                if (end == std::string_view::npos) return lt;
+                pos = end + 3;
+                continue;
+            }
+            if (!is_alpha(input[lt + 1])) {
+                pos = lt + 1; // End tags, doctypes and stray '<' carry no URLs.
+                continue;
+            }
+
+            size_t name_end = lt + 1;
+            while (name_end < input.length() && is_alnum(input[name_end])) ++name_end;
+            size_t gt = find_tag_end(input, name_end);
+            if (gt == std::string_view::npos) return lt;
+
+            scan_start_tag(input.substr(lt + 1, name_end - lt - 1), input.substr(name_end, gt - name_end));
+            pos = gt + 1;
+        }
+    }
+
+    void PreloadScanner::scan_start_tag(std::string_view tag_name, std::string_view attributes) {
+        std::string_view rel, href, src;
+        size_t pos = 0;
+        while (pos < attributes.length()) {
+            char c = attributes[pos];
+            if (is_space(c) || c == '/') {
+                ++pos;
+                continue;
+            }
+            size_t name_start = pos;
+            while (pos < attributes.length() && !is_space(attributes[pos]) && attributes[pos] != '=' && attributes[pos] != '/') ++pos;
+            std::string_view name = attributes.substr(name_start, pos - name_start);
+
+            while (pos < attributes.length() && is_space(attributes[pos])) ++pos;
+            std::string_view value;
+            if (pos < attributes.length() && attributes[pos] == '=') {
+                ++pos;
+                while (pos < attributes.length() && is_space(attributes[pos])) ++pos;
+                if (pos < attributes.length() && (attributes[pos] == '"' || attributes[pos] == '\'')) {
+                    char quote = attributes[pos++];
+                    size_t close = attributes.find(quote, pos);
+                    if (close == std::string_view::npos) close = attributes.length();
+                    value = attributes.substr(pos, close - pos);
+                    pos = std::min(close + 1, attributes.length());
+                } else {
+                    size_t start = pos;
+                    while (pos < attributes.length() && !is_space(attributes[pos])) ++pos;
+                    value = attributes.substr(start, pos - start);
+                }
+            }
+
+            // The first of duplicated attributes wins, as in the parser.
+            if (equals_ignore_case(name, "rel") && rel.empty()) rel = value;
+            else if (equals_ignore_case(name, "href") && href.empty()) href = value;
+            else if (equals_ignore_case(name, "src") && src.empty()) src = value;
+        }
+
+        if (equals_ignore_case(tag_name, "link")) {
+            if (is_stylesheet_link(rel)) report(PreloadType::Stylesheet, href);
+        } else if (equals_ignore_case(tag_name, "script")) {
+            report(PreloadType::Script, src);
+            m_raw_text_end = "</script";
+        } else if (equals_ignore_case(tag_name, "img")) {
+            report(PreloadType::Image, src);
+        } else if (equals_ignore_case(tag_name, "style")) {
+            m_raw_text_end = "</style";
+        } else if (equals_ignore_case(tag_name, "textarea")) {
+            m_raw_text_end = "</textarea";
+        }
+    }
+
+    void PreloadScanner::report(PreloadType type, std::string_view url) {
+        url = trim(url);
+        if (url.empty() || equals_ignore_case(url.substr(0, 5), "data:")) return;
+        if (!m_seen.emplace(url).second) return;
+        if (m_on_request) m_on_request(PreloadRequest{ type, std::string(url) });
+    }
+}
\ No newline at end of file
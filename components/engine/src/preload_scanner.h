@@ -0,0 +1,51 @@
+#ifndef PRELOAD_SCANNER_H
+#define PRELOAD_SCANNER_H
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <unordered_set>
+
+namespace HTML {
+
+    enum class PreloadType { Stylesheet, Script, Image };
+
+    struct PreloadRequest {
+        PreloadType type;
+        std::string url; // As written in the document; not resolved against the page URL.
+    };
+
+    // Whether a <link> with this rel attribute loads a stylesheet the page applies:
+    // "stylesheet" is one of its tokens and "alternate" is not.
+    bool is_stylesheet_link(std::string_view rel);
+
+    // Looks ahead in the raw HTML for subresources the page will need, so they can be
+    // fetched while the document is still arriving and being parsed. It only reads
+    // start tags: no tree, no nodes. It recognizes <link rel=stylesheet href>,
+    // <script src> and <img src>, skipping comments and the contents of <script>,
+    // <style> and <textarea>. Each URL is reported once.
+    class PreloadScanner {
+    public:
+        explicit PreloadScanner(std::function<void(const PreloadRequest&)> on_request)
+            : m_on_request(std::move(on_request)) {}
+
+        // Accepts the document in any split into chunks, like Parser::feed().
+        void feed(std::string_view chunk);
+        void finish();
+
+    private:
+        // Unscanned input. Only a tag or comment cut off by the end of a chunk is kept
+        // between feed() calls.
+        std::string m_buffer;
+        // Set while inside an element whose content is not markup; holds its end tag.
+        std::string m_raw_text_end;
+        std::unordered_set<std::string> m_seen;
+        std::function<void(const PreloadRequest&)> m_on_request;
+
+        size_t scan(std::string_view input);
+        void scan_start_tag(std::string_view tag_name, std::string_view attributes);
+        void report(PreloadType type, std::string_view url);
+    };
+}
+
+#endif // PRELOAD_SCANNER_H
\ No newline at end of file
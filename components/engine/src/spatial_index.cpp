@@ -0,0 +1,111 @@
+#include "spatial_index.h"
+#include <algorithm>
+
+namespace Layout {
+
+    void SpatialIndex::clear() {
+        m_boxes.clear();
+        m_box_bounds.clear();
+        m_nodes.clear();
+        m_level_starts.clear();
+    }
+
+    void SpatialIndex::build(const LayoutTree& tree) {
+        clear();
+        if (tree.empty()) return;
+
+        // Paint order is a preorder walk of the live boxes, which needs no stack
+        // given the parent links.
+        BoxId box = tree.root();
+        while (box != NoBox) {
+            const Rect& rect = tree.rect(box);
+            if (rect.width > 0.0f && rect.height > 0.0f) {
+                m_boxes.push_back(box);
+                m_box_bounds.push_back(Bounds{ rect.x, rect.y, rect.x + rect.width, rect.y + rect.height });
+            }
+            if (tree.first_child(box) != NoBox) {
+                box = tree.first_child(box);
+                continue;
+            }
+            while (box != NoBox && tree.next_sibling(box) == NoBox) box = tree.parent(box);
+            if (box != NoBox) box = tree.next_sibling(box);
+        }
+        if (m_boxes.empty()) return;
+
+        const std::vector<Bounds>* below = &m_box_bounds;
+        size_t below_start = 0, below_size = m_box_bounds.size();
+        do {
+            m_level_starts.push_back(m_nodes.size());
+            for (size_t first = 0; first < below_size; first += Fanout) {
+                size_t last = std::min(first + Fanout, below_size);
+                // Indexed, not referenced: m_nodes may be the level below and grow.
+                Bounds bounds = (*below)[below_start + first];
+                for (size_t i = first + 1; i < last; ++i) {
+                    const Bounds& child = (*below)[below_start + i];
+                    bounds.min_x = std::min(bounds.min_x, child.min_x);
+                    bounds.min_y = std::min(bounds.min_y, child.min_y);
+                    bounds.max_x = std::max(bounds.max_x, child.max_x);
+                    bounds.max_y = std::max(bounds.max_y, child.max_y);
+                }
+                m_nodes.push_back(bounds);
+            }
+            below = &m_nodes;
+            below_start = m_level_starts.back();
+            below_size = m_nodes.size() - below_start;
+        } while (below_size > 1);
+        m_level_starts.push_back(m_nodes.size());
+    }
+
+    void SpatialIndex::query(const Rect& area, std::vector<BoxId>& boxes) const {
+        if (empty()) return;
+        Bounds bounds{ area.x, area.y, area.x + area.width, area.y + area.height };
+        query_node(m_level_starts.size() - 2, 0, bounds, boxes);
+    }
+
+    void SpatialIndex::query_node(size_t level, size_t index, const Bounds& area, std::vector<BoxId>& boxes) const {
+        auto overlaps = [&area](const Bounds& b) {
+            return b.min_x < area.max_x && b.max_x > area.min_x && b.min_y < area.max_y && b.max_y > area.min_y;
+        };
+        if (!overlaps(m_nodes[m_level_starts[level] + index])) return;
+
+        size_t first = index * Fanout;
+        if (level == 0) {
+            size_t last = std::min(first + Fanout, m_boxes.size());
+            for (size_t i = first; i < last; ++i) {
+                if (overlaps(m_box_bounds[i])) boxes.push_back(m_boxes[i]);
+            }
+            return;
+        }
+        size_t last = std::min(first + Fanout, level_size(level - 1));
+        for (size_t i = first; i < last; ++i) {
+            query_node(level - 1, i, area, boxes);
+        }
+    }
+
+    HitTestResult SpatialIndex::hit_test(const LayoutTree& tree, float x, float y) const {
+        HitTestResult result;
+        if (empty()) return result;
+        result.box = find_last(m_level_starts.size() - 2, 0, x, y);
+        if (result.box != NoBox) result.node = tree.styled_node(result.box)->node;
+        return result;
+    }
+
+    // Children are searched last to first, so the first box found is the topmost.
+    BoxId SpatialIndex::find_last(size_t level, size_t index, float x, float y) const {
+        auto contains = [x, y](const Bounds& b) { return x >= b.min_x && x < b.max_x && y >= b.min_y && y < b.max_y; };
+        if (!contains(m_nodes[m_level_starts[level] + index])) return NoBox;
+
+        size_t first = index * Fanout;
+        if (level == 0) {
+            for (size_t i = std::min(first + Fanout, m_boxes.size()); i > first; --i) {
+                if (contains(m_box_bounds[i - 1])) return m_boxes[i - 1];
+            }
+            return NoBox;
+        }
+        for (size_t i = std::min(first + Fanout, level_size(level - 1)); i > first; --i) {
+            BoxId box = find_last(level - 1, i - 1, x, y);
+            if (box != NoBox) return box;
+        }
+        return NoBox;
+    }
+}
\ No newline at end of file
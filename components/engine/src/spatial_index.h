@@ -0,0 +1,54 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include "layout.h"
+#include <vector>
+
+namespace Layout {
+
+    struct HitTestResult {
+        BoxId box = NoBox;
+        const DOM::Node* node = nullptr;
+    };
+
+    // A packed R-tree over the boxes of a laid out tree. The leaves hold boxes in paint
+    // order, Fanout to a node, and each level above groups Fanout consecutive nodes of
+    // the one below, so a query that visits children in order finds boxes in paint
+    // order. Boxes close in document order are mostly close on the page too, which
+    // keeps the nodes tight without sorting. Boxes without area paint nothing and
+    // are left out. The index is a snapshot: rebuild it after a layout that laid out
+    // or moved any box.
+    class SpatialIndex {
+    public:
+        static constexpr size_t Fanout = 16;
+
+        void build(const LayoutTree& tree);
+        void clear();
+        bool empty() const { return m_boxes.empty(); }
+        size_t size() const { return m_boxes.size(); }
+
+        // Appends the boxes that overlap `area` to `boxes`, in paint order.
+        void query(const Rect& area, std::vector<BoxId>& boxes) const;
+        // The box painted last at the point, and its DOM node. Returns no box if there
+        // is none there.
+        HitTestResult hit_test(const LayoutTree& tree, float x, float y) const;
+
+    private:
+        struct Bounds {
+            float min_x, min_y, max_x, max_y;
+        };
+
+        std::vector<BoxId> m_boxes; // In paint order.
+        std::vector<Bounds> m_box_bounds;
+        // Node bounds, level by level from the leaves up to the single root. Node i of a
+        // level covers nodes i * Fanout onwards of the level below, or of m_boxes.
+        std::vector<Bounds> m_nodes;
+        std::vector<size_t> m_level_starts; // Into m_nodes, with the end as the last entry.
+
+        size_t level_size(size_t level) const { return m_level_starts[level + 1] - m_level_starts[level]; }
+        void query_node(size_t level, size_t index, const Bounds& area, std::vector<BoxId>& boxes) const;
+        BoxId find_last(size_t level, size_t index, float x, float y) const;
+    };
+}
+
+#endif // SPATIAL_INDEX_H
\ No newline at end of file
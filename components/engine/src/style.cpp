@@ -1,80 +1,733 @@
 #include "style.h"
+#include "bloom_filter.h"
+#include "thread_pool.h"
 #include <algorithm>
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <unordered_set>
 #include <vector>
-#include <sstream>
 
 namespace Style {
 
-    bool selector_matches(const DOM::ElementData& elem, const CSS::Selector& selector) {
-        if (!selector.tag_name.empty() && selector.tag_name != elem.tag_name) {
+    namespace {
+        using CSS::PropertyId;
+
+        // The winning declaration for each property, indexed by PropertyId.
+        using CascadedValues = std::array<const CSS::Value*, static_cast<size_t>(PropertyId::Count)>;
+
+        enum class NameKind : uint32_t { Tag, Id, Class };
+
+        // The ancestor filter's key for a name; tags, ids and classes of the same name
+        // get different keys. Never 0, which ends RuleCandidate::ancestor_hashes.
+        uint32_t name_hash(NameKind kind, DOM::Atom atom) {
+            uint32_t hash = atom * 3u + static_cast<uint32_t>(kind) + 1u;
+            hash = (hash ^ (hash >> 16)) * 0x85ebca6bu;
+            hash = (hash ^ (hash >> 13)) * 0xc2b2ae35u;
+            hash ^= hash >> 16;
+            return hash ? hash : 1u;
+        }
+
+        template<typename Visit>
+        void for_each_name_hash(const DOM::ElementData& elem, Visit visit) {
+            visit(name_hash(NameKind::Tag, elem.tag));
+            if (elem.id != DOM::Atoms::Null) visit(name_hash(NameKind::Id, elem.id));
+            for (uint16_t i = 0; i < elem.class_count; ++i) {
+                visit(name_hash(NameKind::Class, elem.classes[i]));
+            }
+        }
+
+        // Ids and classes are rarer than tags, so they make the better filter keys.
+        std::array<uint32_t, 4> ancestor_hashes(const CSS::Selector& selector) {
+            std::array<uint32_t, 4> hashes{};
+            size_t count = 0;
+            auto add = [&](NameKind kind, DOM::Atom atom) {
+                if (count < hashes.size() && atom != DOM::Atoms::Null) hashes[count++] = name_hash(kind, atom);
+            };
+            for (const auto& ancestor : selector.ancestors) {
+                add(NameKind::Id, ancestor.compound.id);
+                for (DOM::Atom ancestor_class : ancestor.compound.classes) add(NameKind::Class, ancestor_class);
+            }
+            for (const auto& ancestor : selector.ancestors) add(NameKind::Tag, ancestor.compound.tag);
+            return hashes;
+        }
+
+        const ComputedStyle& initial_style() {
+            static const ComputedStyle initial{ std::make_shared<const InheritedStyle>(), std::make_shared<const BoxStyle>(),
+                                                std::make_shared<const BackgroundStyle>() };
+            return initial;
+        }
+
+        ComputedStyle inherit_from(const ComputedStyle& parent) {
+            const ComputedStyle& initial = initial_style();
+            return ComputedStyle{ parent.inherited, initial.box, initial.background };
+        }
+
+        bool same_color(const CSS::Color& a, const CSS::Color& b) {
+            return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+        }
+
+        class GroupHash {
+        public:
+            void add(uint32_t value) { m_hash = (m_hash ^ value) * 0x9E3779B97F4A7C15ull; }
+            void add(float value) {
+                uint32_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                add(bits);
+            }
+            void add(const CSS::Color& color) { add(uint32_t(color.r) | uint32_t(color.g) << 8 | uint32_t(color.b) << 16 | uint32_t(color.a) << 24); }
+            void add(const ComputedLength& length) {
+                add(length.value);
+                add(static_cast<uint32_t>(length.kind));
+            }
+            size_t value() const { return static_cast<size_t>(m_hash >> 32); }
+
+        private:
+            uint64_t m_hash = 0;
+        };
+
+        size_t hash_group(const InheritedStyle& style) {
+            GroupHash hash;
+            hash.add(style.color);
+            hash.add(style.font_size);
+            hash.add(style.line_height);
+            hash.add(style.line_height_factor);
+            hash.add(uint32_t(style.font_weight));
+            hash.add(style.font_family);
+            return hash.value();
+        }
+        size_t hash_group(const BoxStyle& style) {
+            GroupHash hash;
+            hash.add(uint32_t(style.display) | uint32_t(style.flex_direction) << 8 | uint32_t(style.justify_content) << 16);
+            for (const ComputedLength* length : { &style.width, &style.height, &style.margin_top, &style.margin_right,
+                                                  &style.margin_bottom, &style.margin_left, &style.padding_top,
+                                                  &style.padding_right, &style.padding_bottom, &style.padding_left }) {
+                hash.add(*length);
+            }
+            return hash.value();
+        }
+        size_t hash_group(const BackgroundStyle& style) {
+            GroupHash hash;
+            hash.add(style.background_color);
+            return hash.value();
+        }
+
+        // Groups computed earlier in the pass, by value, so elements that end up with
+        // equal groups share one even when their whole styles differ. Direct mapped: a
+        // new group that lands on an occupied slot replaces the one there.
+        template<typename Group>
+        class GroupCache {
+        public:
+            static constexpr size_t Size = 256;
+
+            std::shared_ptr<const Group> get(const Group& group) {
+                std::shared_ptr<const Group>& slot = m_slots[hash_group(group) & (Size - 1)];
+                if (!slot || !(*slot == group)) slot = std::make_shared<const Group>(group);
+                return slot;
+            }
+
+        private:
+            std::array<std::shared_ptr<const Group>, Size> m_slots;
+        };
+
+        struct GroupCaches {
+            GroupCache<InheritedStyle> inherited;
+            GroupCache<BoxStyle> box;
+            GroupCache<BackgroundStyle> background;
+        };
+
+        // A style being computed. It starts out sharing every group and takes a copy
+        // of a group the first time one of its properties is written. When done, a
+        // copy that ended up equal to what it was copied from is dropped again, and
+        // any other is swapped for an equal group from the cache, allocating only if
+        // there is none.
+        class StyleBuilder {
+        public:
+            explicit StyleBuilder(const ComputedStyle& parent) : m_style(inherit_from(parent)) {}
+
+            const InheritedStyle& current_inherited() const { return m_inherited ? *m_inherited : *m_style.inherited; }
+            InheritedStyle& inherited() { return writable(m_style.inherited, m_inherited); }
+            BoxStyle& box() { return writable(m_style.box, m_box); }
+            BackgroundStyle& background() { return writable(m_style.background, m_background); }
+
+            ComputedStyle finish(GroupCaches& caches) {
+                share_group(m_style.inherited, m_inherited, caches.inherited);
+                share_group(m_style.box, m_box, caches.box);
+                share_group(m_style.background, m_background, caches.background);
+                return std::move(m_style);
+            }
+
+        private:
+            ComputedStyle m_style; // The groups copied from until finish().
+            std::optional<InheritedStyle> m_inherited;
+            std::optional<BoxStyle> m_box;
+            std::optional<BackgroundStyle> m_background;
+
+            template<typename Group>
+            static Group& writable(const std::shared_ptr<const Group>& base, std::optional<Group>& copy) {
+                if (!copy) copy.emplace(*base);
+                return *copy;
+            }
+
+            template<typename Group>
+            static void share_group(std::shared_ptr<const Group>& group, const std::optional<Group>& copy, GroupCache<Group>& cache) {
+                if (copy && !(*copy == *group)) group = cache.get(*copy);
+            }
+        };
+
+        // Font-relative units resolve against `font_size`; ch and ex use the same
+        // advance estimates as layout. Viewport units are not known while styling, so
+        // declarations using them are ignored.
+        bool compute_length(const CSS::Value& value, float font_size, float root_font_size, ComputedLength& length) {
+            if (const float* px = std::get_if<float>(&value)) {
+                length = ComputedLength::px(*px);
+                return true;
+            }
+            if (const CSS::Keyword* keyword = std::get_if<CSS::Keyword>(&value)) {
+                if (*keyword != CSS::Keyword::Auto) return false;
+                length = ComputedLength::auto_length();
+                return true;
+            }
+            const CSS::Length* specified = std::get_if<CSS::Length>(&value);
+            if (!specified) return false;
+            switch (specified->unit) {
+                case CSS::Unit::Em: length = ComputedLength::px(specified->value * font_size); return true;
+                case CSS::Unit::Rem: length = ComputedLength::px(specified->value * root_font_size); return true;
+                case CSS::Unit::Ex: length = ComputedLength::px(specified->value * font_size * 0.5f); return true;
+                case CSS::Unit::Ch: length = ComputedLength::px(specified->value * font_size * 0.6f); return true;
+                case CSS::Unit::Percent: length = ComputedLength::percent(specified->value); return true;
+                default: return false;
+            }
+        }
+
+        // The field behind each of the box-model length properties.
+        ComputedLength BoxStyle::* box_length(PropertyId property) {
+            switch (property) {
+                case PropertyId::Width: return &BoxStyle::width;
+                case PropertyId::Height: return &BoxStyle::height;
+                case PropertyId::MarginTop: return &BoxStyle::margin_top;
+                case PropertyId::MarginRight: return &BoxStyle::margin_right;
+                case PropertyId::MarginBottom: return &BoxStyle::margin_bottom;
+                case PropertyId::MarginLeft: return &BoxStyle::margin_left;
+                case PropertyId::PaddingTop: return &BoxStyle::padding_top;
+                case PropertyId::PaddingRight: return &BoxStyle::padding_right;
+                case PropertyId::PaddingBottom: return &BoxStyle::padding_bottom;
+                case PropertyId::PaddingLeft: return &BoxStyle::padding_left;
+                default: return nullptr;
+            }
+        }
+
+        // For 'inherit' and 'initial': take the computed value from `source`.
+        void copy_property(PropertyId property, const ComputedStyle& source, StyleBuilder& style) {
+            switch (property) {
+                case PropertyId::Display: style.box().display = source.box->display; break;
+                case PropertyId::Color: style.inherited().color = source.inherited->color; break;
+                case PropertyId::BackgroundColor: style.background().background_color = source.background->background_color; break;
+                case PropertyId::FontSize: style.inherited().font_size = source.inherited->font_size; break;
+                case PropertyId::FontFamily: style.inherited().font_family = source.inherited->font_family; break;
+                case PropertyId::FontWeight: style.inherited().font_weight = source.inherited->font_weight; break;
+                case PropertyId::LineHeight:
+                    style.inherited().line_height = source.inherited->line_height;
+                    style.inherited().line_height_factor = source.inherited->line_height_factor;
+                    break;
+                case PropertyId::FlexDirection: style.box().flex_direction = source.box->flex_direction; break;
+                case PropertyId::JustifyContent: style.box().justify_content = source.box->justify_content; break;
+                default:
+                    if (auto length = box_length(property)) style.box().*length = (*source.box).*length;
+                    break;
+            }
+        }
+
+        void apply_value(PropertyId property, const CSS::Value& value, const ComputedStyle& parent,
+                         float root_font_size, StyleBuilder& style) {
+            if (const CSS::Keyword* keyword = std::get_if<CSS::Keyword>(&value)) {
+                if (*keyword == CSS::Keyword::Inherit) return copy_property(property, parent, style);
+                if (*keyword == CSS::Keyword::Initial) return copy_property(property, initial_style(), style);
+            }
+
+            float font_size = style.current_inherited().font_size;
+            switch (property) {
+                case PropertyId::Display:
+                    if (auto display = std::get_if<CSS::Display>(&value)) style.box().display = *display;
+                    break;
+                case PropertyId::FlexDirection:
+                    if (auto direction = std::get_if<CSS::FlexDirection>(&value)) style.box().flex_direction = *direction;
+                    break;
+                case PropertyId::JustifyContent:
+                    if (auto justify = std::get_if<CSS::JustifyContent>(&value)) style.box().justify_content = *justify;
+                    break;
+                case PropertyId::Color:
+                    if (auto color = std::get_if<CSS::Color>(&value)) style.inherited().color = *color;
+                    break;
+                case PropertyId::BackgroundColor:
+                    if (auto color = std::get_if<CSS::Color>(&value)) style.background().background_color = *color;
+                    break;
+                case PropertyId::FontSize: {
+                    // Relative font sizes are relative to the parent's font.
+                    float parent_size = parent.inherited->font_size;
+                    ComputedLength size;
+                    if (compute_length(value, parent_size, root_font_size, size) && !size.is_auto()) {
+                        style.inherited().font_size = size.resolve(parent_size);
+                    }
+                    break;
+                }
+                case PropertyId::LineHeight: {
+                    ComputedLength height;
+                    const CSS::Length* length = std::get_if<CSS::Length>(&value);
+                    if (const CSS::Keyword* keyword = std::get_if<CSS::Keyword>(&value)) {
+                        if (*keyword == CSS::Keyword::Normal) {
+                            style.inherited().line_height = 0.0f;
+                            style.inherited().line_height_factor = 0.0f;
+                        }
+                    } else if (length && length->unit == CSS::Unit::Number) {
+                        style.inherited().line_height = 0.0f;
+                        style.inherited().line_height_factor = std::max(0.0f, length->value);
+                    } else if (compute_length(value, font_size, root_font_size, height)) {
+                        style.inherited().line_height = height.resolve(font_size);
+                        style.inherited().line_height_factor = 0.0f;
+                    }
+                    break;
+                }
+                case PropertyId::FontWeight:
+                    if (const float* weight = std::get_if<float>(&value)) {
+                        style.inherited().font_weight = static_cast<uint16_t>(std::clamp(*weight, 1.0f, 1000.0f));
+                    }
+                    break;
+                case PropertyId::FontFamily:
+                    if (auto family = std::get_if<std::string>(&value)) style.inherited().font_family = DOM::intern(*family);
+                    break;
+                default:
+                    if (auto length = box_length(property)) {
+                        ComputedLength computed;
+                        if (compute_length(value, font_size, root_font_size, computed)) style.box().*length = computed;
+                    }
+                    break;
+            }
+        }
+
+        // Recently computed styles. Selectors only look at tags, ids and classes, so an
+        // id-less element with the same tag and class list as a cached one, under the
+        // same parent style, matches the same rules. Parent styles are only ever shared
+        // between such elements too, so equal parent styles imply equivalent ancestors
+        // for descendant selectors. Text nodes use a Null tag.
+        //
+        // The cache is set associative: the signature picks a set of a few entries,
+        // kept in LRU order, so a lookup compares at most Ways candidates.
+        class StyleSharingCache {
+        public:
+            static constexpr size_t Sets = 64;
+            static constexpr size_t Ways = 4;
+
+            const std::shared_ptr<const ComputedStyle>* find(const ComputedStyle* parent, DOM::Atom tag, const DOM::Atom* classes,
+                                                             uint16_t class_count, StyleStats& stats) {
+                Set& set = m_sets[set_index(parent, tag, classes, class_count)];
+                for (size_t i = 0; i < Ways && set[i].style; ++i) {
+                    const Entry& entry = set[i];
+                    if (entry.parent != parent) {
+                        ++stats.sharing_rejected_parent;
+                    } else if (entry.tag != tag) {
+                        ++stats.sharing_rejected_tag;
+                    } else if (entry.class_count != class_count || !std::equal(classes, classes + class_count, entry.classes)) {
+                        ++stats.sharing_rejected_classes;
+                    } else {
+                        std::rotate(set.begin(), set.begin() + i, set.begin() + i + 1);
+                        return set[0].style;
+                    }
+                }
+                return nullptr;
+            }
+
+            // `classes` and `style` must outlive the cache: they point into the
+            // document's arena and the styled node being built. Holding no reference
+            // keeps entries trivially copyable and eviction free.
+            void insert(const ComputedStyle* parent, DOM::Atom tag, const DOM::Atom* classes, uint16_t class_count,
+                        const std::shared_ptr<const ComputedStyle>* style) {
+                Set& set = m_sets[set_index(parent, tag, classes, class_count)];
+                std::rotate(set.begin(), set.end() - 1, set.end());
+                set[0] = Entry{ parent, tag, class_count, classes, style };
+            }
+
+        private:
+            struct Entry {
+                const ComputedStyle* parent = nullptr;
+                DOM::Atom tag = DOM::Atoms::Null;
+                uint16_t class_count = 0;
+                const DOM::Atom* classes = nullptr;
+                const std::shared_ptr<const ComputedStyle>* style = nullptr;
+            };
+            using Set = std::array<Entry, Ways>;
+
+            std::array<Set, Sets> m_sets;
+
+            static size_t set_index(const ComputedStyle* parent, DOM::Atom tag, const DOM::Atom* classes, uint16_t class_count) {
+                uint64_t hash = reinterpret_cast<uintptr_t>(parent) / alignof(ComputedStyle);
+                hash = (hash ^ tag) * 0x9E3779B97F4A7C15ull;
+                for (uint16_t i = 0; i < class_count; ++i) hash = (hash ^ classes[i]) * 0x9E3779B97F4A7C15ull;
+                return static_cast<size_t>(hash >> 58) & (Sets - 1);
+            }
+        };
+
+        using Engine::ParallelThreshold;
+        using Engine::TaskGrain;
+
+        // State shared by the tasks of one parallel style pass.
+        struct ParallelStyleJob {
+            ParallelStyleJob(const RuleIndex& rules, Engine::ThreadPool& pool) : rules(rules), tasks(pool) {}
+
+            const RuleIndex& rules;
+            // The node count of every subtree, indexed by the root's preorder position.
+            std::vector<uint32_t> subtree_sizes;
+            Engine::TaskGroup tasks;
+            std::mutex stats_mutex;
+            StyleStats stats;
+        };
+
+        // Everything one thread needs to style a subtree.
+        struct StyleContext {
+            StyleContext(const RuleIndex& rules, StyleStats& stats, ParallelStyleJob* job = nullptr)
+                : rules(rules), stats(stats), job(job) {}
+
+            const RuleIndex& rules;
+            StyleStats& stats;
+            ParallelStyleJob* job;
+            std::vector<RuleCandidate> candidates;
+            CascadedValues values;
+            // Names of the elements above the one being styled.
+            CountingBloomFilter<> ancestor_filter;
+            StyleSharingCache sharing_cache;
+            GroupCaches group_caches;
+        };
+
+        void add_ancestors_to_filter(const DOM::Node* node, StyleContext& context) {
+            for (const DOM::Node* ancestor = node->parent; ancestor; ancestor = ancestor->parent) {
+                for_each_name_hash(ancestor->element_data, [&](uint32_t hash) { context.ancestor_filter.add(hash); });
+            }
+        }
+
+        bool rejected_by_filter(const RuleCandidate& candidate, const CountingBloomFilter<>& filter) {
+            for (uint32_t hash : candidate.ancestor_hashes) {
+                if (hash == 0) return false;
+                if (!filter.may_contain(hash)) return true;
+            }
             return false;
         }
-        if (!selector.id.empty()) {
-            auto it = elem.attributes.find("id");
-            if (it == elem.attributes.end() || it->second != selector.id) {
-                return false;
+
+        void cascade(const DOM::Node* element, StyleContext& context) {
+            CascadedValues& values = context.values;
+            values.fill(nullptr);
+            context.rules.collect_candidates(element->element_data, context.candidates);
+            const CSS::Rule* applied = nullptr;
+            for (const RuleCandidate& candidate : context.candidates) {
+                // Later declarations win, so each rule applies once however many of
+                // its selectors match.
+                if (candidate.rule == applied) continue;
+                ++context.stats.selectors_tested;
+                if (!candidate.selector->ancestors.empty()) {
+                    ++context.stats.complex_selectors_tested;
+                    if (rejected_by_filter(candidate, context.ancestor_filter)) {
+                        ++context.stats.rejected_by_filter;
+                        continue;
+                    }
+                }
+                if (!selector_matches(element, *candidate.selector)) continue;
+                for (const auto& decl : candidate.rule->declarations) {
+                    values[static_cast<size_t>(decl.property)] = &decl.value;
+                }
+                applied = candidate.rule;
+            }
+        }
+
+        ComputedStyle compute_style(const CascadedValues& values, const ComputedStyle& parent, float root_font_size,
+                                    GroupCaches& group_caches) {
+            StyleBuilder style(parent);
+            // font-size first, since the other lengths are relative to it.
+            if (const CSS::Value* font_size = values[static_cast<size_t>(PropertyId::FontSize)]) {
+                apply_value(PropertyId::FontSize, *font_size, parent, root_font_size, style);
             }
+            for (size_t i = 1; i < values.size(); ++i) {
+                PropertyId property = static_cast<PropertyId>(i);
+                if (values[i] && property != PropertyId::FontSize) {
+                    apply_value(property, *values[i], parent, root_font_size, style);
+                }
+            }
+            return style.finish(group_caches);
         }
-        if (!selector.classes.empty()) {
-            auto it = elem.attributes.find("class");
-            if (it == elem.attributes.end()) return false;
-            
-            std::vector<std::string> elem_classes;
-            std::string current_class;
-            std::istringstream iss(it->second);
-            while (iss >> current_class) {
-                elem_classes.push_back(current_class);
+
+        std::shared_ptr<const ComputedStyle> compute_node_style(const DOM::Node* node, StyleContext& context,
+                                                                const ComputedStyle& parent, float root_font_size) {
+            if (node->type != DOM::NodeType::Element) {
+                return std::make_shared<const ComputedStyle>(inherit_from(parent));
             }
+            cascade(node, context);
+            float rem = root_font_size > 0.0f ? root_font_size : initial_style().inherited->font_size;
+            return std::make_shared<const ComputedStyle>(compute_style(context.values, parent, rem, context.group_caches));
+        }
+
+        void style_children_parallel(const DOM::Node* node, StyledNode& styled_node, StyleContext& context,
+                                     float root_font_size, size_t index);
 
-            for (const auto& sel_class : selector.classes) {
-                if (std::find(elem_classes.begin(), elem_classes.end(), sel_class) == elem_classes.end()) {
-                    return false;
+        // `root_font_size` is 0 until the root element has been styled; rem units on
+        // the root element itself are relative to the initial font size. `index` is
+        // the node's preorder position, used by the parallel pass.
+        std::unique_ptr<StyledNode> style_node(const DOM::Node* node, StyleContext& context,
+                                               const ComputedStyle& parent, float root_font_size, size_t index) {
+            auto styled_node = std::make_unique<StyledNode>();
+            styled_node->node = node;
+
+            const DOM::ElementData* elem = node->type == DOM::NodeType::Element ? &node->element_data : nullptr;
+            DOM::Atom tag = elem ? elem->tag : DOM::Atoms::Null;
+            const DOM::Atom* classes = elem ? elem->classes : nullptr;
+            uint16_t class_count = elem ? elem->class_count : 0;
+            if (elem && elem->id != DOM::Atoms::Null) {
+                ++context.stats.sharing_ineligible_id;
+                styled_node->style = compute_node_style(node, context, parent, root_font_size);
+            } else if (auto shared = context.sharing_cache.find(&parent, tag, classes, class_count, context.stats)) {
+                ++context.stats.sharing_hits;
+                styled_node->style = *shared;
+            } else {
+                ++context.stats.sharing_misses;
+                styled_node->style = compute_node_style(node, context, parent, root_font_size);
+                context.sharing_cache.insert(&parent, tag, classes, class_count, &styled_node->style);
+            }
+            if (root_font_size <= 0.0f && elem) root_font_size = styled_node->style->inherited->font_size;
+
+            if (!node->first_child) return styled_node;
+            if (elem) for_each_name_hash(*elem, [&](uint32_t hash) { context.ancestor_filter.add(hash); });
+            if (context.job && context.job->subtree_sizes[index] > TaskGrain) {
+                style_children_parallel(node, *styled_node, context, root_font_size, index);
+            } else {
+                size_t child_index = index + 1;
+                for (const DOM::Node* child : node->children()) {
+                    styled_node->children.push_back(style_node(child, context, *styled_node->style, root_font_size, child_index));
+                    if (context.job) child_index += context.job->subtree_sizes[child_index];
                 }
             }
+            if (elem) for_each_name_hash(*elem, [&](uint32_t hash) { context.ancestor_filter.remove(hash); });
+            return styled_node;
+        }
+
+        // Styles `count` siblings from `first` into consecutive slots.
+        void style_siblings(const DOM::Node* first, size_t count, StyleContext& context, const ComputedStyle& parent,
+                            float root_font_size, size_t index, std::unique_ptr<StyledNode>* slots) {
+            const DOM::Node* node = first;
+            for (size_t i = 0; i < count; ++i, node = node->next_sibling) {
+                slots[i] = style_node(node, context, parent, root_font_size, index);
+                index += context.job->subtree_sizes[index];
+            }
+        }
+
+        // A task gets a context of its own, with the ancestor filter rebuilt for where
+        // its subtrees sit in the document.
+        void spawn_siblings_task(ParallelStyleJob& job, const DOM::Node* first, size_t count, const ComputedStyle* parent,
+                                 float root_font_size, size_t index, std::unique_ptr<StyledNode>* slots) {
+            job.tasks.run([&job, first, count, parent, root_font_size, index, slots] {
+                StyleStats stats;
+                auto context = std::make_unique<StyleContext>(job.rules, stats, &job);
+                add_ancestors_to_filter(first, *context);
+                style_siblings(first, count, *context, *parent, root_font_size, index, slots);
+                std::lock_guard<std::mutex> lock(job.stats_mutex);
+                job.stats += stats;
+            });
+        }
+
+        // Each run of consecutive children adding up to TaskGrain nodes is handed to
+        // the pool; the remainder is styled on this thread. The children vector is
+        // sized up front so every task writes only its own slots.
+        void style_children_parallel(const DOM::Node* node, StyledNode& styled_node, StyleContext& context,
+                                     float root_font_size, size_t index) {
+            ParallelStyleJob& job = *context.job;
+            size_t child_count = 0;
+            for (const DOM::Node* child = node->first_child; child; child = child->next_sibling) ++child_count;
+            styled_node.children.resize(child_count);
+
+            const ComputedStyle* parent = styled_node.style.get();
+            const DOM::Node* run_first = nullptr;
+            size_t run_slot = 0, run_index = 0, run_length = 0, run_nodes = 0;
+            size_t slot = 0, child_index = index + 1;
+            for (const DOM::Node* child = node->first_child; child; child = child->next_sibling, ++slot) {
+                if (!run_first) {
+                    run_first = child;
+                    run_slot = slot;
+                    run_index = child_index;
+                    run_length = run_nodes = 0;
+                }
+                size_t size = job.subtree_sizes[child_index];
+                child_index += size;
+                ++run_length;
+                run_nodes += size;
+                if (run_nodes >= TaskGrain) {
+                    spawn_siblings_task(job, run_first, run_length, parent, root_font_size, run_index, &styled_node.children[run_slot]);
+                    run_first = nullptr;
+                }
+            }
+            if (run_first) {
+                style_siblings(run_first, run_length, context, *parent, root_font_size, run_index, &styled_node.children[run_slot]);
+            }
+        }
+
+        // Records every subtree's size in preorder and returns the size of this one.
+        size_t count_subtree(const DOM::Node* node, std::vector<uint32_t>& sizes) {
+            size_t index = sizes.size();
+            sizes.push_back(0);
+            size_t size = 1;
+            for (const DOM::Node* child : node->children()) {
+                size += count_subtree(child, sizes);
+            }
+            sizes[index] = static_cast<uint32_t>(size);
+            return size;
         }
-        return true;
     }
 
-    PropertyMap specified_values(const DOM::ElementData& elem, const CSS::Stylesheet& stylesheet) {
-        PropertyMap values;
-        for (const auto& rule : stylesheet.rules) {
-            for (const auto& selector : rule.selectors) {
-                if (selector_matches(elem, selector)) {
-                    for (const auto& decl : rule.declarations) {
-                        values[decl.property] = decl.value;
+    RuleIndex::RuleIndex(const CSS::Stylesheet& stylesheet) : RuleIndex(std::vector<const CSS::Stylesheet*>{ &stylesheet }) {}
+
+    RuleIndex::RuleIndex(const std::vector<const CSS::Stylesheet*>& stylesheets) {
+        uint32_t order = 0;
+        for (const CSS::Stylesheet* stylesheet : stylesheets) {
+            for (const auto& rule : stylesheet->rules) {
+                for (const auto& selector : rule.selectors) {
+                    RuleCandidate candidate{ order++, &selector, &rule, ancestor_hashes(selector) };
+                    if (selector.id != DOM::Atoms::Null) {
+                        m_id_rules[selector.id].push_back(candidate);
+                    } else if (!selector.classes.empty()) {
+                        m_class_rules[selector.classes.front()].push_back(candidate);
+                    } else if (selector.tag != DOM::Atoms::Null) {
+                        m_tag_rules[selector.tag].push_back(candidate);
+                    } else {
+                        m_universal_rules.push_back(candidate);
                     }
                 }
             }
         }
-        return values;
     }
 
-    // --- THIS FUNCTION IS NOW CORRECT ---
-    std::unique_ptr<StyledNode> style_tree(const DOM::Node* root, const CSS::Stylesheet& stylesheet) {
-        auto styled_node = std::make_unique<StyledNode>();
-        styled_node->node = root;
+    void RuleIndex::collect_candidates(const DOM::ElementData& elem, std::vector<RuleCandidate>& candidates) const {
+        candidates.clear();
+        auto add_bucket = [&](const std::unordered_map<DOM::Atom, Bucket>& buckets, DOM::Atom name) {
+            if (buckets.empty() || name == DOM::Atoms::Null) return;
+            auto it = buckets.find(name);
+            if (it != buckets.end()) candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+        };
+        add_bucket(m_id_rules, elem.id);
+        for (uint16_t i = 0; i < elem.class_count; ++i) {
+            add_bucket(m_class_rules, elem.classes[i]);
+        }
+        add_bucket(m_tag_rules, elem.tag);
+        candidates.insert(candidates.end(), m_universal_rules.begin(), m_universal_rules.end());
+
+        // Each bucket is already in source order; merging them restores cascade order.
+        // A selector lives in one bucket, but an element can list a class twice.
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const RuleCandidate& a, const RuleCandidate& b) { return a.order < b.order; });
+        candidates.erase(std::unique(candidates.begin(), candidates.end(),
+                                     [](const RuleCandidate& a, const RuleCandidate& b) { return a.order == b.order; }),
+                         candidates.end());
+    }
+
+    bool operator==(const InheritedStyle& a, const InheritedStyle& b) {
+        return same_color(a.color, b.color) && a.font_size == b.font_size && a.line_height == b.line_height &&
+               a.line_height_factor == b.line_height_factor && a.font_weight == b.font_weight &&
+               a.font_family == b.font_family;
+    }
+
+    bool operator==(const BoxStyle& a, const BoxStyle& b) {
+        return a.display == b.display && a.flex_direction == b.flex_direction && a.justify_content == b.justify_content &&
+               a.width == b.width && a.height == b.height && a.margin_top == b.margin_top &&
+               a.margin_right == b.margin_right && a.margin_bottom == b.margin_bottom && a.margin_left == b.margin_left &&
+               a.padding_top == b.padding_top && a.padding_right == b.padding_right &&
+               a.padding_bottom == b.padding_bottom && a.padding_left == b.padding_left;
+    }
 
-        if (root->type == DOM::NodeType::Element) {
-            styled_node->specified_values = specified_values(root->element_data, stylesheet);
+    bool operator==(const BackgroundStyle& a, const BackgroundStyle& b) {
+        return same_color(a.background_color, b.background_color);
+    }
+
+    StyleMemory measure_style_memory(const StyledNode& root) {
+        // make_shared puts the control block next to the object: two counts and a vtable.
+        constexpr size_t ControlBlock = 2 * sizeof(long) + sizeof(void*);
+        StyleMemory memory;
+        std::unordered_set<const void*> seen;
+        auto count = [&](const void* object, size_t size, size_t& counter) {
+            if (!seen.insert(object).second) return;
+            ++counter;
+            memory.bytes += size + ControlBlock;
+        };
+        std::vector<const StyledNode*> stack{ &root };
+        while (!stack.empty()) {
+            const StyledNode* node = stack.back();
+            stack.pop_back();
+            ++memory.nodes;
+            const ComputedStyle& style = *node->style;
+            count(&style, sizeof(ComputedStyle), memory.styles);
+            count(style.inherited.get(), sizeof(InheritedStyle), memory.inherited_groups);
+            count(style.box.get(), sizeof(BoxStyle), memory.box_groups);
+            count(style.background.get(), sizeof(BackgroundStyle), memory.background_groups);
+            for (const auto& child : node->children) stack.push_back(child.get());
         }
+        return memory;
+    }
 
-        for (const auto& child : root->children) {
-            auto styled_child = style_tree(child.get(), stylesheet);
+    bool compound_matches(const DOM::ElementData& elem, const CSS::CompoundSelector& compound) {
+        if (compound.tag != DOM::Atoms::Null && compound.tag != elem.tag) {
+            return false;
+        }
+        if (compound.id != DOM::Atoms::Null && compound.id != elem.id) {
+            return false;
+        }
+        for (DOM::Atom sel_class : compound.classes) {
+            if (!elem.has_class(sel_class)) {
+                return false;
+            }
+        }
+        return true;
+    }
 
-            // --- THE INHERITANCE FIX ---
-            // If the child is a text node, it needs to inherit color from its parent.
-            if (styled_child->node->type == DOM::NodeType::Text) {
-                if (styled_child->specified_values.find("color") == styled_child->specified_values.end()) {
-                    auto parent_color = styled_node->specified_values.find("color");
-                    if (parent_color != styled_node->specified_values.end()) {
-                        styled_child->specified_values["color"] = parent_color->second;
-                    }
+    namespace {
+        // Matches selector.ancestors[index...] against the ancestors of `element`,
+        // right to left. A descendant combinator backtracks to try every ancestor.
+        bool ancestors_match(const DOM::Node* element, const CSS::Selector& selector, size_t index) {
+            if (index == selector.ancestors.size()) return true;
+            const CSS::Selector::Ancestor& ancestor = selector.ancestors[index];
+            for (const DOM::Node* node = element->parent; node; node = node->parent) {
+                if (node->type == DOM::NodeType::Element && compound_matches(node->element_data, ancestor.compound) &&
+                    ancestors_match(node, selector, index + 1)) {
+                    return true;
                 }
+                if (ancestor.combinator == CSS::Combinator::Child) return false;
             }
-            
-            styled_node->children.push_back(std::move(styled_child));
+            return false;
         }
+    }
 
-        return styled_node;
+    bool selector_matches(const DOM::Node* element, const CSS::Selector& selector) {
+        return compound_matches(element->element_data, selector) && ancestors_match(element, selector, 0);
+    }
+
+    std::unique_ptr<StyledNode> style_tree(const DOM::Node* root, const RuleIndex& rules, StyleStats* stats) {
+        StyleStats local_stats;
+        StyleContext context(rules, stats ? *stats : local_stats);
+        // Styling a subtree: its ancestors still count for descendant selectors.
+        add_ancestors_to_filter(root, context);
+        return style_node(root, context, initial_style(), 0.0f, 0);
+    }
+
+    std::unique_ptr<StyledNode> parallel_style_tree(const DOM::Node* root, const RuleIndex& rules,
+                                                    Engine::ThreadPool& pool, StyleStats* stats) {
+        ParallelStyleJob job(rules, pool);
+        if (count_subtree(root, job.subtree_sizes) < ParallelThreshold) {
+            return style_tree(root, rules, stats);
+        }
+
+        StyleStats local_stats;
+        StyleStats& root_stats = stats ? *stats : local_stats;
+        std::unique_ptr<StyledNode> styled_root;
+        {
+            auto context = std::make_unique<StyleContext>(rules, root_stats, &job);
+            add_ancestors_to_filter(root, *context);
+            styled_root = style_node(root, *context, initial_style(), 0.0f, 0);
+        }
+        job.tasks.wait();
+        root_stats += job.stats;
+        return styled_root;
     }
 }
\ No newline at end of file
@@ -3,23 +3,175 @@
 
 #include "dom.h"
 #include "css.h"
-#include <map>
-#include <string>
+#include <array>
+#include <unordered_map>
 #include <vector>
 #include <memory>
 
+namespace Engine {
+    class ThreadPool;
+}
+
 namespace Style {
 
-    // --- THIS IS THE CORRECTED LINE ---
-    using PropertyMap = std::map<std::string, CSS::Value>;
+    // A length after the cascade. Font-relative units are already resolved to px;
+    // percentages depend on the containing block and are resolved by layout.
+    struct ComputedLength {
+        enum class Kind : uint8_t { Px, Percent, Auto };
+
+        float value = 0.0f;
+        Kind kind = Kind::Px;
+
+        static ComputedLength px(float value) { return ComputedLength{ value, Kind::Px }; }
+        static ComputedLength percent(float value) { return ComputedLength{ value, Kind::Percent }; }
+        static ComputedLength auto_length() { return ComputedLength{ 0.0f, Kind::Auto }; }
+
+        bool is_auto() const { return kind == Kind::Auto; }
+        bool operator==(const ComputedLength& other) const { return value == other.value && kind == other.kind; }
+        float resolve(float reference, float auto_value = 0.0f) const {
+            if (kind == Kind::Px) return value;
+            if (kind == Kind::Percent) return value * reference / 100.0f;
+            return auto_value;
+        }
+    };
+
+    // Computed values come in immutable, reference-counted groups. A child points at
+    // its parent's inherited group and at the shared initial reset groups, and only
+    // gets a group of its own for one it actually changes.
+
+    // Inherited properties.
+    struct InheritedStyle {
+        CSS::Color color;
+        float font_size = 16.0f;
+        float line_height = 0.0f; // px; 0 is "normal".
+        float line_height_factor = 0.0f; // Of font_size, for a unitless line-height; 0 if none.
+        uint16_t font_weight = 400;
+        DOM::Atom font_family = DOM::Atoms::Null;
+
+        float used_line_height() const {
+            if (line_height_factor > 0.0f) return line_height_factor * font_size;
+            return line_height > 0.0f ? line_height : font_size * 1.2f;
+        }
+    };
+
+    // Properties that start from their initial value on every element: the box and
+    // how its children are laid out...
+    struct BoxStyle {
+        CSS::Display display = CSS::Display::Inline;
+        CSS::FlexDirection flex_direction = CSS::FlexDirection::Row;
+        CSS::JustifyContent justify_content = CSS::JustifyContent::FlexStart;
+        ComputedLength width = ComputedLength::auto_length();
+        ComputedLength height = ComputedLength::auto_length();
+        ComputedLength margin_top, margin_right, margin_bottom, margin_left;
+        ComputedLength padding_top, padding_right, padding_bottom, padding_left;
+    };
+
+    // ...and what is painted behind it.
+    struct BackgroundStyle {
+        CSS::Color background_color{ 0, 0, 0, 0 };
+    };
+
+    struct ComputedStyle {
+        std::shared_ptr<const InheritedStyle> inherited;
+        std::shared_ptr<const BoxStyle> box;
+        std::shared_ptr<const BackgroundStyle> background;
+    };
 
+    // Groups are equal when every value is, whether or not they are the same object.
+    bool operator==(const InheritedStyle& a, const InheritedStyle& b);
+    bool operator==(const BoxStyle& a, const BoxStyle& b);
+    bool operator==(const BackgroundStyle& a, const BackgroundStyle& b);
+
+    // Elements that match the same rules under the same parent style share one
+    // ComputedStyle, so it is reference counted and immutable once computed.
     struct StyledNode {
         const DOM::Node* node;
-        PropertyMap specified_values;
+        std::shared_ptr<const ComputedStyle> style;
         std::vector<std::unique_ptr<StyledNode>> children;
     };
 
-    std::unique_ptr<StyledNode> style_tree(const DOM::Node* root, const CSS::Stylesheet& stylesheet);
+    // A selector that may match an element, and the rule it belongs to. `order` is the
+    // selector's position in the stylesheet, which is also cascade order.
+    // `ancestor_hashes` are Bloom filter keys for names the element's ancestors must
+    // have, ending at the first 0.
+    struct RuleCandidate {
+        uint32_t order;
+        const CSS::Selector* selector;
+        const CSS::Rule* rule;
+        std::array<uint32_t, 4> ancestor_hashes;
+    };
+
+    // A stylesheet's selectors bucketed by their most selective part: the id, else
+    // the first class, else the tag, with a universal bucket for the rest. An element
+    // then only tests the selectors from its own id, class and tag buckets. The
+    // stylesheets must outlive the index.
+    class RuleIndex {
+    public:
+        explicit RuleIndex(const CSS::Stylesheet& stylesheet);
+        // Several sheets, in cascade order: later sheets win ties.
+        explicit RuleIndex(const std::vector<const CSS::Stylesheet*>& stylesheets);
+
+        // Fills `candidates` with the selectors that may match `elem`, in source order.
+        void collect_candidates(const DOM::ElementData& elem, std::vector<RuleCandidate>& candidates) const;
+
+    private:
+        using Bucket = std::vector<RuleCandidate>;
+
+        std::unordered_map<DOM::Atom, Bucket> m_id_rules;
+        std::unordered_map<DOM::Atom, Bucket> m_class_rules;
+        std::unordered_map<DOM::Atom, Bucket> m_tag_rules;
+        Bucket m_universal_rules;
+    };
+
+    struct StyleStats {
+        size_t selectors_tested = 0;
+        size_t complex_selectors_tested = 0; // Those with combinators.
+        size_t rejected_by_filter = 0;       // Complex ones ruled out by the ancestor filter.
+
+        // Style sharing: nodes that reused a cached style, and those that were styled
+        // from scratch. Elements with an id never share. The rest count every cached
+        // style they looked at and turned down, by the first difference found.
+        size_t sharing_hits = 0;
+        size_t sharing_misses = 0;
+        size_t sharing_ineligible_id = 0;
+        size_t sharing_rejected_parent = 0;
+        size_t sharing_rejected_tag = 0;
+        size_t sharing_rejected_classes = 0;
+
+        StyleStats& operator+=(const StyleStats& other) {
+            selectors_tested += other.selectors_tested;
+            complex_selectors_tested += other.complex_selectors_tested;
+            rejected_by_filter += other.rejected_by_filter;
+            sharing_hits += other.sharing_hits;
+            sharing_misses += other.sharing_misses;
+            sharing_ineligible_id += other.sharing_ineligible_id;
+            sharing_rejected_parent += other.sharing_rejected_parent;
+            sharing_rejected_tag += other.sharing_rejected_tag;
+            sharing_rejected_classes += other.sharing_rejected_classes;
+            return *this;
+        }
+    };
+
+    // What a styled tree's computed values take up: each distinct style and group is
+    // counted once, however many nodes share it.
+    struct StyleMemory {
+        size_t nodes = 0;
+        size_t styles = 0;
+        size_t inherited_groups = 0;
+        size_t box_groups = 0;
+        size_t background_groups = 0;
+        size_t bytes = 0;
+    };
+
+    StyleMemory measure_style_memory(const StyledNode& root);
+
+    bool compound_matches(const DOM::ElementData& elem, const CSS::CompoundSelector& compound);
+    bool selector_matches(const DOM::Node* element, const CSS::Selector& selector);
+    std::unique_ptr<StyledNode> style_tree(const DOM::Node* root, const RuleIndex& rules, StyleStats* stats = nullptr);
+    // The same result as style_tree, with large subtrees styled concurrently on `pool`.
+    // Documents below a size threshold are styled on the calling thread.
+    std::unique_ptr<StyledNode> parallel_style_tree(const DOM::Node* root, const RuleIndex& rules,
+                                                    Engine::ThreadPool& pool, StyleStats* stats = nullptr);
 }
 
 #endif // STYLE_H
\ No newline at end of file
@@ -0,0 +1,549 @@
+#include "stylesheet_cache.h"
+#include "css_parser.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace CSS {
+
+    namespace {
+        constexpr std::string_view UserAgentSource = R"(
+            div, h1, p, h2, h3, dt, dd, li, a { display: block; }
+            h1 { font-size: 32px; color: #00ff00; margin-top: 10px; margin-bottom: 10px; }
+            h2 { font-size: 28px; color: #00dd00; margin-top: 8px; margin-bottom: 8px; }
+            h3 { font-size: 24px; color: #00bb00; margin-top: 6px; margin-bottom: 6px; }
+            p, li, dt, dd { font-size: 16px; color: #cccccc; margin-bottom: 8px; }
+            a { color: #8888ff; }
+            #main { background-color: #333333; padding: 20px; }
+            #msg { color: #ff8888; }
+            script { display: none; }
+            #header { display: flex; justify-content: space-between; background-color: #444444; height: 60px; padding-left: 20px; padding-right: 20px; }
+            #logo { display: block; color: #00ff00; font-size: 32px; height: 40px; width: 300px; }
+            #nav { display: flex; justify-content: flex-end; width: 400px; }
+            #nav p { display: block; color: #cccccc; font-size: 20px; margin-left: 15px; height: 30px; width: 80px; }
+        )";
+
+        // Bump whenever a record layout or a value encoding changes.
+        constexpr uint32_t FormatVersion = 2;
+        constexpr char Magic[4] = { 'C', 'S', 'S', 'C' };
+        constexpr uint32_t NoName = 0xFFFFFFFF;
+
+        // Every record is plain data in host byte order; files are a cache for this
+        // machine, not an interchange format.
+        struct Header {
+            char magic[4];
+            uint32_t version;
+            uint64_t hash;
+            // The sizes of the tables the file's ids index into.
+            uint8_t property_count, keyword_count, value_types, reserved;
+            uint32_t string_count, rule_count, selector_count, compound_count;
+            uint32_t class_count, declaration_count, string_bytes;
+        };
+        struct StringRecord { uint32_t offset, length; };
+        struct RuleRecord { uint32_t first_selector, selector_count, first_declaration, declaration_count; };
+        // The first compound is the subject; the rest are its ancestors, right to left.
+        struct SelectorRecord { uint32_t first_compound, compound_count; };
+        struct CompoundRecord {
+            uint32_t tag, id; // String indices, or NoName.
+            uint32_t first_class, class_count;
+            uint8_t combinator, padding[3];
+        };
+        // `type` is the Value alternative. Strings keep their string index in `payload`,
+        // floats and colors their bits; enums are in `small`, as is a length's unit.
+        struct DeclarationRecord {
+            uint8_t property, type, small, padding;
+            uint32_t payload;
+        };
+
+        static_assert(std::is_same_v<std::variant_alternative_t<0, Value>, std::string> &&
+                      std::is_same_v<std::variant_alternative_t<1, Value>, float> &&
+                      std::is_same_v<std::variant_alternative_t<2, Value>, Color> &&
+                      std::is_same_v<std::variant_alternative_t<3, Value>, Display> &&
+                      std::is_same_v<std::variant_alternative_t<4, Value>, FlexDirection> &&
+                      std::is_same_v<std::variant_alternative_t<5, Value>, JustifyContent> &&
+                      std::is_same_v<std::variant_alternative_t<6, Value>, Length> &&
+                      std::is_same_v<std::variant_alternative_t<7, Value>, Keyword>,
+                      "Declaration types are Value alternative indices; bump FormatVersion when they change");
+        static_assert(std::is_trivially_copyable_v<Header> && sizeof(Header) == 48);
+        static_assert(sizeof(DeclarationRecord) == 8 && sizeof(CompoundRecord) == 20);
+
+        template<typename T>
+        void append_records(std::string& out, const std::vector<T>& records) {
+            out.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(T));
+        }
+
+        class Writer {
+        public:
+            uint32_t add_string(std::string_view text) {
+                auto [it, inserted] = m_string_index.try_emplace(std::string(text), static_cast<uint32_t>(strings.size()));
+                if (inserted) {
+                    strings.push_back(StringRecord{ static_cast<uint32_t>(string_bytes.size()), static_cast<uint32_t>(text.size()) });
+                    string_bytes.append(text);
+                }
+                return it->second;
+            }
+
+            uint32_t add_atom(DOM::Atom atom) {
+                return atom == DOM::Atoms::Null ? NoName : add_string(DOM::atom_name(atom));
+            }
+
+            void add_compound(const CompoundSelector& compound, Combinator combinator) {
+                CompoundRecord record{};
+                record.tag = add_atom(compound.tag);
+                record.id = add_atom(compound.id);
+                record.first_class = static_cast<uint32_t>(classes.size());
+                record.class_count = static_cast<uint32_t>(compound.classes.size());
+                record.combinator = static_cast<uint8_t>(combinator);
+                for (DOM::Atom name : compound.classes) classes.push_back(add_atom(name));
+                compounds.push_back(record);
+            }
+
+            void add_declaration(const Declaration& decl) {
+                DeclarationRecord record{};
+                record.property = static_cast<uint8_t>(decl.property);
+                record.type = static_cast<uint8_t>(decl.value.index());
+                std::visit([&](const auto& value) {
+                    using T = std::decay_t<decltype(value)>;
+                    if constexpr (std::is_same_v<T, std::string>) {
+                        record.payload = add_string(value);
+                    } else if constexpr (std::is_same_v<T, float>) {
+                        std::memcpy(&record.payload, &value, sizeof(float));
+                    } else if constexpr (std::is_same_v<T, Color>) {
+                        record.payload = uint32_t(value.r) | uint32_t(value.g) << 8 | uint32_t(value.b) << 16 | uint32_t(value.a) << 24;
+                    } else if constexpr (std::is_same_v<T, Length>) {
+                        std::memcpy(&record.payload, &value.value, sizeof(float));
+                        record.small = static_cast<uint8_t>(value.unit);
+                    } else {
+                        record.small = static_cast<uint8_t>(value);
+                    }
+                }, decl.value);
+                declarations.push_back(record);
+            }
+
+            std::vector<StringRecord> strings;
+            std::string string_bytes;
+            std::vector<RuleRecord> rules;
+            std::vector<SelectorRecord> selectors;
+            std::vector<CompoundRecord> compounds;
+            std::vector<uint32_t> classes;
+            std::vector<DeclarationRecord> declarations;
+
+        private:
+            std::unordered_map<std::string, uint32_t> m_string_index;
+        };
+
+        // Bounds-checked access to one section of a file.
+        template<typename T>
+        class Section {
+        public:
+            Section() = default;
+            Section(const char* begin, uint32_t count) : m_begin(begin), m_count(count) {}
+
+            uint32_t size() const { return m_count; }
+            bool contains(uint32_t first, uint32_t count) const { return first <= m_count && count <= m_count - first; }
+            T operator[](uint32_t i) const {
+                T record;
+                std::memcpy(&record, m_begin + size_t(i) * sizeof(T), sizeof(T));
+                return record;
+            }
+
+        private:
+            const char* m_begin = nullptr;
+            uint32_t m_count = 0;
+        };
+
+        class Reader {
+        public:
+            Reader(const char* data, size_t size) : m_data(data), m_size(size) {}
+
+            template<typename T>
+            bool take(uint32_t count, Section<T>& section) {
+                size_t bytes = size_t(count) * sizeof(T);
+                if (bytes > m_size - m_pos) return false;
+                section = Section<T>(m_data + m_pos, count);
+                m_pos += bytes;
+                return true;
+            }
+
+            bool take_bytes(uint32_t count, std::string_view& bytes) {
+                if (count > m_size - m_pos) return false;
+                bytes = std::string_view(m_data + m_pos, count);
+                m_pos += count;
+                return true;
+            }
+
+        private:
+            const char* m_data;
+            size_t m_size;
+            size_t m_pos = sizeof(Header);
+        };
+
+        bool valid_value(uint8_t type, uint8_t small) {
+            switch (type) {
+            case 3: return small <= uint8_t(Display::None);
+            case 4: return small <= uint8_t(FlexDirection::Column);
+            case 5: return small <= uint8_t(JustifyContent::SpaceAround);
+            case 6: return small <= uint8_t(Unit::Number);
+            case 7: return small < uint8_t(Keyword::Count);
+            default: return type < std::variant_size_v<Value>;
+            }
+        }
+
+        // A read-only view of a whole file, mapped rather than read into a buffer.
+        class MappedFile {
+        public:
+            explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+                m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+                if (m_file == INVALID_HANDLE_VALUE) return;
+                LARGE_INTEGER size;
+                if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) return;
+                m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (!m_mapping) return;
+                m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+                if (m_data) m_size = static_cast<size_t>(size.QuadPart);
+#else
+                m_fd = open(path.c_str(), O_RDONLY);
+                if (m_fd < 0) return;
+                struct stat info;
+                if (fstat(m_fd, &info) != 0 || info.st_size == 0) return;
+                void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, m_fd, 0);
+                if (data == MAP_FAILED) return;
+                m_data = data;
+                m_size = static_cast<size_t>(info.st_size);
+#endif
+            }
+
+            ~MappedFile() {
+#ifdef _WIN32
+                if (m_data) UnmapViewOfFile(m_data);
+                if (m_mapping) CloseHandle(m_mapping);
+                if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+                if (m_data) munmap(m_data, m_size);
+                if (m_fd >= 0) close(m_fd);
+#endif
+            }
+
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            const void* data() const { return m_data; }
+            size_t size() const { return m_size; }
+
+        private:
+#ifdef _WIN32
+            HANDLE m_file = INVALID_HANDLE_VALUE;
+            HANDLE m_mapping = nullptr;
+            void* m_data = nullptr;
+#else
+            int m_fd = -1;
+            void* m_data = nullptr;
+#endif
+            size_t m_size = 0;
+        };
+
+        unsigned long process_id() {
+#ifdef _WIN32
+            return GetCurrentProcessId();
+#else
+            return static_cast<unsigned long>(getpid());
+#endif
+        }
+    }
+
+    const Stylesheet& user_agent_stylesheet() {
+        static const Stylesheet stylesheet = Parser(std::string(UserAgentSource)).parse_stylesheet();
+        return stylesheet;
+    }
+
+    // MurmurHash64A, seeded with the length.
+    uint64_t content_hash(std::string_view source) {
+        constexpr uint64_t m = 0xc6a4a7935bd1e995ull;
+        constexpr int r = 47;
+        uint64_t hash = 0x8445d61a4e774912ull ^ (source.size() * m);
+        const char* p = source.data();
+        size_t remaining = source.size();
+        for (; remaining >= 8; p += 8, remaining -= 8) {
+            uint64_t k;
+            std::memcpy(&k, p, 8);
+            k *= m;
+            k ^= k >> r;
+            k *= m;
+            hash ^= k;
+            hash *= m;
+        }
+        if (remaining > 0) {
+            uint64_t k = 0;
+            std::memcpy(&k, p, remaining);
+            hash ^= k;
+            hash *= m;
+        }
+        hash ^= hash >> r;
+        hash *= m;
+        hash ^= hash >> r;
+        return hash;
+    }
+
+    std::string serialize_stylesheet(const Stylesheet& stylesheet, uint64_t hash) {
+        Writer writer;
+        for (const Rule& rule : stylesheet.rules) {
+            RuleRecord record{};
+            record.first_selector = static_cast<uint32_t>(writer.selectors.size());
+            record.selector_count = static_cast<uint32_t>(rule.selectors.size());
+            record.first_declaration = static_cast<uint32_t>(writer.declarations.size());
+            record.declaration_count = static_cast<uint32_t>(rule.declarations.size());
+            for (const Selector& selector : rule.selectors) {
+                writer.selectors.push_back(SelectorRecord{ static_cast<uint32_t>(writer.compounds.size()),
+                                                           static_cast<uint32_t>(selector.ancestors.size() + 1) });
+                writer.add_compound(selector, Combinator::Descendant);
+                for (const Selector::Ancestor& ancestor : selector.ancestors) {
+                    writer.add_compound(ancestor.compound, ancestor.combinator);
+                }
+            }
+            for (const Declaration& decl : rule.declarations) writer.add_declaration(decl);
+            writer.rules.push_back(record);
+        }
+
+        Header header{};
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = FormatVersion;
+        header.hash = hash;
+        header.property_count = static_cast<uint8_t>(PropertyId::Count);
+        header.keyword_count = static_cast<uint8_t>(Keyword::Count);
+        header.value_types = static_cast<uint8_t>(std::variant_size_v<Value>);
+        header.string_count = static_cast<uint32_t>(writer.strings.size());
+        header.rule_count = static_cast<uint32_t>(writer.rules.size());
+        header.selector_count = static_cast<uint32_t>(writer.selectors.size());
+        header.compound_count = static_cast<uint32_t>(writer.compounds.size());
+        header.class_count = static_cast<uint32_t>(writer.classes.size());
+        header.declaration_count = static_cast<uint32_t>(writer.declarations.size());
+        header.string_bytes = static_cast<uint32_t>(writer.string_bytes.size());
+
+        std::string out(reinterpret_cast<const char*>(&header), sizeof(header));
+        append_records(out, writer.strings);
+        append_records(out, writer.rules);
+        append_records(out, writer.selectors);
+        append_records(out, writer.compounds);
+        append_records(out, writer.classes);
+        append_records(out, writer.declarations);
+        out += writer.string_bytes;
+        return out;
+    }
+
+    std::optional<Stylesheet> deserialize_stylesheet(const void* data, size_t size, uint64_t hash) {
+        Header header;
+        if (size < sizeof(header)) return std::nullopt;
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != FormatVersion ||
+            header.hash != hash || header.property_count != uint8_t(PropertyId::Count) ||
+            header.keyword_count != uint8_t(Keyword::Count) || header.value_types != std::variant_size_v<Value>) {
+            return std::nullopt;
+        }
+
+        Reader reader(static_cast<const char*>(data), size);
+        Section<StringRecord> string_records;
+        Section<RuleRecord> rules;
+        Section<SelectorRecord> selectors;
+        Section<CompoundRecord> compounds;
+        Section<uint32_t> classes;
+        Section<DeclarationRecord> declarations;
+        std::string_view string_bytes;
+        if (!reader.take(header.string_count, string_records) || !reader.take(header.rule_count, rules) ||
+            !reader.take(header.selector_count, selectors) || !reader.take(header.compound_count, compounds) ||
+            !reader.take(header.class_count, classes) || !reader.take(header.declaration_count, declarations) ||
+            !reader.take_bytes(header.string_bytes, string_bytes)) {
+            return std::nullopt;
+        }
+
+        std::vector<std::string_view> strings(string_records.size());
+        for (uint32_t i = 0; i < string_records.size(); ++i) {
+            StringRecord record = string_records[i];
+            if (record.offset > string_bytes.size() || record.length > string_bytes.size() - record.offset) return std::nullopt;
+            strings[i] = string_bytes.substr(record.offset, record.length);
+        }
+        // Each name is interned once, however many selectors use it.
+        std::vector<DOM::Atom> atoms(strings.size(), DOM::Atoms::Null);
+        bool valid = true;
+        auto atom = [&](uint32_t index) -> DOM::Atom {
+            if (index == NoName) return DOM::Atoms::Null;
+            if (index >= strings.size()) {
+                valid = false;
+                return DOM::Atoms::Null;
+            }
+            if (atoms[index] == DOM::Atoms::Null) atoms[index] = DOM::intern(strings[index]);
+            return atoms[index];
+        };
+        auto read_compound = [&](const CompoundRecord& record, CompoundSelector& compound) {
+            compound.tag = atom(record.tag);
+            compound.id = atom(record.id);
+            if (!classes.contains(record.first_class, record.class_count)) {
+                valid = false;
+                return;
+            }
+            compound.classes.reserve(record.class_count);
+            for (uint32_t i = 0; i < record.class_count; ++i) compound.classes.push_back(atom(classes[record.first_class + i]));
+        };
+
+        Stylesheet stylesheet;
+        stylesheet.rules.resize(rules.size());
+        for (uint32_t r = 0; r < rules.size() && valid; ++r) {
+            RuleRecord rule_record = rules[r];
+            Rule& rule = stylesheet.rules[r];
+            if (!selectors.contains(rule_record.first_selector, rule_record.selector_count) ||
+                !declarations.contains(rule_record.first_declaration, rule_record.declaration_count)) {
+                return std::nullopt;
+            }
+
+            rule.selectors.resize(rule_record.selector_count);
+            for (uint32_t s = 0; s < rule_record.selector_count && valid; ++s) {
+                SelectorRecord selector_record = selectors[rule_record.first_selector + s];
+                if (selector_record.compound_count == 0 ||
+                    !compounds.contains(selector_record.first_compound, selector_record.compound_count)) {
+                    return std::nullopt;
+                }
+                Selector& selector = rule.selectors[s];
+                read_compound(compounds[selector_record.first_compound], selector);
+                selector.ancestors.resize(selector_record.compound_count - 1);
+                for (uint32_t c = 1; c < selector_record.compound_count; ++c) {
+                    CompoundRecord record = compounds[selector_record.first_compound + c];
+                    if (record.combinator > uint8_t(Combinator::Child)) return std::nullopt;
+                    selector.ancestors[c - 1].combinator = static_cast<Combinator>(record.combinator);
+                    read_compound(record, selector.ancestors[c - 1].compound);
+                }
+            }
+
+            rule.declarations.reserve(rule_record.declaration_count);
+            for (uint32_t d = 0; d < rule_record.declaration_count; ++d) {
+                DeclarationRecord record = declarations[rule_record.first_declaration + d];
+                if (record.property == 0 || record.property >= uint8_t(PropertyId::Count) ||
+                    !valid_value(record.type, record.small)) {
+                    return std::nullopt;
+                }
+                Value value;
+                float number;
+                std::memcpy(&number, &record.payload, sizeof(float));
+                switch (record.type) {
+                case 0:
+                    if (record.payload >= strings.size()) return std::nullopt;
+                    value = std::string(strings[record.payload]);
+                    break;
+                case 1: value = number; break;
+                case 2:
+                    value = Color{ uint8_t(record.payload), uint8_t(record.payload >> 8),
+                                   uint8_t(record.payload >> 16), uint8_t(record.payload >> 24) };
+                    break;
+                case 3: value = static_cast<Display>(record.small); break;
+                case 4: value = static_cast<FlexDirection>(record.small); break;
+                case 5: value = static_cast<JustifyContent>(record.small); break;
+                case 6: value = Length{ number, static_cast<Unit>(record.small) }; break;
+                default: value = static_cast<Keyword>(record.small); break;
+                }
+                rule.declarations.push_back(Declaration{ static_cast<PropertyId>(record.property), std::move(value) });
+            }
+        }
+        if (!valid) return std::nullopt;
+        return stylesheet;
+    }
+
+    StylesheetCache::StylesheetCache(std::string directory) : m_directory(std::move(directory)) {}
+
+    std::shared_ptr<const Stylesheet> StylesheetCache::get(std::string_view source) {
+        uint64_t hash = content_hash(source);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_index.find(hash);
+            if (it != m_index.end()) {
+                m_entries.splice(m_entries.begin(), m_entries, it->second);
+                ++m_stats.memory_hits;
+                return it->second->second;
+            }
+        }
+
+        // Compiled outside the lock; two threads missing on the same sheet both compile it.
+        std::shared_ptr<const Stylesheet> stylesheet = load_from_disk(hash);
+        bool from_disk = stylesheet != nullptr;
+        bool written = false;
+        if (!stylesheet) {
+            stylesheet = std::make_shared<const Stylesheet>(Parser(std::string(source)).parse_stylesheet());
+            written = write_to_disk(*stylesheet, hash);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++(from_disk ? m_stats.disk_hits : m_stats.parsed);
+        if (written) ++m_stats.disk_writes;
+        if (m_index.count(hash) == 0) {
+            m_entries.emplace_front(hash, stylesheet);
+            m_index[hash] = m_entries.begin();
+            if (m_entries.size() > MaxMemoryEntries) {
+                m_index.erase(m_entries.back().first);
+                m_entries.pop_back();
+            }
+        }
+        return stylesheet;
+    }
+
+    StylesheetCacheStats StylesheetCache::stats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+    std::string StylesheetCache::file_path(uint64_t hash) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.cssc", static_cast<unsigned long long>(hash));
+        return m_directory + "/" + name;
+    }
+
+    std::shared_ptr<const Stylesheet> StylesheetCache::load_from_disk(uint64_t hash) const {
+        if (m_directory.empty()) return nullptr;
+        MappedFile file(file_path(hash));
+        if (!file.data()) return nullptr;
+        auto stylesheet = deserialize_stylesheet(file.data(), file.size(), hash);
+        if (!stylesheet) return nullptr;
+        return std::make_shared<const Stylesheet>(std::move(*stylesheet));
+    }
+
+    bool StylesheetCache::write_to_disk(const Stylesheet& stylesheet, uint64_t hash) const {
+        if (m_directory.empty()) return false;
+        std::error_code error;
+        std::filesystem::create_directories(m_directory, error);
+        if (error) return false;
+
+        // Written aside and renamed into place, so a reader never maps a partial file.
+        // The name is unique to this write: another process, or another cache in this
+        // one, may be writing the same sheet at the same time.
+        static std::atomic<uint32_t> next_temporary{ 0 };
+        std::string path = file_path(hash);
+        std::string temporary = path + "." + std::to_string(process_id()) + "." + std::to_string(next_temporary++) + ".tmp";
+        {
+            std::string data = serialize_stylesheet(stylesheet, hash);
+            std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+            out.write(data.data(), static_cast<std::streamsize>(data.size()));
+            out.close(); // Flushes; a full disk may only show up here.
+            if (!out) {
+                std::filesystem::remove(temporary, error);
+                return false;
+            }
+        }
+        std::filesystem::rename(temporary, path, error);
+        if (error) {
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+        return true;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef STYLESHEET_CACHE_H
+#define STYLESHEET_CACHE_H
+
+#include "css.h"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace CSS {
+
+    // The built-in sheet every page is styled with before its own. It is parsed once,
+    // on first use, and shared for the rest of the process.
+    const Stylesheet& user_agent_stylesheet();
+
+    // A 64-bit hash of a stylesheet's source text; the key its compiled form is
+    // cached under.
+    uint64_t content_hash(std::string_view source);
+
+    // The compiled-stylesheet file format: a header, then flat arrays of fixed-size
+    // records for rules, selectors, compounds, class lists and declarations, then
+    // one string table. Names and string values are indices into the table, so a
+    // mapped file is read in place and nothing is tokenized again. Files written by
+    // another format version, or for other property and keyword tables, are rejected.
+    std::string serialize_stylesheet(const Stylesheet& stylesheet, uint64_t hash);
+    // Returns nothing if `data` isn't a well-formed file for `hash`.
+    std::optional<Stylesheet> deserialize_stylesheet(const void* data, size_t size, uint64_t hash);
+
+    struct StylesheetCacheStats {
+        size_t memory_hits = 0;
+        size_t disk_hits = 0;
+        size_t parsed = 0;      // Misses, compiled from source.
+        size_t disk_writes = 0;
+    };
+
+    // Compiled stylesheets keyed by the hash of their source. Recently used sheets
+    // are kept in memory; with a directory, every compiled sheet is also written
+    // there and memory-mapped back on a later miss, including in later sessions.
+    class StylesheetCache {
+    public:
+        static constexpr size_t MaxMemoryEntries = 32;
+
+        // An empty directory keeps the cache in memory only.
+        explicit StylesheetCache(std::string directory = {});
+
+        // The compiled form of `source`, parsing it only if no cache has it.
+        std::shared_ptr<const Stylesheet> get(std::string_view source);
+        StylesheetCacheStats stats() const;
+
+    private:
+        using Entry = std::pair<uint64_t, std::shared_ptr<const Stylesheet>>;
+
+        std::string m_directory;
+        mutable std::mutex m_mutex;
+        std::list<Entry> m_entries; // Most recently used first.
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+        StylesheetCacheStats m_stats;
+
+        std::string file_path(uint64_t hash) const;
+        std::shared_ptr<const Stylesheet> load_from_disk(uint64_t hash) const;
+        bool write_to_disk(const Stylesheet& stylesheet, uint64_t hash) const;
+    };
+}
+
+#endif // STYLESHEET_CACHE_H
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include "text_layout.h"
+#include "text_scanner.h"
+#include <chrono>
+#include <functional>
+
+namespace Layout {
+
+    namespace {
+
+        using Scan::is_space;
+
+        void collapse_whitespace(std::string_view text, std::string& out) {
+            out.clear();
+            bool pending_space = false;
+            for (char c : text) {
+                if (is_space(c)) {
+                    pending_space = !out.empty();
+                    continue;
+                }
+                if (pending_space) out.push_back(' ');
+                pending_space = false;
+                out.push_back(c);
+            }
+        }
+
+        size_t hash_run(std::string_view text, const Font& font) {
+            size_t hash = std::hash<std::string_view>()(text);
+            hash ^= (size_t(font.family) * 31 + font.weight) * 0x9E3779B97F4A7C15ull;
+            hash ^= std::hash<float>()(font.size) + (hash << 6) + (hash >> 2);
+            return hash;
+        }
+
+        std::shared_ptr<const TextRun> measure_run(std::string_view text, const Font& font, const FontMetrics& metrics) {
+            auto run = std::make_shared<TextRun>();
+            run->font = font;
+            run->text = std::string(text);
+            run->space_width = metrics.measure(" ", font);
+            size_t start = 0;
+            while (start < text.size()) {
+                size_t end = text.find(' ', start);
+                if (end == std::string_view::npos) end = text.size();
+                TextRun::Word word;
+                word.start = static_cast<uint32_t>(start);
+                word.length = static_cast<uint32_t>(end - start);
+                word.width = metrics.measure(text.substr(start, end - start), font);
+                run->words.push_back(word);
+                start = end + 1;
+            }
+            return run;
+        }
+    }
+
+    float FixedPitchMetrics::measure(std::string_view text, const Font& font) const {
+        size_t characters = 0;
+        for (char c : text) {
+            // Counts UTF-8 lead bytes, one per code point.
+            if ((static_cast<unsigned char>(c) & 0xC0) != 0x80) ++characters;
+        }
+        return characters * font.size * 0.6f;
+    }
+
+    void break_lines(const TextRun& run, float width, std::vector<TextLine>& lines) {
+        lines.clear();
+        const auto& words = run.words;
+        size_t i = 0;
+        while (i < words.size()) {
+            TextLine line;
+            line.start = words[i].start;
+            line.width = words[i].width;
+            size_t last = i;
+            while (last + 1 < words.size() && line.width + run.space_width + words[last + 1].width <= width) {
+                ++last;
+                line.width += run.space_width + words[last].width;
+            }
+            line.length = words[last].start + words[last].length - line.start;
+            lines.push_back(line);
+            i = last + 1;
+        }
+    }
+
+    std::shared_ptr<const TextRun> TextRunCache::get(std::string_view text, const Font& font) {
+        collapse_whitespace(text, m_collapsed);
+        std::shared_ptr<const TextRun>& slot = m_slots[hash_run(m_collapsed, font) & (Size - 1)];
+        if (slot && slot->font == font && slot->text == m_collapsed) {
+            ++m_stats.hits;
+            return slot;
+        }
+        ++m_stats.misses;
+        auto start = std::chrono::steady_clock::now();
+        slot = measure_run(m_collapsed, font, m_metrics);
+        m_stats.measure_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return slot;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifndef TEXT_LAYOUT_H
+#define TEXT_LAYOUT_H
+
+#include "atom.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Layout {
+
+    // What a run of text is set in.
+    struct Font {
+        DOM::Atom family = DOM::Atoms::Null;
+        uint16_t weight = 400;
+        float size = 16.0f;
+
+        bool operator==(const Font& other) const { return family == other.family && weight == other.weight && size == other.size; }
+        bool operator!=(const Font& other) const { return !(*this == other); }
+    };
+
+    // Glyph advances of the fonts text is painted with. Layout measures whole words
+    // through it, so it is called once per distinct word and font, not per frame.
+    class FontMetrics {
+    public:
+        virtual ~FontMetrics() = default;
+        // The advance of `text` on one line, in px.
+        virtual float measure(std::string_view text, const Font& font) const = 0;
+    };
+
+    // For when no font is loaded: every character is 0.6em wide.
+    class FixedPitchMetrics : public FontMetrics {
+    public:
+        float measure(std::string_view text, const Font& font) const override;
+    };
+
+    // A text node's content as laid out: whitespace collapsed to single spaces and
+    // trimmed, then split into words at the spaces, each measured once. Immutable,
+    // and shared by every box and cache entry with the same text and font.
+    struct TextRun {
+        struct Word {
+            uint32_t start = 0; // Byte range in `text`.
+            uint32_t length = 0;
+            float width = 0.0f;
+        };
+
+        Font font;
+        std::string text;
+        std::vector<Word> words;
+        float space_width = 0.0f;
+    };
+
+    // One line of a run: a byte range of its text, from the first word's start to
+    // the last word's end, and the width it takes.
+    struct TextLine {
+        uint32_t start = 0;
+        uint32_t length = 0;
+        float width = 0.0f;
+    };
+
+    // Breaks `run` into lines no wider than `width` at spaces, fitting as many words
+    // on each line as will go. A word wider than `width` gets a line to itself.
+    // Replaces the contents of `lines`.
+    void break_lines(const TextRun& run, float width, std::vector<TextLine>& lines);
+
+    struct TextRunCacheStats {
+        size_t hits = 0;
+        size_t misses = 0; // Runs measured.
+        // Only measuring is timed: a clock read costs about as much as breaking a
+        // short run into lines.
+        double measure_ms = 0.0;
+    };
+
+    // Measured runs keyed by their collapsed text and font. The width is not part
+    // of the key: a run is broken into lines for whatever width it is laid out at,
+    // so a resize only breaks lines again. Direct mapped: a new run that lands on
+    // an occupied slot replaces the one there. Not thread safe.
+    class TextRunCache {
+    public:
+        static constexpr size_t Size = 65536;
+
+        explicit TextRunCache(const FontMetrics& metrics) : m_metrics(metrics), m_slots(Size) {}
+
+        std::shared_ptr<const TextRun> get(std::string_view text, const Font& font);
+        TextRunCacheStats stats() const { return m_stats; }
+
+    private:
+        const FontMetrics& m_metrics;
+        std::vector<std::shared_ptr<const TextRun>> m_slots;
+        std::string m_collapsed; // Scratch for the text being looked up.
+        TextRunCacheStats m_stats;
+    };
+}
+
+#endif // TEXT_LAYOUT_H
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include "text_scanner.h"
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SCAN_HAVE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX2 code for functions that ask for it; MSVC always can.
+#if defined(SCAN_HAVE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SCAN_TARGET_AVX2
+#endif
+
+namespace Scan {
+
+    namespace {
+
+        inline bool in_set(char c, const DelimiterSet& set) {
+            for (int i = 0; i < set.count; ++i) {
+                if (set.chars[i] == c) return true;
+            }
+            return false;
+        }
+
+        // --- Scalar fallback ---
+
+        size_t find_first_of_scalar(const char* data, size_t pos, size_t size, const DelimiterSet& set) {
+            while (pos < size && !in_set(data[pos], set)) ++pos;
+            return pos;
+        }
+
+        size_t skip_whitespace_scalar(const char* data, size_t pos, size_t size) {
+            while (pos < size && is_space(data[pos])) ++pos;
+            return pos;
+        }
+
+#ifdef SCAN_HAVE_X86
+        inline unsigned count_trailing_zeros(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return static_cast<unsigned>(index);
+#else
+            return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+        }
+
+        // --- SSE2: 16 bytes per step ---
+
+        size_t find_first_of_sse2(const char* data, size_t pos, size_t size, const DelimiterSet& set) {
+            __m128i needles[8];
+            for (int i = 0; i < set.count; ++i) needles[i] = _mm_set1_epi8(set.chars[i]);
+
+            for (; pos + 16 <= size; pos += 16) {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+                __m128i hits = _mm_cmpeq_epi8(block, needles[0]);
+                for (int i = 1; i < set.count; ++i) {
+                    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[i]));
+                }
+                uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+                if (mask) return pos + count_trailing_zeros(mask);
+            }
+            return find_first_of_scalar(data, pos, size, set);
+        }
+
+        size_t skip_whitespace_sse2(const char* data, size_t pos, size_t size) {
+            const __m128i space = _mm_set1_epi8(' ');
+            const __m128i tab = _mm_set1_epi8('\t');
+            const __m128i range = _mm_set1_epi8('\r' - '\t');
+
+            for (; pos + 16 <= size; pos += 16) {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+                // '\t'..'\r' is a contiguous range: (c - '\t') <= 4 as an unsigned byte.
+                __m128i shifted = _mm_sub_epi8(block, tab);
+                __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(shifted, range), shifted);
+                __m128i ws = _mm_or_si128(in_range, _mm_cmpeq_epi8(block, space));
+                uint32_t mask = ~static_cast<uint32_t>(_mm_movemask_epi8(ws)) & 0xFFFFu;
+                if (mask) return pos + count_trailing_zeros(mask);
+            }
+            return skip_whitespace_scalar(data, pos, size);
+        }
+
+        // --- AVX2: 32 bytes per step ---
+
+        SCAN_TARGET_AVX2
+        size_t find_first_of_avx2(const char* data, size_t pos, size_t size, const DelimiterSet& set) {
+            __m256i needles[8];
+            for (int i = 0; i < set.count; ++i) needles[i] = _mm256_set1_epi8(set.chars[i]);
+
+            for (; pos + 32 <= size; pos += 32) {
+                __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+                __m256i hits = _mm256_cmpeq_epi8(block, needles[0]);
+                for (int i = 1; i < set.count; ++i) {
+                    hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, needles[i]));
+                }
+                uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+                if (mask) return pos + count_trailing_zeros(mask);
+            }
+            return find_first_of_sse2(data, pos, size, set);
+        }
+
+        SCAN_TARGET_AVX2
+        size_t skip_whitespace_avx2(const char* data, size_t pos, size_t size) {
+            const __m256i space = _mm256_set1_epi8(' ');
+            const __m256i tab = _mm256_set1_epi8('\t');
+            const __m256i range = _mm256_set1_epi8('\r' - '\t');
+
+            for (; pos + 32 <= size; pos += 32) {
+                __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos));
+                __m256i shifted = _mm256_sub_epi8(block, tab);
+                __m256i in_range = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, range), shifted);
+                __m256i ws = _mm256_or_si256(in_range, _mm256_cmpeq_epi8(block, space));
+                uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(ws));
+                if (mask) return pos + count_trailing_zeros(mask);
+            }
+            return skip_whitespace_sse2(data, pos, size);
+        }
+
+        bool cpu_has_avx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7) return false;
+            __cpuid(info, 1);
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            bool avx = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx) return false;
+            // The OS must save the YMM registers on context switches.
+            if ((_xgetbv(0) & 0x6) != 0x6) return false;
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+        }
+#endif // SCAN_HAVE_X86
+
+        Level detect_level() {
+#ifdef SCAN_HAVE_X86
+            if (cpu_has_avx2()) return Level::AVX2;
+            // SSE2 is part of the x86-64 baseline; on 32-bit x86 we assume it too.
+            return Level::SSE2;
+#else
+            return Level::Scalar;
+#endif
+        }
+
+        struct Dispatch {
+            Level level;
+            size_t (*find_first_of)(const char*, size_t, size_t, const DelimiterSet&);
+            size_t (*skip_whitespace)(const char*, size_t, size_t);
+        };
+
+        Dispatch make_dispatch(Level level) {
+#ifdef SCAN_HAVE_X86
+            if (level == Level::AVX2) return { Level::AVX2, find_first_of_avx2, skip_whitespace_avx2 };
+            if (level == Level::SSE2) return { Level::SSE2, find_first_of_sse2, skip_whitespace_sse2 };
+#endif
+            return { Level::Scalar, find_first_of_scalar, skip_whitespace_scalar };
+        }
+
+        Dispatch& dispatch() {
+            static Dispatch d = make_dispatch(detect_level());
+            return d;
+        }
+    }
+
+    size_t find_first_of(std::string_view input, size_t pos, const DelimiterSet& set) {
+        if (pos >= input.size()) return input.size();
+        return dispatch().find_first_of(input.data(), pos, input.size(), set);
+    }
+
+    size_t skip_whitespace(std::string_view input, size_t pos) {
+        if (pos >= input.size()) return input.size();
+        return dispatch().skip_whitespace(input.data(), pos, input.size());
+    }
+
+    size_t find_pair(std::string_view input, size_t pos, char first, char second) {
+        while (true) {
+            pos = find_first_of(input, pos, DelimiterSet(first));
+            if (pos + 1 >= input.size()) return input.size();
+            if (input[pos + 1] == second) return pos;
+            ++pos;
+        }
+    }
+
+    Level active_level() {
+        return dispatch().level;
+    }
+
+    void set_level(Level level) {
+        Level supported = detect_level();
+        if (static_cast<int>(level) > static_cast<int>(supported)) level = supported;
+        dispatch() = make_dispatch(level);
+    }
+}
\ No newline at end of file
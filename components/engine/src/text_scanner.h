@@ -0,0 +1,66 @@
+#ifndef TEXT_SCANNER_H
+#define TEXT_SCANNER_H
+
+#include <string_view>
+#include <cstddef>
+
+// Vectorized byte scanning shared by the HTML and CSS parsers. Each call looks at
+// 16 (SSE2) or 32 (AVX2) bytes per step; the implementation is picked once at
+// runtime from what the CPU supports, with a scalar fallback everywhere else.
+namespace Scan {
+
+    enum class Level { Scalar, SSE2, AVX2 };
+
+    // Up to 8 delimiter bytes to search for in one pass, e.g. {'<', '&'} or {';', '}'}.
+    struct DelimiterSet {
+        char chars[8] = {};
+        int count = 0;
+
+        constexpr DelimiterSet(char a) : chars{a}, count(1) {}
+        constexpr DelimiterSet(char a, char b) : chars{a, b}, count(2) {}
+        constexpr DelimiterSet(char a, char b, char c) : chars{a, b, c}, count(3) {}
+        constexpr DelimiterSet(char a, char b, char c, char d) : chars{a, b, c, d}, count(4) {}
+    };
+
+    // Index of the first byte at or after pos that is in the set, or input.size().
+    size_t find_first_of(std::string_view input, size_t pos, const DelimiterSet& set);
+
+    // Index of the first byte at or after pos that is not ASCII whitespace
+    // (space, \t, \n, \v, \f, \r), or input.size().
+    size_t skip_whitespace(std::string_view input, size_t pos);
+
+    // Index of the first byte of the next occurrence of needle (two bytes, e.g. "*/")
+    // at or after pos, or input.size().
+    size_t find_pair(std::string_view input, size_t pos, char first, char second);
+
+    // ASCII-only classification and case folding for the parsers: no locale lookups
+    // and no UB on bytes >= 0x80. is_space() is the set skip_whitespace() skips.
+    constexpr bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+    constexpr bool is_alpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+    constexpr bool is_digit(char c) { return c >= '0' && c <= '9'; }
+    constexpr bool is_alnum(char c) { return is_alpha(c) || is_digit(c); }
+    constexpr char lower(char c) { return (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c; }
+
+    // `lowercase` must already be lowercase.
+    constexpr bool equals_ignore_case(std::string_view s, std::string_view lowercase) {
+        if (s.length() != lowercase.length()) return false;
+        for (size_t i = 0; i < s.length(); ++i) {
+            if (lower(s[i]) != lowercase[i]) return false;
+        }
+        return true;
+    }
+
+    constexpr std::string_view trim(std::string_view s) {
+        while (!s.empty() && is_space(s.front())) s.remove_prefix(1);
+        while (!s.empty() && is_space(s.back())) s.remove_suffix(1);
+        return s;
+    }
+
+    Level active_level();
+
+    // Forces a given implementation (clamped to what the CPU supports). Meant for
+    // comparing implementations against each other; not thread-safe.
+    void set_level(Level level);
+}
+
+#endif // TEXT_SCANNER_H
\ No newline at end of file
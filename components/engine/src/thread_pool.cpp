@@ -0,0 +1,128 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+
+namespace Engine {
+
+    namespace {
+        // The pool and queue of the worker running on this thread, if any.
+        thread_local const ThreadPool* t_pool = nullptr;
+        thread_local size_t t_queue = 0;
+    }
+
+    ThreadPool::ThreadPool(size_t threads) {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; ++i) {
+            m_queues.push_back(std::make_unique<TaskQueue>());
+        }
+        for (size_t i = 0; i < threads; ++i) {
+            m_threads.emplace_back([this, i] { worker_loop(i); });
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    ThreadPool& ThreadPool::shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    void ThreadPool::submit(Task task) {
+        size_t index = t_pool == this ? t_queue : m_next_queue.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+        {
+            std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+            m_queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            // Taking the lock orders the increment with a worker checking before it sleeps.
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_pending.fetch_add(1);
+        }
+        m_wake.notify_one();
+    }
+
+    bool ThreadPool::take_task(size_t index, Task& task) {
+        {
+            TaskQueue& own = *m_queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                m_pending.fetch_sub(1);
+                return true;
+            }
+        }
+        for (size_t i = 1; i < m_queues.size(); ++i) {
+            TaskQueue& victim = *m_queues[(index + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                m_pending.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool ThreadPool::run_pending_task() {
+        if (m_pending.load() == 0) return false;
+        Task task;
+        size_t index = t_pool == this ? t_queue : 0;
+        if (!take_task(index, task)) return false;
+        task();
+        return true;
+    }
+
+    void ThreadPool::worker_loop(size_t index) {
+        t_pool = this;
+        t_queue = index;
+        while (true) {
+            Task task;
+            if (take_task(index, task)) {
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_wake_mutex);
+            m_wake.wait(lock, [this] { return m_stopping || m_pending.load() > 0; });
+            if (m_stopping && m_pending.load() == 0) return;
+        }
+    }
+
+    void TaskGroup::run(ThreadPool::Task task) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_outstanding;
+        }
+        m_pool.submit([this, task = std::move(task)] {
+            task();
+            // Decrement under the lock: wait() can't return, and the group can't be
+            // destroyed, until this task has let go of it.
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_outstanding == 0) m_done.notify_all();
+        });
+    }
+
+    void TaskGroup::wait() {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_outstanding == 0) return;
+            }
+            if (m_pool.run_pending_task()) continue;
+            // Everything left is running elsewhere; check back in case it forks more.
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait_for(lock, std::chrono::milliseconds(1), [this] { return m_outstanding == 0; });
+        }
+    }
+
+} // namespace Engine
\ No newline at end of file
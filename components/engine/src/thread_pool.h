@@ -0,0 +1,92 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Engine {
+
+    // A fixed set of worker threads, each with its own task deque. A worker runs its
+    // newest task first and, once out of work, steals the oldest task of another
+    // worker, so work forked deep in a traversal stays on the thread that forked it
+    // and idle threads take the biggest remaining pieces. Tasks must not throw.
+    class ThreadPool {
+    public:
+        using Task = std::function<void()>;
+
+        explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // One pool for the whole process, sized to the hardware threads.
+        static ThreadPool& shared();
+
+        size_t size() const { return m_threads.size(); }
+
+        // Queues a task. Called from a worker, it goes on that worker's own deque.
+        void submit(Task task);
+
+        // Runs one queued task on the calling thread, if there is any, so a thread
+        // waiting for tasks can help instead of blocking.
+        bool run_pending_task();
+
+    private:
+        struct TaskQueue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<TaskQueue>> m_queues;
+        std::vector<std::thread> m_threads;
+        std::atomic<size_t> m_pending{ 0 };
+        std::atomic<size_t> m_next_queue{ 0 };
+        std::mutex m_wake_mutex;
+        std::condition_variable m_wake;
+        bool m_stopping = false;
+
+        void worker_loop(size_t index);
+        // Own deque from the back, then the others from the front.
+        bool take_task(size_t index, Task& task);
+    };
+
+    // Tasks that are waited for together. A task may add more tasks to its group.
+    class TaskGroup {
+    public:
+        explicit TaskGroup(ThreadPool& pool) : m_pool(pool) {}
+        ~TaskGroup() { wait(); }
+
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        void run(ThreadPool::Task task);
+        // Returns once every task has finished, running queued tasks meanwhile.
+        void wait();
+
+    private:
+        ThreadPool& m_pool;
+        size_t m_outstanding = 0;
+        std::mutex m_mutex;
+        std::condition_variable m_done;
+    };
+
+    // How the tree passes (style, layout) split their work. A tree smaller than
+    // ParallelThreshold nodes is walked on the calling thread; in a larger one,
+    // subtrees, or runs of sibling subtrees, of about TaskGrain nodes become tasks.
+    // Queuing and running a task costs well under a microsecond, and no pass spends
+    // less than ~70ns a node (layout), so a task's overhead stays below 1% while a
+    // tree at the threshold still splits into 16 tasks.
+    constexpr size_t ParallelThreshold = 16384;
+    constexpr size_t TaskGrain = 1024;
+
+} // namespace Engine
+
+#endif // THREAD_POOL_H
\ No newline at end of file
@@ -0,0 +1,56 @@
+#ifndef TOOL_SUPPORT_H
+#define TOOL_SUPPORT_H
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// What the engine's command line programs share: engine_bench, render_page and the
+// test programs. Not part of the engine library.
+namespace Tools {
+
+    inline bool read_file(const char* path, std::string& contents) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return false;
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        contents = buffer.str();
+        return true;
+    }
+
+    // Checks failed so far in this test program.
+    inline int g_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            ++Tools::g_failures; \
+        } \
+    } while (0)
+
+    struct Test {
+        const char* name;
+        void (*run)();
+    };
+
+    // The main of a test program, `program [test ...]`: runs every test, or the named
+    // ones, and returns non-zero if any check failed.
+    template<size_t N>
+    int run_tests(int argc, char** argv, const Test (&tests)[N]) {
+        for (const Test& test : tests) {
+            bool selected = argc == 1;
+            for (int i = 1; i < argc; ++i) selected = selected || std::strcmp(argv[i], test.name) == 0;
+            if (!selected) continue;
+            int failures_before = g_failures;
+            test.run();
+            std::cout << (g_failures == failures_before ? "[PASS] " : "[FAIL] ") << test.name << std::endl;
+        }
+        return g_failures == 0 ? 0 : 1;
+    }
+}
+
+#endif // TOOL_SUPPORT_H
\ No newline at end of file
@@ -0,0 +1,165 @@
+// Pixel checks of the CPU rasterizer, through the same passes render_page runs:
+//   raster_tests [test ...]
+// Runs every test, or the named ones, and exits non-zero if any check failed.
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "html_parser.h"
+#include "css_parser.h"
+#include "stylesheet_cache.h"
+#include "style.h"
+#include "layout.h"
+#include "spatial_index.h"
+#include "display_list.h"
+#include "thread_pool.h"
+#include "rasterizer.h"
+#include "tool_support.h"
+
+namespace {
+    // Three blocks stacked at the top left of the page, the green one across four tiles.
+    const char* const BlocksPage =
+        "<html><body><div id=\"red\"></div><div id=\"green\"></div><div id=\"blue\"></div></body></html>";
+    const char* const BlocksStylesheet =
+        "html, body { margin: 0px; padding: 0px; }"
+        "#red { display: block; width: 100px; height: 50px; background-color: #ff0000; }"
+        "#green { display: block; width: 300px; height: 300px; background-color: #00ff00; }"
+        "#blue { display: block; width: 20px; height: 20px; margin-left: 40px; background-color: #0000ff; }";
+
+    // A page carried through every pass up to the display list, as render_page does.
+    struct Page {
+        std::unique_ptr<DOM::Document> document;
+        CSS::Stylesheet stylesheet;
+        std::unique_ptr<Style::StyledNode> style_root;
+        Layout::FixedPitchMetrics font_metrics;
+        std::unique_ptr<Layout::TextRunCache> text_cache;
+        Layout::LayoutTree layout_tree;
+        Layout::SpatialIndex box_index;
+        Paint::DisplayList display_list;
+
+        Page(const std::string& html, const std::string& css) {
+            document = HTML::Parser(html).parse_document();
+            stylesheet = CSS::Parser(css).parse_stylesheet();
+            std::vector<const CSS::Stylesheet*> stylesheets{ &CSS::user_agent_stylesheet(), &stylesheet };
+            Style::RuleIndex rules(stylesheets);
+            style_root = Style::parallel_style_tree(document->root(), rules, Engine::ThreadPool::shared());
+            text_cache = std::make_unique<Layout::TextRunCache>(font_metrics);
+            Layout::Rect viewport;
+            viewport.width = 1280.0f;
+            viewport.height = 720.0f;
+            layout_tree.build(*style_root);
+            layout_tree.parallel_layout(viewport, *text_cache, Engine::ThreadPool::shared());
+            box_index.build(layout_tree);
+            display_list.build(layout_tree);
+        }
+    };
+
+    Layout::Rect make_viewport(float x, float y, float width, float height) {
+        Layout::Rect viewport;
+        viewport.x = x;
+        viewport.y = y;
+        viewport.width = width;
+        viewport.height = height;
+        return viewport;
+    }
+
+    uint32_t pixel(const Gpu::Framebuffer& framebuffer, uint32_t x, uint32_t y) {
+        const uint8_t* p = framebuffer.pixels.data() + (static_cast<size_t>(y) * framebuffer.width + x) * 4;
+        return static_cast<uint32_t>(p[0]) << 16 | static_cast<uint32_t>(p[1]) << 8 | p[2];
+    }
+
+    // Backgrounds land on the pixels their boxes cover, edges included, and the
+    // rest of the page stays white.
+    void raster_blocks() {
+        Page page(BlocksPage, BlocksStylesheet);
+        Gpu::TileRasterizer rasterizer;
+        Gpu::Framebuffer framebuffer;
+        Gpu::RasterStats stats;
+        rasterizer.render(page.display_list, page.box_index, make_viewport(0, 0, 1280, 720), framebuffer,
+                          Engine::ThreadPool::shared(), &stats);
+        CHECK(framebuffer.width == 1280 && framebuffer.height == 720);
+        CHECK(pixel(framebuffer, 0, 0) == 0xff0000);
+        CHECK(pixel(framebuffer, 99, 49) == 0xff0000);
+        CHECK(pixel(framebuffer, 100, 0) == 0xffffff);
+        CHECK(pixel(framebuffer, 0, 50) == 0x00ff00);
+        // The green block crosses the first tile's right and bottom edges.
+        CHECK(pixel(framebuffer, 299, 349) == 0x00ff00);
+        CHECK(pixel(framebuffer, 300, 349) == 0xffffff);
+        CHECK(pixel(framebuffer, 39, 350) == 0xffffff);
+        CHECK(pixel(framebuffer, 40, 350) == 0x0000ff);
+        CHECK(pixel(framebuffer, 59, 369) == 0x0000ff);
+        CHECK(pixel(framebuffer, 60, 369) == 0xffffff);
+        CHECK(pixel(framebuffer, 40, 370) == 0xffffff);
+        CHECK(pixel(framebuffer, 1279, 719) == 0xffffff);
+        CHECK(stats.tiles_rasterized == 5 * 3 && stats.tiles_reused == 0);
+    }
+
+    // A viewport that doesn't start on a tile edge shows the same pixels, shifted.
+    void raster_scrolled() {
+        Page page(BlocksPage, BlocksStylesheet);
+        Gpu::TileRasterizer rasterizer;
+        Gpu::Framebuffer framebuffer;
+        rasterizer.render(page.display_list, page.box_index, make_viewport(30, 340, 200, 100), framebuffer,
+                          Engine::ThreadPool::shared());
+        CHECK(framebuffer.width == 200 && framebuffer.height == 100);
+        CHECK(pixel(framebuffer, 0, 0) == 0x00ff00);
+        CHECK(pixel(framebuffer, 9, 10) == 0xffffff);
+        CHECK(pixel(framebuffer, 10, 10) == 0x0000ff);
+        CHECK(pixel(framebuffer, 29, 29) == 0x0000ff);
+        CHECK(pixel(framebuffer, 30, 29) == 0xffffff);
+        CHECK(pixel(framebuffer, 10, 30) == 0xffffff);
+    }
+
+    // An unchanged page reuses every tile, and a changed one redraws only the tiles
+    // it damaged.
+    void raster_tile_reuse() {
+        Page page(BlocksPage, BlocksStylesheet);
+        Gpu::TileRasterizer rasterizer;
+        Gpu::Framebuffer first, second;
+        Gpu::RasterStats stats;
+        Layout::Rect viewport = make_viewport(0, 0, 1280, 720);
+        rasterizer.render(page.display_list, page.box_index, viewport, first, Engine::ThreadPool::shared());
+        rasterizer.render(page.display_list, page.box_index, viewport, second, Engine::ThreadPool::shared(), &stats);
+        CHECK(stats.tiles_rasterized == 0 && stats.tiles_reused == 5 * 3 && stats.items_drawn == 0);
+        CHECK(first.pixels == second.pixels);
+
+        std::string recolored = BlocksStylesheet;
+        recolored += "#blue { background-color: #000000; }";
+        Page changed(BlocksPage, recolored);
+        rasterizer.render(changed.display_list, changed.box_index, viewport, second, Engine::ThreadPool::shared(), &stats);
+        CHECK(stats.tiles_rasterized == 1 && stats.tiles_reused == 5 * 3 - 1);
+        CHECK(pixel(second, 40, 350) == 0x000000);
+        CHECK(pixel(second, 0, 0) == 0xff0000);
+    }
+
+    // A viewport with nothing in it still reports its own, empty, frame.
+    void raster_empty_viewport() {
+        Page page(BlocksPage, BlocksStylesheet);
+        Gpu::TileRasterizer rasterizer;
+        Gpu::Framebuffer framebuffer;
+        Gpu::RasterStats stats;
+        rasterizer.render(page.display_list, page.box_index, make_viewport(0, 0, 1280, 720), framebuffer,
+                          Engine::ThreadPool::shared(), &stats);
+        CHECK(stats.tiles_rasterized > 0);
+        rasterizer.render(page.display_list, page.box_index, make_viewport(0, 0, 0, 0), framebuffer,
+                          Engine::ThreadPool::shared(), &stats);
+        CHECK(framebuffer.width == 0 && framebuffer.height == 0);
+        CHECK(stats.tiles_rasterized == 0 && stats.tiles_reused == 0 && stats.items_drawn == 0);
+        rasterizer.render(page.display_list, page.box_index, make_viewport(-500, -500, 100, 100), framebuffer,
+                          Engine::ThreadPool::shared(), &stats);
+        CHECK(stats.tiles_rasterized == 0 && stats.tiles_reused == 0 && stats.items_drawn == 0);
+    }
+
+    const Tools::Test Tests[] = {
+        { "raster_blocks", raster_blocks },
+        { "raster_scrolled", raster_scrolled },
+        { "raster_tile_reuse", raster_tile_reuse },
+        { "raster_empty_viewport", raster_empty_viewport },
+    };
+}
+
+int main(int argc, char** argv) {
+    return Tools::run_tests(argc, argv, Tests);
+}
\ No newline at end of file
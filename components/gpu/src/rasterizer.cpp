@@ -0,0 +1,354 @@
+#include "rasterizer.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+namespace Gpu {
+
+    namespace {
+        // Printable ASCII from the public domain font8x8_basic. One byte a row, top to
+        // bottom, with the lowest bit the leftmost pixel.
+        const uint8_t Glyphs[95][8] = {
+            { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ' '
+            { 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 }, // !
+            { 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // "
+            { 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 }, // #
+            { 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 }, // $
+            { 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 }, // %
+            { 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 }, // &
+            { 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '
+            { 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 }, // (
+            { 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 }, // )
+            { 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 }, // *
+            { 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 }, // +
+            { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 }, // ,
+            { 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 }, // -
+            { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 }, // .
+            { 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 }, // /
+            { 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 }, // 0
+            { 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 }, // 1
+            { 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 }, // 2
+            { 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 }, // 3
+            { 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 }, // 4
+            { 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 }, // 5
+            { 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 }, // 6
+            { 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 }, // 7
+            { 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 }, // 8
+            { 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 }, // 9
+            { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 }, // :
+            { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 }, // ;
+            { 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 }, // <
+            { 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 }, // =
+            { 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 }, // >
+            { 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 }, // ?
+            { 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 }, // @
+            { 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 }, // A
+            { 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 }, // B
+            { 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 }, // C
+            { 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 }, // D
+            { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 }, // E
+            { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 }, // F
+            { 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 }, // G
+            { 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 }, // H
+            { 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, // I
+            { 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 }, // J
+            { 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 }, // K
+            { 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 }, // L
+            { 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 }, // M
+            { 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 }, // N
+            { 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 }, // O
+            { 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 }, // P
+            { 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 }, // Q
+            { 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 }, // R
+            { 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 }, // S
+            { 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, // T
+            { 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 }, // U
+            { 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 }, // V
+            { 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 }, // W
+            { 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 }, // X
+            { 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 }, // Y
+            { 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 }, // Z
+            { 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 }, // [
+            { 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 }, // backslash
+            { 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 }, // ]
+            { 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 }, // ^
+            { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF }, // _
+            { 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 }, // `
+            { 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 }, // a
+            { 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 }, // b
+            { 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 }, // c
+            { 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 }, // d
+            { 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 }, // e
+            { 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 }, // f
+            { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F }, // g
+            { 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 }, // h
+            { 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, // i
+            { 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E }, // j
+            { 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 }, // k
+            { 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 }, // l
+            { 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 }, // m
+            { 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 }, // n
+            { 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 }, // o
+            { 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F }, // p
+            { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 }, // q
+            { 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 }, // r
+            { 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 }, // s
+            { 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 }, // t
+            { 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 }, // u
+            { 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 }, // v
+            { 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 }, // w
+            { 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 }, // x
+            { 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F }, // y
+            { 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 }, // z
+            { 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 }, // {
+            { 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 }, // |
+            { 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 }, // }
+            { 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ~
+        };
+
+        constexpr uint32_t TileSize = TileRasterizer::TileSize;
+
+        uint64_t tile_key(uint32_t column, uint32_t row) { return static_cast<uint64_t>(row) << 32 | column; }
+
+        // FNV-1a, continued from `hash`.
+        uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; ++i) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        // Hashes what an item draws, text by content: a run can be freed and another
+        // allocated at its address.
+        uint64_t hash_item(uint64_t hash, const Paint::DisplayItem& item) {
+            const CSS::Color& color = item.color;
+            uint8_t header[5] = { static_cast<uint8_t>(item.type), color.r, color.g, color.b, color.a };
+            float geometry[5] = { item.x, item.y, item.width, item.height, item.font_size };
+            hash = hash_bytes(hash, header, sizeof(header));
+            hash = hash_bytes(hash, geometry, sizeof(geometry));
+            return hash_bytes(hash, item.text, item.text_length);
+        }
+
+        // The pixels whose centers lie in [start, end), clamped to a tile.
+        void covered_pixels(float start, float end, int& first, int& last) {
+            first = std::max(0, static_cast<int>(std::ceil(start - 0.5f)));
+            last = std::min(static_cast<int>(TileSize), static_cast<int>(std::ceil(end - 0.5f)));
+        }
+
+        void blend(uint8_t* pixel, const CSS::Color& color) {
+            if (color.a == 255) {
+                pixel[0] = color.r;
+                pixel[1] = color.g;
+                pixel[2] = color.b;
+                pixel[3] = 255;
+                return;
+            }
+            unsigned alpha = color.a, rest = 255 - color.a;
+            pixel[0] = static_cast<uint8_t>((color.r * alpha + pixel[0] * rest + 127) / 255);
+            pixel[1] = static_cast<uint8_t>((color.g * alpha + pixel[1] * rest + 127) / 255);
+            pixel[2] = static_cast<uint8_t>((color.b * alpha + pixel[2] * rest + 127) / 255);
+            pixel[3] = static_cast<uint8_t>(alpha + (pixel[3] * rest + 127) / 255);
+        }
+
+        // Item coordinates are relative to the tile here.
+        void fill_rect(uint8_t* pixels, float x, float y, float width, float height, const CSS::Color& color) {
+            int x0, x1, y0, y1;
+            covered_pixels(x, x + width, x0, x1);
+            covered_pixels(y, y + height, y0, y1);
+            for (int py = y0; py < y1; ++py) {
+                uint8_t* row = pixels + (static_cast<size_t>(py) * TileSize) * 4;
+                for (int px = x0; px < x1; ++px) blend(row + px * 4, color);
+            }
+        }
+
+        // Each code point gets a cell as wide as FixedPitchMetrics measures it and
+        // font_size tall, centered in the line, and the glyph is scaled to fill it.
+        void draw_text(uint8_t* pixels, const Paint::DisplayItem& item, float x, float y) {
+            float advance = item.font_size * 0.6f;
+            float cell_top = y + (item.height - item.font_size) * 0.5f;
+            if (advance <= 0.0f || cell_top >= TileSize || cell_top + item.font_size <= 0.0f) return;
+            int y0, y1;
+            covered_pixels(cell_top, cell_top + item.font_size, y0, y1);
+
+            float cell_left = x;
+            for (uint32_t i = 0; i < item.text_length && cell_left < TileSize; ++i) {
+                unsigned char c = static_cast<unsigned char>(item.text[i]);
+                if ((c & 0xC0) == 0x80) continue;
+                float left = cell_left;
+                cell_left += advance;
+                // Code points past ASCII take their space but draw nothing.
+                if (c <= ' ' || c > '~' || cell_left <= 0.0f) continue;
+
+                const uint8_t* glyph = Glyphs[c - ' '];
+                int x0, x1;
+                covered_pixels(left, cell_left, x0, x1);
+                for (int py = y0; py < y1; ++py) {
+                    int glyph_row = std::min(7, static_cast<int>((py + 0.5f - cell_top) * 8.0f / item.font_size));
+                    uint8_t bits = glyph[glyph_row];
+                    if (!bits) continue;
+                    uint8_t* row = pixels + (static_cast<size_t>(py) * TileSize) * 4;
+                    for (int px = x0; px < x1; ++px) {
+                        int glyph_column = std::min(7, static_cast<int>((px + 0.5f - left) * 8.0f / advance));
+                        if (bits >> glyph_column & 1) blend(row + px * 4, item.color);
+                    }
+                }
+            }
+        }
+
+        void draw_tile(std::vector<uint8_t>& pixels, const Paint::DisplayList& display_list,
+                       const std::vector<uint32_t>& items, float tile_x, float tile_y) {
+            pixels.resize(static_cast<size_t>(TileSize) * TileSize * 4);
+            std::fill(pixels.begin(), pixels.end(), uint8_t(255));
+            for (uint32_t index : items) {
+                const Paint::DisplayItem& item = display_list.items()[index];
+                if (item.type == Paint::ItemType::SolidRect) {
+                    fill_rect(pixels.data(), item.x - tile_x, item.y - tile_y, item.width, item.height, item.color);
+                } else {
+                    draw_text(pixels.data(), item, item.x - tile_x, item.y - tile_y);
+                }
+            }
+        }
+    }
+
+    void Framebuffer::resize(uint32_t new_width, uint32_t new_height) {
+        width = new_width;
+        height = new_height;
+        pixels.assign(static_cast<size_t>(width) * height * 4, 255);
+    }
+
+    bool write_ppm(const Framebuffer& framebuffer, const std::string& path) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out << "P6\n" << framebuffer.width << ' ' << framebuffer.height << "\n255\n";
+        std::vector<uint8_t> row(static_cast<size_t>(framebuffer.width) * 3);
+        for (uint32_t y = 0; y < framebuffer.height; ++y) {
+            const uint8_t* source = framebuffer.pixels.data() + static_cast<size_t>(y) * framebuffer.width * 4;
+            for (uint32_t x = 0; x < framebuffer.width; ++x) {
+                row[x * 3] = source[x * 4];
+                row[x * 3 + 1] = source[x * 4 + 1];
+                row[x * 3 + 2] = source[x * 4 + 2];
+            }
+            out.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+        }
+        return static_cast<bool>(out);
+    }
+
+    void TileRasterizer::render(const Paint::DisplayList& display_list, const Layout::SpatialIndex& index,
+                                const Layout::Rect& viewport, Framebuffer& framebuffer, Engine::ThreadPool& pool,
+                                RasterStats* stats) {
+        auto start = std::chrono::steady_clock::now();
+        ++m_frame;
+        framebuffer.resize(static_cast<uint32_t>(std::max(0.0f, std::ceil(viewport.width))),
+                           static_cast<uint32_t>(std::max(0.0f, std::ceil(viewport.height))));
+        // Whole pixels, so tiles copy into the framebuffer without resampling.
+        float origin_x = std::floor(viewport.x), origin_y = std::floor(viewport.y);
+        float left = std::max(0.0f, origin_x), top = std::max(0.0f, origin_y);
+        float right = origin_x + framebuffer.width, bottom = origin_y + framebuffer.height;
+        RasterStats frame_stats;
+        if (right <= left || bottom <= top) {
+            // Nothing of the page is in view; still report this frame, not the last one.
+            frame_stats.raster_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (stats) *stats = frame_stats;
+            return;
+        }
+
+        // Tiles are looked up before any task runs, so the tasks never touch the map.
+        struct TileJob {
+            uint32_t column, row;
+            Tile* tile;
+            bool drawn = false;
+            size_t items_drawn = 0;
+        };
+        std::vector<TileJob> jobs;
+        for (uint32_t row = static_cast<uint32_t>(top / TileSize); row * TileSize < bottom; ++row) {
+            for (uint32_t column = static_cast<uint32_t>(left / TileSize); column * TileSize < right; ++column) {
+                Tile& tile = m_tiles[tile_key(column, row)];
+                tile.last_used = m_frame;
+                jobs.push_back(TileJob{ column, row, &tile });
+            }
+        }
+
+        Engine::TaskGroup tasks(pool);
+        for (TileJob& job : jobs) {
+            tasks.run([&display_list, &index, &job] {
+                Layout::Rect area;
+                area.x = static_cast<float>(job.column * TileSize);
+                area.y = static_cast<float>(job.row * TileSize);
+                area.width = area.height = static_cast<float>(TileSize);
+                std::vector<Layout::BoxId> boxes;
+                index.query(area, boxes);
+
+                // The items that reach into the tile, in paint order, and their fingerprint.
+                std::vector<uint32_t> items;
+                uint64_t fingerprint = 14695981039346656037ull;
+                for (Layout::BoxId box : boxes) {
+                    uint32_t first = display_list.first_item(box);
+                    uint32_t end = first + display_list.item_count(box);
+                    for (uint32_t i = first; i < end; ++i) {
+                        const Paint::DisplayItem& item = display_list.items()[i];
+                        if (item.x >= area.x + area.width || item.y >= area.y + area.height ||
+                            item.y + item.height <= area.y) continue;
+                        // A text item's width is its line's; glyphs overflowing it are
+                        // not worth a tighter bound.
+                        if (item.type == Paint::ItemType::SolidRect && item.x + item.width <= area.x) continue;
+                        items.push_back(i);
+                        fingerprint = hash_item(fingerprint, item);
+                    }
+                }
+                if (job.tile->drawn && job.tile->fingerprint == fingerprint) return;
+                draw_tile(job.tile->pixels, display_list, items, area.x, area.y);
+                job.tile->fingerprint = fingerprint;
+                job.tile->drawn = true;
+                job.drawn = true;
+                job.items_drawn = items.size();
+            });
+        }
+        tasks.wait();
+
+        for (const TileJob& job : jobs) {
+            if (job.drawn) {
+                ++frame_stats.tiles_rasterized;
+                frame_stats.items_drawn += job.items_drawn;
+            } else {
+                ++frame_stats.tiles_reused;
+            }
+
+            // Copy the part of the tile inside the viewport, row by row.
+            float tile_x = static_cast<float>(job.column * TileSize), tile_y = static_cast<float>(job.row * TileSize);
+            int x0 = static_cast<int>(std::max(tile_x, origin_x) - origin_x);
+            int x1 = static_cast<int>(std::min(tile_x + TileSize, right) - origin_x);
+            int y0 = static_cast<int>(std::max(tile_y, origin_y) - origin_y);
+            int y1 = static_cast<int>(std::min(tile_y + TileSize, bottom) - origin_y);
+            int source_x = static_cast<int>(origin_x + x0 - tile_x);
+            int source_y = static_cast<int>(origin_y + y0 - tile_y);
+            for (int y = y0; y < y1; ++y) {
+                const uint8_t* source = job.tile->pixels.data() + (static_cast<size_t>(source_y + y - y0) * TileSize + source_x) * 4;
+                uint8_t* target = framebuffer.pixels.data() + (static_cast<size_t>(y) * framebuffer.width + x0) * 4;
+                std::memcpy(target, source, static_cast<size_t>(x1 - x0) * 4);
+            }
+        }
+        evict();
+
+        frame_stats.raster_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (stats) *stats = frame_stats;
+    }
+
+    void TileRasterizer::evict() {
+        if (m_tiles.size() <= m_max_tiles) return;
+        std::vector<std::pair<uint64_t, uint64_t>> by_use; // Last used, key.
+        by_use.reserve(m_tiles.size());
+        for (const auto& entry : m_tiles) by_use.emplace_back(entry.second.last_used, entry.first);
+        size_t excess = m_tiles.size() - m_max_tiles;
+        std::nth_element(by_use.begin(), by_use.begin() + (excess - 1), by_use.end());
+        for (size_t i = 0; i < excess; ++i) {
+            // Never a tile of the frame just drawn.
+            if (by_use[i].first == m_frame) continue;
+            m_tiles.erase(by_use[i].second);
+        }
+    }
+}
\ No newline at end of file
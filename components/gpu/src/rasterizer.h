@@ -0,0 +1,72 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include "display_list.h"
+#include "spatial_index.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Engine { class ThreadPool; }
+
+namespace Gpu {
+
+    // RGBA, 8 bits a channel, rows top to bottom.
+    struct Framebuffer {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> pixels;
+
+        void resize(uint32_t new_width, uint32_t new_height);
+    };
+
+    // Writes the framebuffer as a binary PPM, dropping alpha. Returns false if the
+    // file could not be written.
+    bool write_ppm(const Framebuffer& framebuffer, const std::string& path);
+
+    struct RasterStats {
+        size_t tiles_rasterized = 0;
+        size_t tiles_reused = 0;
+        size_t items_drawn = 0;
+        double raster_ms = 0.0; // The whole render() call.
+    };
+
+    // Paints a display list on the CPU, in TileSize tiles of the page that are kept
+    // between renders. A tile is drawn again only when it is damaged: when the items
+    // that overlap it, found through the spatial index, differ from the ones it was
+    // drawn from. Damaged tiles are drawn in parallel. Text is drawn with a built-in
+    // 8x8 font at the advances of Layout::FixedPitchMetrics, so pages should be laid
+    // out with those metrics. No anti-aliasing: a pixel is covered when its center is.
+    class TileRasterizer {
+    public:
+        static constexpr uint32_t TileSize = 256;
+
+        // Tiles beyond `max_tiles` are dropped, least recently used first, after a render.
+        explicit TileRasterizer(size_t max_tiles = 128) : m_max_tiles(max_tiles) {}
+
+        // Draws the part of the page in `viewport` into `framebuffer`, resized to the
+        // viewport. The index and display list must be built from the same layout.
+        void render(const Paint::DisplayList& display_list, const Layout::SpatialIndex& index, const Layout::Rect& viewport,
+                    Framebuffer& framebuffer, Engine::ThreadPool& pool, RasterStats* stats = nullptr);
+        // Drops every tile, for when the page changes.
+        void clear() { m_tiles.clear(); }
+        size_t tile_count() const { return m_tiles.size(); }
+
+    private:
+        struct Tile {
+            uint64_t fingerprint = 0; // Of the items the pixels were drawn from.
+            uint64_t last_used = 0;
+            bool drawn = false;
+            std::vector<uint8_t> pixels; // TileSize * TileSize RGBA.
+        };
+
+        size_t m_max_tiles;
+        uint64_t m_frame = 0;
+        std::unordered_map<uint64_t, Tile> m_tiles; // By row << 32 | column.
+
+        void evict();
+    };
+}
+
+#endif // RASTERIZER_H
\ No newline at end of file
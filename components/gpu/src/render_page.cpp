@@ -0,0 +1,77 @@
+// Renders the top of a local page to a PPM image without a window or GPU:
+//   render_page <page.html> <out.ppm> [stylesheet.css ...]
+// The stylesheets follow the built-in one, in the order given.
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "html_parser.h"
+#include "css_parser.h"
+#include "stylesheet_cache.h"
+#include "style.h"
+#include "layout.h"
+#include "spatial_index.h"
+#include "display_list.h"
+#include "thread_pool.h"
+#include "rasterizer.h"
+#include "tool_support.h"
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <page.html> <out.ppm> [stylesheet.css ...]" << std::endl;
+        return 2;
+    }
+
+    std::string html;
+    if (!Tools::read_file(argv[1], html)) {
+        std::cerr << "Cannot read " << argv[1] << std::endl;
+        return 1;
+    }
+    std::vector<CSS::Stylesheet> author_sheets;
+    for (int i = 3; i < argc; ++i) {
+        std::string css;
+        if (!Tools::read_file(argv[i], css)) {
+            std::cerr << "Cannot read " << argv[i] << std::endl;
+            return 1;
+        }
+        author_sheets.push_back(CSS::Parser(css).parse_stylesheet());
+    }
+
+    auto document = HTML::Parser(html).parse_document();
+    if (!document->root()) {
+        std::cerr << "No document in " << argv[1] << std::endl;
+        return 1;
+    }
+    std::vector<const CSS::Stylesheet*> stylesheets{ &CSS::user_agent_stylesheet() };
+    for (const auto& sheet : author_sheets) stylesheets.push_back(&sheet);
+    Style::RuleIndex rules(stylesheets);
+    Engine::ThreadPool& pool = Engine::ThreadPool::shared();
+    auto style_root = Style::parallel_style_tree(document->root(), rules, pool);
+
+    // The rasterizer draws text at fixed pitch advances, so layout measures with them too.
+    Layout::FixedPitchMetrics font_metrics;
+    Layout::TextRunCache text_cache(font_metrics);
+    Layout::Rect viewport;
+    viewport.width = 1280.0f;
+    viewport.height = 720.0f;
+    Layout::LayoutTree layout_tree;
+    layout_tree.build(*style_root);
+    layout_tree.parallel_layout(viewport, text_cache, pool);
+    Layout::SpatialIndex box_index;
+    box_index.build(layout_tree);
+    Paint::DisplayList display_list;
+    display_list.build(layout_tree);
+
+    Gpu::TileRasterizer rasterizer;
+    Gpu::Framebuffer framebuffer;
+    Gpu::RasterStats stats;
+    rasterizer.render(display_list, box_index, viewport, framebuffer, pool, &stats);
+    if (!Gpu::write_ppm(framebuffer, argv[2])) {
+        std::cerr << "Cannot write " << argv[2] << std::endl;
+        return 1;
+    }
+    std::cout << "[Raster] " << framebuffer.width << "x" << framebuffer.height << ": " << stats.tiles_rasterized
+              << " tiles, " << stats.items_drawn << " items in " << stats.raster_ms << " ms" << std::endl;
+    return 0;
+}
\ No newline at end of file
@@ -1,19 +1,64 @@
 #include "network_process.h"
+#include "text_scanner.h"
 #include <iostream>
+#include <thread>
 
 namespace Net {
 
+    std::string resolve_url(const std::string& base, std::string_view reference) {
+        reference = Scan::trim(reference);
+        std::string ref(reference.substr(0, reference.find('#')));
+        size_t scheme_end = base.find("://");
+        if (ref.find("://") != std::string::npos || scheme_end == std::string::npos) {
+            return ref;
+        }
+        size_t host_end = base.find('/', scheme_end + 3);
+        if (host_end == std::string::npos) host_end = base.length();
+
+        if (ref.compare(0, 2, "//") == 0) {
+            return base.substr(0, scheme_end + 1) + ref;
+        }
+        if (!ref.empty() && ref[0] == '/') {
+            return base.substr(0, host_end) + ref;
+        }
+        // Relative to the directory of the page, ignoring its query.
+        std::string path = base.substr(0, base.find_first_of("?#"));
+        size_t last_slash = path.rfind('/');
+        if (last_slash == std::string::npos || last_slash < host_end) {
+            return base.substr(0, host_end) + "/" + ref;
+        }
+        return path.substr(0, last_slash + 1) + ref;
+    }
+
     NetworkProcess::NetworkProcess(std::shared_ptr<Engine::ContentBlocker> blocker)
         : m_blocker(blocker) {}
 
     std::optional<Resource> NetworkProcess::request(const std::string& url) {
+        std::shared_future<Resource> prefetched;
+        {
+            std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+            auto it = m_prefetches.find(url);
+            if (it != m_prefetches.end()) {
+                prefetched = std::move(it->second);
+                m_prefetches.erase(it);
+                ++m_prefetch_stats.hits;
+            }
+        }
+        if (prefetched.valid()) {
+            std::cout << "[Network] Prefetch hit: " << url << std::endl;
+            return prefetched.get();
+        }
+
         std::cout << "[Network] Requesting URL: " << url << std::endl;
 
         if (m_blocker->should_block(url)) {
             std::cout << "[Network] *** BLOCKED *** by Content Blocker." << std::endl;
             return std::nullopt;
         }
+        return fetch(url);
+    }
 
+    Resource NetworkProcess::fetch(const std::string& url) {
         // --- REAL HTTP REQUEST ---
         cpr::Response r = cpr::Get(cpr::Url{url});
 
@@ -22,7 +67,8 @@ namespace Net {
             return Resource{
                 url,
                 r.text,
-                r.header["content-type"]
+                r.header["content-type"],
+                r.status_code
             };
         } else {
             std::cout << "[Network] !!! FAILED !!! (" << r.status_code << ")" << std::endl;
@@ -30,9 +76,67 @@ namespace Net {
             return Resource{
                 url,
                 "<h1>Error " + std::to_string(r.status_code) + "</h1>",
-                "text/html"
+                "text/html",
+                r.status_code
             };
         }
     }
 
+    void NetworkProcess::prefetch(const std::string& url) {
+        if (m_blocker->should_block(url)) return;
+
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+        if (m_prefetches.count(url)) return;
+        std::cout << "[Network] Prefetching URL: " << url << std::endl;
+
+        // The fetch runs detached: a discarded prefetch must not make navigation wait
+        // for its response.
+        std::promise<Resource> promise;
+        m_prefetches.emplace(url, promise.get_future().share());
+        ++m_prefetch_stats.issued;
+        std::thread([url, promise = std::move(promise)]() mutable {
+            promise.set_value(fetch(url));
+        }).detach();
+    }
+
+    void NetworkProcess::discard_prefetches() {
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+        m_prefetch_stats.wasted += m_prefetches.size();
+        m_prefetches.clear();
+    }
+
+    PrefetchStats NetworkProcess::prefetch_stats() const {
+        std::lock_guard<std::mutex> lock(m_prefetch_mutex);
+        return m_prefetch_stats;
+    }
+
+    std::optional<Resource> NetworkProcess::request(const std::string& url, const std::function<void(std::string_view)>& on_chunk) {
+        std::cout << "[Network] Streaming URL: " << url << std::endl;
+
+        if (m_blocker->should_block(url)) {
+            std::cout << "[Network] *** BLOCKED *** by Content Blocker." << std::endl;
+            return std::nullopt;
+        }
+
+        size_t received = 0;
+        cpr::Response r = cpr::Get(cpr::Url{url}, cpr::WriteCallback{[&](const std::string_view& data, intptr_t) {
+            received += data.size();
+            on_chunk(data);
+            return true;
+        }});
+
+        if (r.status_code == 200) {
+            std::cout << "[Network] Success (" << r.status_code << ") [" << r.header["content-type"] << "] " << received << " bytes" << std::endl;
+            return Resource{ url, "", r.header["content-type"], r.status_code };
+        }
+
+        std::cout << "[Network] !!! FAILED !!! (" << r.status_code << ")" << std::endl;
+        // The server's own error page has already been streamed; only fill in ours
+        // when it sent nothing.
+        if (received == 0) {
+            on_chunk("<h1>Error " + std::to_string(r.status_code) + "</h1>");
+        }
+        return Resource{ url, "", "text/html", r.status_code };
+    }
+
 } // namespace Net
\ No newline at end of file
@@ -4,6 +4,11 @@
 #include <string>
 #include <memory>
 #include <optional>
+#include <functional>
+#include <string_view>
+#include <future>
+#include <mutex>
+#include <unordered_map>
 #include "content_blocker.h"
 #include <cpr/cpr.h> // <-- ADD THIS LINE
 
@@ -13,15 +18,48 @@ namespace Net {
         std::string url;
         std::string data;
         std::string content_type;
+        // The HTTP status, or 0 if no response arrived. For failures, data holds an
+        // error page to show in place of a document, never a subresource.
+        long status_code = 0;
+
+        bool ok() const { return status_code == 200; }
+    };
+
+    struct PrefetchStats {
+        size_t issued = 0;
+        size_t hits = 0;   // Requests answered from a prefetch.
+        size_t wasted = 0; // Prefetches discarded without ever being requested.
     };
 
+    // Resolves a URL found in a page (absolute, "//host/...", "/path" or relative)
+    // against the page's own URL. The fragment is dropped.
+    std::string resolve_url(const std::string& base, std::string_view reference);
+
     class NetworkProcess {
     public:
         NetworkProcess(std::shared_ptr<Engine::ContentBlocker> blocker);
+        // Uses the response of an earlier prefetch() of the same URL if there is one.
         std::optional<Resource> request(const std::string& url);
+        // Streams the body to on_chunk as it is received instead of buffering it.
+        // The returned Resource carries the URL and content type but no data.
+        std::optional<Resource> request(const std::string& url, const std::function<void(std::string_view)>& on_chunk);
+
+        // Starts fetching `url` in the background so that a later request() for it
+        // doesn't wait on the network. Repeated and blocked URLs are ignored.
+        void prefetch(const std::string& url);
+        // Drops every prefetch nobody requested, e.g. when navigating away, and
+        // counts them as wasted.
+        void discard_prefetches();
+        PrefetchStats prefetch_stats() const;
 
     private:
         std::shared_ptr<Engine::ContentBlocker> m_blocker;
+
+        mutable std::mutex m_prefetch_mutex;
+        std::unordered_map<std::string, std::shared_future<Resource>> m_prefetches;
+        PrefetchStats m_prefetch_stats;
+
+        static Resource fetch(const std::string& url);
     };
 
 } // namespace Net
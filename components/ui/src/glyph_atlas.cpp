@@ -0,0 +1,286 @@
+#include "glyph_atlas.h"
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+// ImGui ships stb_truetype; its own copy is compiled static too, so the two don't clash.
+#define STB_TRUETYPE_IMPLEMENTATION
+#define STBTT_STATIC
+#include "imstb_truetype.h"
+
+namespace {
+    constexpr int MaxPixelSize = 512;
+    constexpr int Padding = 1; // Right of and below each glyph, so filtering never reaches a neighbour.
+    // One reserve must stay under the 64k vertices 16 bit indices can address.
+    constexpr size_t MaxQuadsPerReserve = 8192;
+
+    int pixel_size(float font_size) {
+        return std::clamp(static_cast<int>(std::lround(font_size)), 1, MaxPixelSize);
+    }
+
+    // Decodes the code point at `text` and moves past it. A malformed byte decodes
+    // as U+FFFD on its own.
+    uint32_t next_code_point(const char*& text, const char* end) {
+        unsigned char lead = static_cast<unsigned char>(*text++);
+        if (lead < 0x80) return lead;
+        int length = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : -1;
+        if (length < 0 || end - text < length) return 0xFFFD;
+        uint32_t code_point = lead & (0x3F >> length);
+        for (int i = 0; i < length; ++i) {
+            unsigned char next = static_cast<unsigned char>(text[i]);
+            if ((next & 0xC0) != 0x80) return 0xFFFD;
+            code_point = code_point << 6 | (next & 0x3F);
+        }
+        text += length;
+        return code_point <= 0x10FFFF ? code_point : 0xFFFD;
+    }
+}
+
+struct GlyphAtlas::Face {
+    std::vector<unsigned char> data;
+    stbtt_fontinfo info;
+    int ascent = 0; // In font units.
+};
+
+GlyphAtlas::GlyphAtlas() = default;
+GlyphAtlas::~GlyphAtlas() = default;
+
+bool GlyphAtlas::load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    auto face = std::make_unique<Face>();
+    face->data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (face->data.empty()) return false;
+    int offset = stbtt_GetFontOffsetForIndex(face->data.data(), 0);
+    if (offset < 0 || !stbtt_InitFont(&face->info, face->data.data(), offset)) return false;
+    int descent = 0, line_gap = 0;
+    stbtt_GetFontVMetrics(&face->info, &face->ascent, &descent, &line_gap);
+
+    release();
+    m_face = std::move(face);
+    return true;
+}
+
+void GlyphAtlas::release() {
+    for (Page& page : m_pages) {
+        if (page.texture) glDeleteTextures(1, &page.texture);
+    }
+    m_pages.clear();
+    m_current_page = 0;
+    m_glyphs.clear();
+}
+
+float GlyphAtlas::measure(std::string_view text, const Layout::Font& font) const {
+    if (!m_face) return 0.0f;
+    float scale = stbtt_ScaleForPixelHeight(&m_face->info, static_cast<float>(pixel_size(font.size)));
+    const char* position = text.data();
+    const char* end = position + text.size();
+    int advance_units = 0;
+    while (position < end) {
+        int advance = 0, left_bearing = 0;
+        stbtt_GetCodepointHMetrics(&m_face->info, static_cast<int>(next_code_point(position, end)), &advance, &left_bearing);
+        advance_units += advance;
+    }
+    return advance_units * scale;
+}
+
+void GlyphAtlas::begin_frame() {
+    ++m_frame;
+    m_stats.misses = 0;
+    m_stats.evictions = 0;
+    m_stats.dropped = 0;
+    m_stats.draw_calls = 0;
+}
+
+void GlyphAtlas::add_text(float font_size, ImVec2 position, ImU32 color, const char* text, const char* text_end) {
+    if (!m_face) return;
+    int size = pixel_size(font_size);
+    float scale = stbtt_ScaleForPixelHeight(&m_face->info, static_cast<float>(size));
+    // Bitmaps are placed on whole pixels, so they map onto the screen texel for texel.
+    float baseline = std::round(position.y + m_face->ascent * scale);
+    float pen = position.x;
+    const float texel = 1.0f / PageSize;
+    while (text < text_end) {
+        uint32_t code_point = next_code_point(text, text_end);
+        const Glyph* glyph = find_glyph(code_point, size);
+        if (!glyph) {
+            int advance = 0, left_bearing = 0;
+            stbtt_GetCodepointHMetrics(&m_face->info, static_cast<int>(code_point), &advance, &left_bearing);
+            pen += advance * scale;
+            continue;
+        }
+        if (glyph->page != NoPage) {
+            float x = std::round(pen) + glyph->left;
+            float y = baseline + glyph->top;
+            m_pages[glyph->page].quads.push_back(Quad{
+                ImVec2(x, y), ImVec2(x + glyph->width, y + glyph->height),
+                ImVec2(glyph->x * texel, glyph->y * texel), ImVec2((glyph->x + glyph->width) * texel, (glyph->y + glyph->height) * texel),
+                color });
+        }
+        pen += glyph->advance;
+    }
+}
+
+void GlyphAtlas::flush(ImDrawList* draw_list) {
+    GLint previous_texture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for (Page& page : m_pages) {
+        if (page.dirty_top >= page.dirty_bottom) continue;
+        glBindTexture(GL_TEXTURE_2D, page.texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, page.dirty_top, PageSize, page.dirty_bottom - page.dirty_top, GL_RGBA,
+                        GL_UNSIGNED_BYTE, page.pixels.data() + static_cast<size_t>(page.dirty_top) * PageSize * 4);
+        page.dirty_top = PageSize;
+        page.dirty_bottom = 0;
+    }
+    glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(previous_texture));
+
+    size_t used_area = 0;
+    for (Page& page : m_pages) {
+        used_area += page.used_area;
+        if (page.quads.empty()) continue;
+        draw_list->PushTextureID((ImTextureID)(intptr_t)page.texture);
+        for (size_t first = 0; first < page.quads.size(); first += MaxQuadsPerReserve) {
+            size_t count = std::min(MaxQuadsPerReserve, page.quads.size() - first);
+            draw_list->PrimReserve(static_cast<int>(count * 6), static_cast<int>(count * 4));
+            for (size_t i = first; i < first + count; ++i) {
+                const Quad& quad = page.quads[i];
+                draw_list->PrimRectUV(quad.min, quad.max, quad.uv_min, quad.uv_max, quad.color);
+            }
+        }
+        draw_list->PopTextureID();
+        page.quads.clear();
+        ++m_stats.draw_calls;
+    }
+
+    m_stats.pages = m_pages.size();
+    m_stats.glyphs = m_glyphs.size();
+    m_stats.occupancy = m_pages.empty() ? 0.0f : static_cast<float>(used_area) / (m_pages.size() * PageSize * PageSize);
+}
+
+const GlyphAtlas::Glyph* GlyphAtlas::find_glyph(uint32_t code_point, int pixel_size) {
+    uint32_t key = static_cast<uint32_t>(pixel_size) << 21 | code_point;
+    auto found = m_glyphs.find(key);
+    if (found != m_glyphs.end()) {
+        if (found->second.page != NoPage) m_pages[found->second.page].last_used = m_frame;
+        return &found->second;
+    }
+
+    ++m_stats.misses;
+    const stbtt_fontinfo& info = m_face->info;
+    float scale = stbtt_ScaleForPixelHeight(&info, static_cast<float>(pixel_size));
+    Glyph glyph;
+    int advance = 0, left_bearing = 0;
+    stbtt_GetCodepointHMetrics(&info, static_cast<int>(code_point), &advance, &left_bearing);
+    glyph.advance = advance * scale;
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    stbtt_GetCodepointBitmapBox(&info, static_cast<int>(code_point), scale, scale, &x0, &y0, &x1, &y1);
+    int width = x1 - x0, height = y1 - y0;
+    if (width > 0 && height > 0) {
+        size_t page_index = 0;
+        int x = 0, y = 0;
+        if (!place(width, height, page_index, x, y)) {
+            // Not cached, so it is tried again next frame.
+            ++m_stats.dropped;
+            return nullptr;
+        }
+        m_bitmap.resize(static_cast<size_t>(width) * height);
+        stbtt_MakeCodepointBitmap(&info, m_bitmap.data(), width, height, width, scale, scale, static_cast<int>(code_point));
+        Page& page = m_pages[page_index];
+        for (int row = 0; row < height; ++row) {
+            uint8_t* pixel = page.pixels.data() + (static_cast<size_t>(y + row) * PageSize + x) * 4;
+            for (int column = 0; column < width; ++column, pixel += 4) {
+                pixel[0] = pixel[1] = pixel[2] = 255;
+                pixel[3] = m_bitmap[static_cast<size_t>(row) * width + column];
+            }
+        }
+        page.dirty_top = std::min(page.dirty_top, y);
+        page.dirty_bottom = std::max(page.dirty_bottom, y + height);
+        page.glyph_keys.push_back(key);
+        page.last_used = m_frame;
+
+        glyph.page = static_cast<uint8_t>(page_index);
+        glyph.x = static_cast<uint16_t>(x);
+        glyph.y = static_cast<uint16_t>(y);
+        glyph.width = static_cast<uint16_t>(width);
+        glyph.height = static_cast<uint16_t>(height);
+        glyph.left = static_cast<int16_t>(x0);
+        glyph.top = static_cast<int16_t>(y0);
+    }
+    return &(m_glyphs[key] = glyph);
+}
+
+bool GlyphAtlas::place(int width, int height, size_t& page_index, int& x, int& y) {
+    int padded_width = width + Padding, padded_height = height + Padding;
+    // At most once into a fresh or emptied page, where any glyph up to MaxPixelSize fits.
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (!m_pages.empty()) {
+            Page& page = m_pages[m_current_page];
+            if (page.row_x + padded_width > PageSize) {
+                page.row_y += page.row_height;
+                page.row_x = 0;
+                page.row_height = 0;
+            }
+            if (page.row_y + padded_height <= PageSize) {
+                page_index = m_current_page;
+                x = page.row_x;
+                y = page.row_y;
+                page.row_x += padded_width;
+                page.row_height = std::max(page.row_height, padded_height);
+                page.used_area += static_cast<size_t>(width) * height;
+                return true;
+            }
+        }
+
+        if (m_pages.size() < MaxPages) {
+            m_current_page = add_page();
+            continue;
+        }
+        size_t oldest = MaxPages;
+        for (size_t i = 0; i < m_pages.size(); ++i) {
+            if (m_pages[i].last_used == m_frame) continue;
+            if (oldest == MaxPages || m_pages[i].last_used < m_pages[oldest].last_used) oldest = i;
+        }
+        if (oldest == MaxPages) return false;
+        empty_page(oldest);
+        ++m_stats.evictions;
+        m_current_page = oldest;
+    }
+    return false;
+}
+
+size_t GlyphAtlas::add_page() {
+    Page page;
+    page.pixels.assign(static_cast<size_t>(PageSize) * PageSize * 4, 0);
+    page.dirty_top = 0;
+    page.dirty_bottom = PageSize;
+
+    GLint previous_texture = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous_texture);
+    glGenTextures(1, &page.texture);
+    glBindTexture(GL_TEXTURE_2D, page.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, PageSize, PageSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(previous_texture));
+
+    m_pages.push_back(std::move(page));
+    return m_pages.size() - 1;
+}
+
+void GlyphAtlas::empty_page(size_t page_index) {
+    Page& page = m_pages[page_index];
+    for (uint32_t key : page.glyph_keys) m_glyphs.erase(key);
+    page.glyph_keys.clear();
+    // Cleared, so filtering at the edge of a new glyph never picks up an old one.
+    std::fill(page.pixels.begin(), page.pixels.end(), uint8_t(0));
+    page.dirty_top = 0;
+    page.dirty_bottom = PageSize;
+    page.row_x = page.row_y = page.row_height = 0;
+    page.used_area = 0;
+}
\ No newline at end of file
@@ -0,0 +1,101 @@
+#ifndef GLYPH_ATLAS_H
+#define GLYPH_ATLAS_H
+
+#include "text_layout.h"
+#include "imgui.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct GlyphAtlasStats {
+    size_t pages = 0;
+    float occupancy = 0.0f; // Share of the pages' area taken by glyphs.
+    size_t glyphs = 0;
+    // This frame:
+    size_t misses = 0;      // Glyphs rasterized.
+    size_t evictions = 0;   // Pages emptied to make room.
+    size_t dropped = 0;     // Glyphs not drawn: every page was full and in use.
+    size_t draw_calls = 0;
+};
+
+// Glyphs of one TrueType face, rasterized on demand at each whole pixel size text is
+// drawn at, so large text is as sharp as small text, and packed in rows onto RGBA
+// texture pages. When all MaxPages are full, the page least recently drawn from is
+// emptied and reused; pages drawn from this frame are never evicted, as queued quads
+// point into them. Text of a frame is queued and drawn at flush() in one batch per
+// page, on top of everything else drawn into the list. As FontMetrics it measures
+// with the face's own advances; family and weight are ignored.
+class GlyphAtlas : public Layout::FontMetrics {
+public:
+    static constexpr int PageSize = 1024;
+    static constexpr size_t MaxPages = 4;
+
+    GlyphAtlas();
+    ~GlyphAtlas() override;
+
+    GlyphAtlas(const GlyphAtlas&) = delete;
+    GlyphAtlas& operator=(const GlyphAtlas&) = delete;
+
+    // Reads a TrueType file. Returns false if it can't be read or parsed.
+    bool load(const std::string& path);
+    bool loaded() const { return m_face != nullptr; }
+    // Deletes the textures and glyphs. Call while the GL context is still current.
+    void release();
+
+    float measure(std::string_view text, const Layout::Font& font) const override;
+
+    // Resets the per frame counters.
+    void begin_frame();
+    // Queues `text` with the top of its line at `position`.
+    void add_text(float font_size, ImVec2 position, ImU32 color, const char* text, const char* text_end);
+    // Uploads new glyphs and draws the queued text.
+    void flush(ImDrawList* draw_list);
+    const GlyphAtlasStats& stats() const { return m_stats; }
+
+private:
+    struct Face;
+
+    struct Glyph {
+        uint8_t page = NoPage;
+        uint16_t x = 0, y = 0, width = 0, height = 0; // In the page.
+        int16_t left = 0, top = 0; // Of the bitmap, from the pen on the baseline.
+        float advance = 0.0f;
+    };
+    static constexpr uint8_t NoPage = 0xFF;
+
+    struct Quad {
+        ImVec2 min, max, uv_min, uv_max;
+        ImU32 color;
+    };
+
+    struct Page {
+        unsigned int texture = 0;
+        std::vector<uint8_t> pixels;
+        // The row being filled: glyphs go left to right, and a new row starts below
+        // the tallest glyph of this one.
+        int row_x = 0, row_y = 0, row_height = 0;
+        size_t used_area = 0;
+        uint64_t last_used = 0;
+        int dirty_top = PageSize, dirty_bottom = 0;
+        std::vector<uint32_t> glyph_keys;
+        std::vector<Quad> quads;
+    };
+
+    std::unique_ptr<Face> m_face;
+    std::vector<Page> m_pages;
+    size_t m_current_page = 0; // The one new glyphs go on.
+    std::unordered_map<uint32_t, Glyph> m_glyphs; // By size << 21 | code point.
+    std::vector<uint8_t> m_bitmap; // Scratch for one rasterized glyph.
+    uint64_t m_frame = 0;
+    GlyphAtlasStats m_stats;
+
+    const Glyph* find_glyph(uint32_t code_point, int pixel_size);
+    bool place(int width, int height, size_t& page_index, int& x, int& y);
+    size_t add_page();
+    void empty_page(size_t page_index);
+};
+
+#endif // GLYPH_ATLAS_H
\ No newline at end of file
@@ -3,8 +3,10 @@
 #include <vector>
 #include <memory>
 #include <optional>
+#include <cfloat>
 #include <functional>
 #include <sstream>
+#include <chrono>
 
 // Graphics and Windowing
 #include <glad/glad.h>
@@ -15,9 +17,14 @@
 
 // Our Engine and other components
 #include "html_parser.h"
-#include "css_parser.h"
+#include "preload_scanner.h"
+#include "stylesheet_cache.h"
 #include "style.h"
+#include "thread_pool.h"
 #include "layout.h"
+#include "spatial_index.h"
+#include "display_list.h"
+#include "glyph_atlas.h"
 #include "content_blocker.h"
 #include "network_process.h"
 #include "javascript.h"
@@ -25,6 +32,7 @@
 struct UIState {
     char address_bar_text[1024] = "http://info.cern.ch/hypertext/WWW/TheProject.html";
     bool load_requested = true;
+    bool restyle_requested = false; // After scripts changed the current document.
     std::string url_to_load = "http://info.cern.ch/hypertext/WWW/TheProject.html";
     bool show_dev_console = true;
     bool show_about_window = false;
@@ -52,55 +60,50 @@ void ApplyNetscapeTheme() {
     colors[ImGuiCol_ChildBg] = ImVec4(0.01f, 0.0f, 0.01f, 1.00f);
 }
 
-void render_layout_box(const Layout::LayoutBox* box, ImDrawList* draw_list, ImVec2 viewport_origin) {
-    if (!box || !box->styled_node) return;
-
-    ImVec2 p_min(viewport_origin.x + box->dimensions.x, viewport_origin.y + box->dimensions.y);
-    ImVec2 p_max(p_min.x + box->dimensions.width, p_min.y + box->dimensions.height);
-
-    if (box->box_type == Layout::BoxType::Block || box->box_type == Layout::BoxType::Flex) {
-        auto it = box->styled_node->specified_values.find("background-color");
-        if (it != box->styled_node->specified_values.end()) {
-            if (const CSS::Color* color = std::get_if<CSS::Color>(&it->second)) {
-                draw_list->AddRectFilled(p_min, p_max, IM_COL32(color->r, color->g, color->b, color->a));
-            }
-        }
+// Measures text with the font it is painted with. Only one face is loaded, so
+// family and weight don't change the advances.
+class ImGuiFontMetrics : public Layout::FontMetrics {
+public:
+    float measure(std::string_view text, const Layout::Font& font) const override {
+        return ImGui::GetFont()->CalcTextSizeA(font.size, FLT_MAX, 0.0f, text.data(), text.data() + text.size()).x;
     }
+};
 
-    if (box->box_type == Layout::BoxType::Anonymous && box->styled_node->node->type == DOM::NodeType::Text) {
-        auto it = box->styled_node->specified_values.find("color");
-        if (it != box->styled_node->specified_values.end()) {
-            if (const CSS::Color* color = std::get_if<CSS::Color>(&it->second)) {
-                float font_size = 16.0f;
-                auto fs_it = box->styled_node->specified_values.find("font-size");
-                if (fs_it != box->styled_node->specified_values.end()) {
-                    if (const float* fs = std::get_if<float>(&fs_it->second)) {
-                        font_size = *fs;
-                    }
-                }
-                ImGui::GetFont()->Scale = font_size / ImGui::GetFontSize();
-                ImGui::PushFont(ImGui::GetFont());
-                
-                ImVec2 text_pos(p_min.x, p_min.y);
-                float wrap_width = box->dimensions.width;
-                const char* text_start = box->styled_node->node->text_data.c_str();
-                const char* text_end = text_start + box->styled_node->node->text_data.length();
-                
-                draw_list->AddText(ImGui::GetFont(), font_size, text_pos, IM_COL32(color->r, color->g, color->b, color->a), text_start, text_end, wrap_width);
-
-                ImGui::PopFont();
+// Copies the display items of `boxes` into the draw list; all styling was resolved
+// when the list was built. Text goes through the glyph atlas when it has a font.
+// Returns how many items were drawn.
+size_t replay_display_list(const Paint::DisplayList& display_list, const std::vector<Layout::BoxId>& boxes,
+                           ImDrawList* draw_list, ImVec2 origin, GlyphAtlas& glyph_atlas) {
+    ImFont* font = ImGui::GetFont();
+    if (glyph_atlas.loaded()) glyph_atlas.begin_frame();
+    const std::vector<Paint::DisplayItem>& items = display_list.items();
+    size_t replayed = 0;
+    for (Layout::BoxId box : boxes) {
+        uint32_t first = display_list.first_item(box);
+        uint32_t end = first + display_list.item_count(box);
+        for (uint32_t i = first; i < end; ++i) {
+            const Paint::DisplayItem& item = items[i];
+            ImVec2 p_min(origin.x + item.x, origin.y + item.y);
+            ImU32 color = IM_COL32(item.color.r, item.color.g, item.color.b, item.color.a);
+            if (item.type == Paint::ItemType::SolidRect) {
+                draw_list->AddRectFilled(p_min, ImVec2(p_min.x + item.width, p_min.y + item.height), color);
+            } else if (glyph_atlas.loaded()) {
+                glyph_atlas.add_text(item.font_size, p_min, color, item.text, item.text + item.text_length);
+            } else {
+                draw_list->AddText(font, item.font_size, p_min, color, item.text, item.text + item.text_length);
             }
         }
+        replayed += end - first;
     }
-
-    for (const auto& child : box->children) {
-        render_layout_box(child.get(), draw_list, viewport_origin);
-    }
+    if (glyph_atlas.loaded()) glyph_atlas.flush(draw_list);
+    return replayed;
 }
 
 int main() {
     auto content_blocker = std::make_shared<Engine::ContentBlocker>();
     Net::NetworkProcess network_process(content_blocker);
+    // Compiled stylesheets, kept across navigations and, on disk, across sessions.
+    CSS::StylesheetCache stylesheet_cache("cache/stylesheets");
     JS::JSEngine js_engine;
 
     if (!glfwInit()) { return -1; }
@@ -115,17 +118,80 @@ int main() {
     ImGui_ImplOpenGL3_Init("#version 330");
 
     UIState ui_state;
-    std::unique_ptr<DOM::Node> dom_root_owner = nullptr;
+    std::unique_ptr<DOM::Document> document = nullptr;
     std::unique_ptr<Style::StyledNode> style_root = nullptr;
-    std::unique_ptr<Layout::LayoutBox> layout_root = nullptr;
+    // Kept across navigations so its arrays are reused.
+    Layout::LayoutTree layout_tree;
+    // Page text is drawn sharp at every size from a glyph atlas of the first system
+    // font found, or else scaled from ImGui's built-in font.
+    GlyphAtlas glyph_atlas;
+    for (const char* path : { "C:/Windows/Fonts/segoeui.ttf", "C:/Windows/Fonts/arial.ttf",
+                              "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf", "/System/Library/Fonts/Supplemental/Arial.ttf" }) {
+        if (glyph_atlas.load(path)) {
+            std::cout << "[Text] Glyph atlas font: " << path << std::endl;
+            break;
+        }
+    }
+    ImGuiFontMetrics font_metrics;
+    const Layout::FontMetrics& text_metrics =
+        glyph_atlas.loaded() ? static_cast<const Layout::FontMetrics&>(glyph_atlas) : font_metrics;
+    // Measured text, kept across navigations too.
+    Layout::TextRunCache text_cache(text_metrics);
+    // Where the laid out boxes are, for painting only the visible ones and hit testing.
+    Layout::SpatialIndex box_index;
+    std::vector<Layout::BoxId> visible_boxes;
+    // Rebuilt with the index, and after a restyle, which can change colors without
+    // changing layout.
+    Paint::DisplayList display_list;
+    bool display_list_stale = false;
+    Layout::LayoutStats layout_stats;
+    // Author sheets of the current page in document order; they follow the built-in
+    // sheet so they win ties.
+    std::vector<std::shared_ptr<const CSS::Stylesheet>> author_sheets;
+
+    // Styles the current document and points the layout tree at the new styles, so
+    // only boxes whose style or content changed are laid out again.
+    auto restyle_document = [&]() {
+        std::vector<const CSS::Stylesheet*> stylesheets{ &CSS::user_agent_stylesheet() };
+        for (const auto& sheet : author_sheets) stylesheets.push_back(sheet.get());
+        Style::RuleIndex rules(stylesheets);
+        Style::StyleStats style_stats;
+        auto new_style_root = Style::parallel_style_tree(document->root(), rules, Engine::ThreadPool::shared(), &style_stats);
+        std::cout << "[Style] Selectors tested: " << style_stats.selectors_tested << ", with combinators: "
+                  << style_stats.complex_selectors_tested << ", rejected by ancestor filter: "
+                  << style_stats.rejected_by_filter << std::endl;
+        std::cout << "[Style] Shared styles: " << style_stats.sharing_hits << " hits, " << style_stats.sharing_misses
+                  << " misses, " << style_stats.sharing_ineligible_id << " with ids; rejected by parent "
+                  << style_stats.sharing_rejected_parent << ", tag " << style_stats.sharing_rejected_tag
+                  << ", classes " << style_stats.sharing_rejected_classes << std::endl;
+        Style::StyleMemory style_memory = Style::measure_style_memory(*new_style_root);
+        std::cout << "[Style] Memory: " << style_memory.bytes / 1024 << " KB for " << style_memory.nodes << " nodes; "
+                  << style_memory.styles << " styles, " << style_memory.inherited_groups << " inherited, "
+                  << style_memory.box_groups << " box and " << style_memory.background_groups
+                  << " background groups" << std::endl;
+        // The layout tree still points at the old styles, which it compares against.
+        layout_tree.update(*new_style_root);
+        style_root = std::move(new_style_root);
+        display_list_stale = true;
+    };
 
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
 
         if (ui_state.load_requested) {
+            HTML::Parser html_parser;
             std::string html_source;
             std::string current_url = ui_state.url_to_load;
 
+            // Start fetching stylesheets and scripts as soon as their tags stream in,
+            // instead of after the whole page has been parsed.
+            network_process.discard_prefetches();
+            HTML::PreloadScanner preload_scanner([&](const HTML::PreloadRequest& preload) {
+                if (preload.type != HTML::PreloadType::Image) {
+                    network_process.prefetch(Net::resolve_url(current_url, preload.url));
+                }
+            });
+
             if (current_url == "js_test.html") {
                 html_source = R"(
                     <div id="main">
@@ -138,6 +204,32 @@ int main() {
                         </script>
                     </div>
                 )";
+            } else if (current_url == "js_bench.html") {
+                // Results go to the dev console and replace the first line.
+                html_source = R"(
+                    <div id="main">
+                        <h1 id="title">JS DOM Lookup Benchmark</h1>
+                        <p id="result">Running...</p>
+                        <ul><li>One</li><li>Two</li><li>Three</li><li>Four</li><li>Five</li>
+                            <li>Six</li><li>Seven</li><li>Eight</li><li>Nine</li><li>Ten</li></ul>
+                        <script>
+                            var result = document.getElementById('result');
+                            var start = Date.now();
+                            var same = 0;
+                            for (var i = 0; i < 100000; i++) {
+                                if (document.getElementById('result') === result) same++;
+                            }
+                            var by_id_ms = Date.now() - start;
+                            start = Date.now();
+                            var found = 0;
+                            for (var i = 0; i < 10000; i++) found += document.getElementsByTagName('li').length;
+                            var by_tag_ms = Date.now() - start;
+                            console.log("100000 getElementById: " + by_id_ms + " ms, " + same + " returned the same object");
+                            console.log("10000 getElementsByTagName of 10 items: " + by_tag_ms + " ms, " + found + " items");
+                            result.innerHTML = "getElementById: " + by_id_ms + " ms per 100000, getElementsByTagName: " + by_tag_ms + " ms per 10000";
+                        </script>
+                    </div>
+                )";
             } else if (current_url == "flexbox.html") {
                  html_source = R"(
                     <div id="header">
@@ -149,53 +241,74 @@ int main() {
                 )";
             }
             else {
-                auto resource = network_process.request(current_url);
-                if (resource) { html_source = resource->data; }
-                else { html_source = "<h1>Error</h1><p>Page failed to load or was blocked.</p>"; }
+                // Feed the parser as the body arrives rather than waiting for all of it.
+                auto resource = network_process.request(current_url, [&](std::string_view chunk) {
+                    preload_scanner.feed(chunk);
+                    html_parser.feed(chunk);
+                });
+                if (!resource) { html_source = "<h1>Error</h1><p>Page failed to load or was blocked.</p>"; }
             }
-            
-            std::string css_source = R"(
-                div, h1, p, h2, h3, dt, dd, li, a { display: block; }
-                h1 { font-size: 32px; color: #00ff00; margin-top: 10px; margin-bottom: 10px; }
-                h2 { font-size: 28px; color: #00dd00; margin-top: 8px; margin-bottom: 8px; }
-                h3 { font-size: 24px; color: #00bb00; margin-top: 6px; margin-bottom: 6px; }
-                p, li, dt, dd { font-size: 16px; color: #cccccc; margin-bottom: 8px; }
-                a { color: #8888ff; }
-                #main { background-color: #333333; padding: 20px; }
-                #msg { color: #ff8888; }
-                script { display: none; }
-                #header { display: flex; justify-content: space-between; background-color: #444444; height: 60px; padding-left: 20px; padding-right: 20px; }
-                #logo { display: block; color: #00ff00; font-size: 32px; height: 40px; width: 300px; }
-                #nav { display: flex; justify-content: flex-end; width: 400px; }
-                #nav p { display: block; color: #cccccc; font-size: 20px; margin-left: 15px; height: 30px; width: 80px; }
-            )";
+            author_sheets.clear();
 
-            HTML::Parser html_parser(html_source);
-            auto dom_nodes = html_parser.parse_nodes();
-            if (!dom_nodes.empty()) {
-                dom_root_owner = std::move(dom_nodes[0]);
-                js_engine.set_document(dom_root_owner.get());
+            preload_scanner.feed(html_source);
+            preload_scanner.finish();
+            html_parser.feed(html_source);
+            auto parsed_document = html_parser.finish();
+            if (parsed_document->root()) {
+                // The old style and layout trees point into the old document's arena.
+                layout_tree.clear();
+                box_index.clear();
+                display_list.clear();
+                style_root = nullptr;
+                document = std::move(parsed_document);
+                js_engine.set_document(document.get());
 
-                std::function<void(DOM::Node*)> execute_scripts = 
+                std::function<void(DOM::Node*)> run_scripts_and_load_styles = 
                     [&](DOM::Node* node) {
-                    if (node->type == DOM::NodeType::Element && node->element_data.tag_name == "script") {
-                        if (!node->children.empty() && node->children[0]->type == DOM::NodeType::Text) {
-                            js_engine.run_script(node->children[0]->text_data);
+                    if (node->type == DOM::NodeType::Element && node->element_data.tag == DOM::Atoms::script) {
+                        std::string_view src = node->element_data.get_attribute(DOM::Atoms::src);
+                        if (!src.empty()) {
+                            auto script = network_process.request(Net::resolve_url(current_url, src));
+                            if (script && script->ok()) js_engine.run_script(script->data);
+                        } else if (node->first_child && node->first_child->type == DOM::NodeType::Text) {
+                            js_engine.run_script(std::string(node->first_child->text_data));
                         }
                     }
-                    for (auto& child : node->children) {
-                        execute_scripts(child.get());
+                    if (node->type == DOM::NodeType::Element && node->element_data.tag == DOM::Atoms::link &&
+                        HTML::is_stylesheet_link(node->element_data.get_attribute(DOM::Atoms::rel))) {
+                        std::string_view href = node->element_data.get_attribute(DOM::Atoms::href);
+                        if (!href.empty()) {
+                            auto sheet = network_process.request(Net::resolve_url(current_url, href));
+                            // A failed fetch carries our error page, which is neither CSS
+                            // nor worth caching.
+                            if (sheet && sheet->ok()) author_sheets.push_back(stylesheet_cache.get(sheet->data));
+                        }
+                    }
+                    for (DOM::Node* child : node->children()) {
+                        run_scripts_and_load_styles(child);
                     }
                 };
-                execute_scripts(dom_root_owner.get());
+                run_scripts_and_load_styles(document->root());
 
-                CSS::Parser css_parser(css_source);
-                auto stylesheet = css_parser.parse_stylesheet();
-                style_root = Style::style_tree(dom_root_owner.get(), stylesheet);
+                restyle_document();
             } else {
+                layout_tree.clear();
+                box_index.clear();
+                display_list.clear();
                 style_root = nullptr;
             }
+            CSS::StylesheetCacheStats sheet_cache = stylesheet_cache.stats();
+            std::cout << "[CSS] Stylesheet cache: " << sheet_cache.memory_hits << " memory hits, " << sheet_cache.disk_hits
+                      << " disk hits, " << sheet_cache.parsed << " parsed" << std::endl;
+            Net::PrefetchStats prefetch = network_process.prefetch_stats();
+            std::cout << "[Network] Prefetches: " << prefetch.issued << " issued, " << prefetch.hits
+                      << " hits, " << prefetch.wasted << " wasted" << std::endl;
             ui_state.load_requested = false;
+            ui_state.restyle_requested = false;
+        }
+        if (ui_state.restyle_requested) {
+            if (document && document->root()) restyle_document();
+            ui_state.restyle_requested = false;
         }
 
         ImGui_ImplOpenGL3_NewFrame();
@@ -219,6 +332,11 @@ int main() {
                     ui_state.url_to_load = "js_test.html";
                     ui_state.load_requested = true;
                 }
+                if (ImGui::MenuItem("JS DOM Lookup Benchmark")) {
+                    strcpy(ui_state.address_bar_text, "js_bench.html");
+                    ui_state.url_to_load = "js_bench.html";
+                    ui_state.load_requested = true;
+                }
                 if (ImGui::MenuItem("Flexbox Test")) {
                     strcpy(ui_state.address_bar_text, "flexbox.html");
                     ui_state.url_to_load = "flexbox.html";
@@ -242,16 +360,71 @@ int main() {
                 ImGui::PopItemWidth();
 
                 ImGui::BeginChild("ContentView", ImVec2(0, -ImGui::GetFrameHeightWithSpacing()), true);
-                if (style_root) {
-                    Layout::Dimensions viewport;
+                layout_stats = Layout::LayoutStats();
+                visible_boxes.clear();
+                Layout::HitTestResult hovered;
+                size_t items_replayed = 0;
+                double replay_ms = 0.0;
+                if (!layout_tree.empty()) {
+                    Layout::Rect viewport;
                     viewport.width = ImGui::GetContentRegionAvail().x;
                     viewport.height = ImGui::GetContentRegionAvail().y;
-                    layout_root = Layout::layout_tree(*style_root, viewport);
+                    layout_tree.parallel_layout(viewport, text_cache, Engine::ThreadPool::shared(), &layout_stats);
+                    if (layout_stats.boxes_laid_out > 0 || layout_stats.boxes_moved > 0) {
+                        box_index.build(layout_tree);
+                        display_list_stale = true;
+                    }
+                    if (display_list_stale) {
+                        display_list.build(layout_tree);
+                        display_list_stale = false;
+                    }
+
+                    // The scroll position and window size, in page coordinates.
+                    Layout::Rect visible;
+                    visible.x = ImGui::GetScrollX();
+                    visible.y = ImGui::GetScrollY();
+                    visible.width = ImGui::GetWindowSize().x;
+                    visible.height = ImGui::GetWindowSize().y;
+                    box_index.query(visible, visible_boxes);
+
                     ImDrawList* draw_list = ImGui::GetWindowDrawList();
                     ImVec2 viewport_pos = ImGui::GetCursorScreenPos();
-                    render_layout_box(layout_root.get(), draw_list, viewport_pos);
+                    auto replay_start = std::chrono::steady_clock::now();
+                    items_replayed = replay_display_list(display_list, visible_boxes, draw_list, viewport_pos, glyph_atlas);
+                    replay_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - replay_start).count();
+                    if (ImGui::IsWindowHovered()) {
+                        ImVec2 mouse = ImGui::GetMousePos();
+                        hovered = box_index.hit_test(layout_tree, mouse.x - viewport_pos.x, mouse.y - viewport_pos.y);
+                    }
+                    // Gives the view the page's size, so it scrolls.
+                    const Layout::Rect& page = layout_tree.rect(layout_tree.root());
+                    ImGui::Dummy(ImVec2(page.width, page.height));
                 }
                 ImGui::EndChild();
+                ImGui::Text("Layout: %zu boxes laid out, %zu moved, %zu reused this frame in %.2f ms", layout_stats.boxes_laid_out,
+                            layout_stats.boxes_moved, layout_stats.boxes_reused, layout_stats.layout_ms);
+                size_t text_runs = layout_stats.text_runs_kept + layout_stats.text_cache_hits + layout_stats.text_runs_measured;
+                if (text_runs > 0) {
+                    ImGui::SameLine();
+                    ImGui::Text("| Text: %zu runs kept, %zu cache hits, %zu measured in %.2f ms (%.0f%% reused)",
+                                layout_stats.text_runs_kept, layout_stats.text_cache_hits, layout_stats.text_runs_measured,
+                                layout_stats.text_measure_ms, 100.0 * (text_runs - layout_stats.text_runs_measured) / text_runs);
+                }
+                ImGui::SameLine();
+                ImGui::Text("| Painted %zu of %zu boxes: %zu of %zu display items in %.3f ms", visible_boxes.size(), box_index.size(),
+                            items_replayed, display_list.items().size(), replay_ms);
+                if (glyph_atlas.loaded()) {
+                    const GlyphAtlasStats& glyphs = glyph_atlas.stats();
+                    ImGui::SameLine();
+                    ImGui::Text("| Glyphs: %zu on %zu pages, %.0f%% full, %zu misses, %zu evictions, %zu draw calls",
+                                glyphs.glyphs, glyphs.pages, 100.0f * glyphs.occupancy, glyphs.misses, glyphs.evictions,
+                                glyphs.draw_calls);
+                }
+                if (hovered.node) {
+                    std::string_view name = hovered.node->type == DOM::NodeType::Element ? hovered.node->element_data.tag_name() : "#text";
+                    ImGui::SameLine();
+                    ImGui::Text("| Under mouse: %.*s", static_cast<int>(name.size()), name.data());
+                }
                 ImGui::EndTabItem();
             }
             if (ImGui::BeginTabItem("+")) { ImGui::EndTabItem(); }
@@ -270,7 +443,7 @@ int main() {
             ImGui::PushItemWidth(-1);
             if (ImGui::InputText("##ConsoleInput", ui_state.console_input_buffer, sizeof(ui_state.console_input_buffer), ImGuiInputTextFlags_EnterReturnsTrue)) {
                 js_engine.run_script(ui_state.console_input_buffer);
-                ui_state.load_requested = true;
+                ui_state.restyle_requested = true;
                 strcpy(ui_state.console_input_buffer, "");
             }
             ImGui::PopItemWidth();
@@ -294,6 +467,7 @@ int main() {
         glfwSwapBuffers(window);
     }
 
+    glyph_atlas.release();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();